@@ -0,0 +1,247 @@
+#include "DamageFilter.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#define DAMAGEFILTER_CRC32 1
+#include <immintrin.h>
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+namespace {
+
+// xxHash64と同じ乗数と1ラウンド
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t mix(uint64_t acc, uint64_t v)
+{
+	acc += v * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+inline uint64_t load64(uchar const *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t load32(uchar const *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+quint64 hashScalar(uchar const *bits, size_t row_bytes, int rows, qsizetype stride)
+{
+	uint64_t a = PRIME1;
+	uint64_t b = PRIME2;
+	for (int y = 0; y < rows; y++) {
+		uchar const *p = bits + y * stride;
+		size_t i = 0;
+		for (; i + 16 <= row_bytes; i += 16) {
+			a = mix(a, load64(p + i));
+			b = mix(b, load64(p + i + 8));
+		}
+		for (; i < row_bytes; i++) {
+			a = mix(a, p[i]);
+		}
+	}
+	uint64_t h = a ^ rotl(b, 32);
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+#ifdef DAMAGEFILTER_CRC32
+// CRC32Cの命令で偶数番目と奇数番目の8バイトを別々に畳み込み、64ビットにする
+TARGET_SSE42 quint64 hashSSE42(uchar const *bits, size_t row_bytes, int rows, qsizetype stride)
+{
+	uint64_t a = 0x9E3779B9;
+	uint64_t b = 0x85EBCA6B;
+	for (int y = 0; y < rows; y++) {
+		uchar const *p = bits + y * stride;
+		size_t i = 0;
+		for (; i + 16 <= row_bytes; i += 16) {
+			a = _mm_crc32_u64(a, load64(p + i));
+			b = _mm_crc32_u64(b, load64(p + i + 8));
+		}
+		for (; i + 4 <= row_bytes; i += 4) {
+			a = _mm_crc32_u32((uint32_t)a, load32(p + i));
+		}
+		for (; i < row_bytes; i++) {
+			a = _mm_crc32_u8((uint32_t)a, p[i]);
+		}
+	}
+	return (a << 32) | (b & 0xffffffff);
+}
+
+bool detectCrc32()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+bool const has_crc32 = detectCrc32();
+#endif
+
+quint64 pixelCount(const QRegion &region)
+{
+	quint64 n = 0;
+	for (QRect const &r : region) {
+		n += (quint64)r.width() * r.height();
+	}
+	return n;
+}
+
+} // namespace
+
+/**
+ * @brief 画像の矩形の内容のハッシュ（0にはならない）
+ * @param bits 矩形の左上
+ * @param row_bytes 1行のバイト数
+ * @param rows 行数
+ * @param stride 行の間隔
+ */
+quint64 DamageFilter::hash(uchar const *bits, int row_bytes, int rows, qsizetype stride)
+{
+	quint64 h;
+#ifdef DAMAGEFILTER_CRC32
+	if (has_crc32) {
+		h = hashSSE42(bits, row_bytes, rows, stride);
+	} else
+#endif
+	{
+		h = hashScalar(bits, row_bytes, rows, stride);
+	}
+	return h ? h : 1;
+}
+
+/**
+ * @brief ハッシュと統計を捨てる（接続し直す時）
+ */
+void DamageFilter::reset()
+{
+	size_ = {};
+	columns_ = 0;
+	hashes_.clear();
+	stats_.checked_pixels = 0;
+	stats_.skipped_pixels = 0;
+	stats_.skipped_frames = 0;
+}
+
+void DamageFilter::resize(QSize size)
+{
+	size_ = size;
+	columns_ = (size.width() + TILE_SIZE - 1) / TILE_SIZE;
+	int rows = (size.height() + TILE_SIZE - 1) / TILE_SIZE;
+	hashes_.assign((size_t)columns_ * rows, 0);
+}
+
+/**
+ * @brief regionに触れるタイルの番号をtiles_に並べる（行順、重複なし）
+ */
+void DamageFilter::collectTiles(const QRegion &region)
+{
+	tiles_.clear();
+	QRect bounds(QPoint(0, 0), size_);
+	for (QRect r : region) {
+		r &= bounds;
+		if (r.isEmpty()) continue;
+		int x0 = r.left() / TILE_SIZE;
+		int x1 = r.right() / TILE_SIZE;
+		int y0 = r.top() / TILE_SIZE;
+		int y1 = r.bottom() / TILE_SIZE;
+		for (int ty = y0; ty <= y1; ty++) {
+			for (int tx = x0; tx <= x1; tx++) {
+				tiles_.push_back(ty * columns_ + tx);
+			}
+		}
+	}
+	std::sort(tiles_.begin(), tiles_.end());
+	tiles_.erase(std::unique(tiles_.begin(), tiles_.end()), tiles_.end());
+}
+
+QRect DamageFilter::tileRect(int index) const
+{
+	QRect r((index % columns_) * TILE_SIZE, (index / columns_) * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+	return r & QRect(QPoint(0, 0), size_);
+}
+
+quint64 DamageFilter::tileHash(const QImage &image, const QRect &rect) const
+{
+	int bpp = image.depth() / 8;
+	uchar const *bits = image.constBits() + rect.y() * image.bytesPerLine() + rect.x() * bpp;
+	return hash(bits, rect.width() * bpp, rect.height(), image.bytesPerLine());
+}
+
+/**
+ * @brief 無効領域から、前回から内容が変わっていないタイルを取り除く
+ * @param image 公開しようとしている画面
+ * @param damage 画面の無効領域
+ * @return 内容が変わったタイルに限った無効領域
+ */
+QRegion DamageFilter::filter(const QImage &image, const QRegion &damage)
+{
+	if (damage.isEmpty()) return damage;
+	if (image.size() != size_) {
+		resize(image.size());
+	}
+
+	collectTiles(damage);
+	QRegion unchanged;
+	for (int index : tiles_) {
+		QRect r = tileRect(index);
+		quint64 h = tileHash(image, r);
+		if (h == hashes_[index]) {
+			unchanged += r;
+		} else {
+			hashes_[index] = h;
+		}
+	}
+
+	quint64 checked = pixelCount(damage);
+	stats_.checked_pixels += checked;
+	if (unchanged.isEmpty()) return damage;
+
+	QRegion result = damage.subtracted(unchanged);
+	stats_.skipped_pixels += checked - pixelCount(result);
+	if (result.isEmpty()) {
+		stats_.skipped_frames++;
+	}
+	return result;
+}
+
+/**
+ * @brief 無効領域に触れるタイルのハッシュを計算し直すだけで、取り除かない
+ *
+ * 移動と一緒に公開する場合のように、無効領域をそのまま渡す必要がある時に使う。
+ */
+void DamageFilter::update(const QImage &image, const QRegion &damage)
+{
+	if (image.size() != size_) {
+		resize(image.size());
+	}
+	collectTiles(damage);
+	for (int index : tiles_) {
+		hashes_[index] = tileHash(image, tileRect(index));
+	}
+}
+
+DamageFilter::Stats const &DamageFilter::stats() const
+{
+	return stats_;
+}
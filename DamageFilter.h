@@ -0,0 +1,47 @@
+#ifndef DAMAGEFILTER_H
+#define DAMAGEFILTER_H
+
+#include <QImage>
+#include <QRegion>
+#include <QSize>
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief 内容が変わっていないタイルを無効領域から取り除くフィルタ
+ *
+ * 最後に公開した画面をTILE_SIZE四方のタイルに分け、タイルごとに内容の
+ * ハッシュを持っておく。無効領域に触れたタイルのハッシュを計算し直し、
+ * 同じだったタイルは無効領域から外す。同じ画素を描き直しただけの更新
+ * （キャレットの点滅、同じ内容のタイルの再送など）は表示側に渡らない。
+ * filter()/update()はRDPスレッドからのみ呼ぶこと。
+ */
+class DamageFilter {
+public:
+	static constexpr int TILE_SIZE = 64;
+	struct Stats {
+		std::atomic<quint64> checked_pixels { 0 }; // ハッシュで調べた無効領域の画素数
+		std::atomic<quint64> skipped_pixels { 0 }; // そのうち内容が変わっていなかった画素数
+		std::atomic<quint64> skipped_frames { 0 }; // 無効領域がすべて取り除かれて公開しなかった回数
+	};
+private:
+	QSize size_;
+	int columns_ = 0;
+	std::vector<quint64> hashes_; // 0なら未計算
+	std::vector<int> tiles_; // 作業用
+	Stats stats_;
+
+	void resize(QSize size);
+	void collectTiles(const QRegion &region);
+	QRect tileRect(int index) const;
+	quint64 tileHash(const QImage &image, const QRect &rect) const;
+public:
+	void reset();
+	QRegion filter(const QImage &image, const QRegion &damage);
+	void update(const QImage &image, const QRegion &damage);
+	Stats const &stats() const;
+
+	static quint64 hash(uchar const *bits, int row_bytes, int rows, qsizetype stride);
+};
+
+#endif // DAMAGEFILTER_H
@@ -0,0 +1,160 @@
+#include "ExportBenchmark.h"
+#include "ExportClient.h"
+#include "FramebufferExport.h"
+#include "FramebufferPool.h"
+#include "Histogram.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+constexpr int RECT_SIZE = 256; // 1フレームで書き換える矩形
+constexpr int MAX_FRAMES = 1 << 20;
+constexpr int DURATION_MS = 3000;
+
+qint64 now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double ms(quint64 us)
+{
+	return us / 1000.0;
+}
+
+} // namespace
+
+/**
+ * @brief フレームバッファの公開の速さを測る
+ *
+ * Rapsodia --bench-export で実行する。共有メモリの画面に矩形を書いては
+ * FramebufferExportで公開するスレッドと、ExportClientで受け取って無効領域の
+ * 画素を読むスレッドを同時に動かし、受け取れたフレーム数と、公開してから
+ * 読み終わるまでの時間を測る。サーバーには接続しない。
+ */
+int runExportBenchmark()
+{
+	FramebufferPool pool;
+	pool.setShared(true);
+	QImage image = pool.image(QSize(WIDTH, HEIGHT), QImage::Format_RGB32);
+	if (image.isNull() || pool.fd() < 0) {
+		fprintf(stderr, "failed to allocate shared framebuffer\n");
+		return 1;
+	}
+	image.fill(Qt::black);
+
+#ifdef _WIN32
+	QString name = "rapsodia-bench-export";
+#else
+	QString name = QString("rapsodia-bench-export-%1").arg(getpid());
+#endif
+	FramebufferExport exporter;
+	if (!exporter.listen(name)) {
+		fprintf(stderr, "failed to listen %s\n", name.toUtf8().constData());
+		return 1;
+	}
+	exporter.setBuffer(pool.fd(), pool.bytes(), pool.stride(), image.format());
+
+	std::vector<std::atomic<qint64>> published(MAX_FRAMES);
+	std::atomic<quint64> produced { 0 };
+	std::atomic<bool> producing { true };
+	Histogram latency;
+	std::atomic<quint64> received { 0 };
+	std::atomic<quint64> read_pixels { 0 };
+	std::atomic<bool> consumer_done { false };
+	std::atomic<quint64> consumed_sequence { 0 };
+
+	// 受け取る側
+	std::thread consumer([&](){
+		ExportClient client;
+		if (client.connectTo(name)) {
+			ExportClient::Frame frame;
+			quint32 checksum = 0;
+			while (client.next(&frame)) {
+				quint64 pixels = 0;
+				for (QRect const &r : frame.damage) {
+					for (int y = r.top(); y <= r.bottom(); y++) {
+						auto const *p = reinterpret_cast<quint32 const *>(client.bits() + y * client.stride()) + r.left();
+						for (int x = 0; x < r.width(); x++) {
+							checksum ^= p[x];
+						}
+					}
+					pixels += (quint64)r.width() * r.height();
+				}
+				if (frame.sequence >= 1 && frame.sequence <= MAX_FRAMES) {
+					qint64 t = published[frame.sequence - 1].load();
+					if (t > 0) {
+						latency.record(now() - t);
+					}
+				}
+				consumed_sequence = frame.sequence;
+				received++;
+				read_pixels += pixels;
+				if (!producing && frame.sequence >= produced) break;
+			}
+			(void)checksum;
+		}
+		consumer_done = true;
+	});
+
+	// 受け取る側がつながるのを待つ
+	QElapsedTimer wait;
+	wait.start();
+	while (exporter.stats().clients.load() == 0 && !consumer_done && wait.elapsed() < 5000) {
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+	}
+
+	// 書き込む側（RDPスレッドの代わり）
+	QElapsedTimer elapsed;
+	elapsed.start();
+	std::thread producer([&](){
+		int columns = WIDTH / RECT_SIZE;
+		int rows = HEIGHT / RECT_SIZE;
+		for (quint64 i = 0; i < MAX_FRAMES && elapsed.elapsed() < DURATION_MS; i++) {
+			QRect r(((int)i % columns) * RECT_SIZE, ((int)(i / columns) % rows) * RECT_SIZE, RECT_SIZE, RECT_SIZE);
+			quint32 value = (quint32)i * 0x9e3779b1u;
+			for (int y = r.top(); y <= r.bottom(); y++) {
+				auto *p = reinterpret_cast<quint32 *>(image.scanLine(y)) + r.left();
+				std::fill(p, p + r.width(), value);
+			}
+			published[i] = now();
+			exporter.publishFrame(image.size(), r);
+			produced = i + 1;
+			// GUIスレッドのキューが際限なく伸びないように、受け取る側が大きく遅れたら待つ
+			while (i + 1 > consumed_sequence + 1024 && !consumer_done && elapsed.elapsed() < DURATION_MS) {
+				QThread::yieldCurrentThread();
+			}
+		}
+		producing = false;
+	});
+
+	while (!consumer_done) {
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+		if (!producing && elapsed.elapsed() > DURATION_MS + 2000) break;
+	}
+	producer.join();
+	double seconds = elapsed.nsecsElapsed() / 1e9;
+	exporter.close();
+	consumer.join();
+
+	quint64 frames = produced;
+	auto const &stats = exporter.stats();
+	printf("buffer      %dx%d RGB32, %.1f MB shared (fd %d)\n", WIDTH, HEIGHT, pool.bytes() / 1048576.0, pool.fd());
+	printf("frames      %llu published, %llu messages, %llu received\n", (unsigned long long)frames, (unsigned long long)stats.messages.load(), (unsigned long long)received.load());
+	printf("throughput  %.1f frames/s published, %.1f messages/s received, %.1f Mpx/s read\n", frames / seconds, received / seconds, read_pixels / 1e6 / seconds);
+	printf("latency     p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", ms(latency.percentile(50)), ms(latency.percentile(99)), ms(latency.max()));
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef EXPORTBENCHMARK_H
+#define EXPORTBENCHMARK_H
+
+int runExportBenchmark();
+
+#endif // EXPORTBENCHMARK_H
@@ -0,0 +1,230 @@
+#include "ExportClient.h"
+#include "FramebufferExport.h"
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+ExportClient::~ExportClient()
+{
+	close();
+}
+
+/**
+ * @brief FramebufferExportのソケットに接続する
+ * @param name FramebufferExport::listen()に渡した名前
+ */
+bool ExportClient::connectTo(const QString &name)
+{
+#ifdef _WIN32
+	(void)name;
+	return false;
+#else
+	close();
+	QByteArray path = FramebufferExport::socketPath(name).toLocal8Bit();
+	sockaddr_un addr {};
+	if ((size_t)path.size() >= sizeof(addr.sun_path)) return false;
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.constData(), (size_t)path.size());
+
+	socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket_ < 0) return false;
+	if (::connect(socket_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+		close();
+		return false;
+	}
+	return true;
+#endif
+}
+
+void ExportClient::close()
+{
+	unmap();
+#ifndef _WIN32
+	if (received_fd_ >= 0) {
+		::close(received_fd_);
+		received_fd_ = -1;
+	}
+	if (socket_ >= 0) {
+		::close(socket_);
+		socket_ = -1;
+	}
+#endif
+	input_.clear();
+}
+
+void ExportClient::unmap()
+{
+#ifndef _WIN32
+	if (map_) {
+		munmap(map_, map_size_);
+	}
+#endif
+	map_ = nullptr;
+	map_size_ = 0;
+	stride_ = 0;
+	layout_.clear();
+}
+
+/**
+ * @brief 1行読む（行が揃うまで待つ）
+ * @return 切断した場合はfalse
+ */
+bool ExportClient::readLine(QByteArray *line)
+{
+	while (1) {
+		int i = input_.indexOf('\n');
+		if (i >= 0) {
+			*line = input_.left(i);
+			input_.remove(0, i + 1);
+			return true;
+		}
+		char tmp[65536];
+		qint64 n = FramebufferExport::receiveDescriptor(socket_, tmp, sizeof(tmp), &received_fd_);
+		if (n <= 0) return false;
+		input_.append(tmp, (qsizetype)n);
+	}
+}
+
+/**
+ * @brief bufferメッセージ：添付されていた共有メモリをマップし直す
+ */
+bool ExportClient::applyBuffer(const QJsonObject &json)
+{
+	unmap();
+	size_t size = (size_t)json["size"].toInteger();
+	if (size == 0) return true;
+	if (received_fd_ < 0) return false;
+#ifdef _WIN32
+	return false;
+#else
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, received_fd_, 0);
+	::close(received_fd_);
+	received_fd_ = -1;
+	if (p == MAP_FAILED) return false;
+	map_ = static_cast<uchar *>(p);
+	map_size_ = size;
+	stride_ = (qsizetype)json["stride"].toInteger();
+	layout_ = json["format"].toString().toLatin1();
+	return true;
+#endif
+}
+
+/**
+ * @brief 次のフレームを待つ
+ * @return 切断した場合はfalse
+ */
+bool ExportClient::next(Frame *out)
+{
+	QByteArray line;
+	while (readLine(&line)) {
+		QJsonObject json = QJsonDocument::fromJson(line).object();
+		QString type = json["type"].toString();
+		if (type == "buffer") {
+			if (!applyBuffer(json)) return false;
+		} else if (type == "frame" && map_) {
+			out->sequence = (quint64)json["sequence"].toInteger();
+			out->size = QSize(json["width"].toInt(), json["height"].toInt());
+			out->damage.clear();
+			for (QJsonValue const &v : json["damage"].toArray()) {
+				QJsonArray a = v.toArray();
+				out->damage.push_back(QRect(a[0].toInt(), a[1].toInt(), a[2].toInt(), a[3].toInt()));
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief 画面の先頭（マップしていなければnullptr）
+ */
+uchar const *ExportClient::bits() const
+{
+	return map_;
+}
+
+qsizetype ExportClient::stride() const
+{
+	return stride_;
+}
+
+/**
+ * @brief 画素のバイトの並び（"BGRX"または"RGBX"）
+ */
+QByteArray ExportClient::layout() const
+{
+	return layout_;
+}
+
+/**
+ * @brief マップした画面をコピーせずにQImageとして参照する
+ */
+QImage ExportClient::image(QSize size) const
+{
+	if (!map_ || (size_t)stride_ * size.height() > map_size_) return {};
+	QImage::Format format = layout_ == "RGBX" ? QImage::Format_RGBX8888 : QImage::Format_RGB32;
+	return QImage(map_, size.width(), size.height(), stride_, format);
+}
+
+/**
+ * @brief 公開された画面を読み続け、1秒ごとに受け取った量を表示する
+ *
+ * Rapsodia --export-consumer <name> で実行する。外部のプロセスが画面を読む
+ * 場合の見本で、無効領域の画素を実際に読む（チェックサムを計算する）。
+ */
+int runExportConsumer(const QString &name)
+{
+	ExportClient client;
+	if (!client.connectTo(name)) {
+		fprintf(stderr, "failed to connect %s\n", FramebufferExport::socketPath(name).toUtf8().constData());
+		return 1;
+	}
+
+	quint64 frames = 0;
+	quint64 skipped = 0; // まとめて送られたため受け取らなかった番号の数
+	quint64 pixels = 0;
+	quint64 last_sequence = 0;
+	quint32 checksum = 0;
+	QElapsedTimer elapsed;
+	elapsed.start();
+	ExportClient::Frame frame;
+	while (client.next(&frame)) {
+		if (last_sequence > 0 && frame.sequence > last_sequence + 1) {
+			skipped += frame.sequence - last_sequence - 1;
+		}
+		last_sequence = frame.sequence;
+		frames++;
+		for (QRect const &r : frame.damage) {
+			for (int y = r.top(); y <= r.bottom(); y++) {
+				auto const *p = reinterpret_cast<quint32 const *>(client.bits() + y * client.stride()) + r.left();
+				for (int x = 0; x < r.width(); x++) {
+					checksum ^= p[x];
+				}
+			}
+			pixels += (quint64)r.width() * r.height();
+		}
+		if (elapsed.elapsed() >= 1000) {
+			double seconds = elapsed.nsecsElapsed() / 1e9;
+			printf("%dx%d %s  %llu frames (%llu coalesced), %.1f Mpx/s, %.1f MB/s read, checksum %08x\n",
+				   frame.size.width(), frame.size.height(), client.layout().constData(),
+				   (unsigned long long)frames, (unsigned long long)skipped,
+				   pixels / 1e6 / seconds, pixels * 4 / 1048576.0 / seconds, checksum);
+			fflush(stdout);
+			frames = 0;
+			skipped = 0;
+			pixels = 0;
+			elapsed.restart();
+		}
+	}
+	return 0;
+}
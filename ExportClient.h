@@ -0,0 +1,55 @@
+#ifndef EXPORTCLIENT_H
+#define EXPORTCLIENT_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+class QJsonObject;
+
+/**
+ * @brief FramebufferExportで公開された画面を読む側（外部のプロセスの見本）
+ *
+ * ローカルソケットで受け取った共有メモリをmmapし、frameメッセージの無効領域を
+ * コピーせずに読む。Qtのソケットは添付されたfdを捨てるので、recvmsgで直接読む。
+ * 1つのスレッドから使うこと。
+ */
+class ExportClient {
+public:
+	struct Frame {
+		quint64 sequence = 0;
+		QSize size;
+		QVector<QRect> damage;
+	};
+private:
+	int socket_ = -1;
+	int received_fd_ = -1; // 受け取ったが、まだbufferメッセージを読んでいないfd
+	uchar *map_ = nullptr;
+	size_t map_size_ = 0;
+	qsizetype stride_ = 0;
+	QByteArray layout_;
+	QByteArray input_; // 読みかけのデータ
+
+	bool readLine(QByteArray *line);
+	bool applyBuffer(const QJsonObject &json);
+	void unmap();
+public:
+	ExportClient() = default;
+	ExportClient(const ExportClient &) = delete;
+	ExportClient &operator=(const ExportClient &) = delete;
+	~ExportClient();
+	bool connectTo(const QString &name);
+	void close();
+	bool next(Frame *out);
+	uchar const *bits() const;
+	qsizetype stride() const;
+	QByteArray layout() const;
+	QImage image(QSize size) const;
+};
+
+int runExportConsumer(const QString &name);
+
+#endif // EXPORTCLIENT_H
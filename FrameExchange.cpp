@@ -0,0 +1,228 @@
+#include "FrameExchange.h"
+#include <cstring>
+#include <utility>
+
+namespace {
+
+/**
+ * @brief デタッチせずに画素データへの書き込みポインタを得る
+ *
+ * 描画側がQImageの浅いコピーを保持しているため、bits()を呼ぶと複製が
+ * 作られてしまう。スロットの排他はインデックスの交換で保証している。
+ */
+uchar *writableBits(const QImage &image)
+{
+	return const_cast<uchar *>(image.constBits());
+}
+
+void copyRegion(const QImage &src, const QImage &dst, const QRegion &region)
+{
+	uchar const *s = src.constBits();
+	uchar *d = writableBits(dst);
+	qsizetype sstride = src.bytesPerLine();
+	qsizetype dstride = dst.bytesPerLine();
+	int bpp = src.depth() / 8;
+	for (QRect const &r : region) {
+		size_t bytes = (size_t)r.width() * bpp;
+		for (int y = r.top(); y <= r.bottom(); y++) {
+			memcpy(d + y * dstride + r.x() * bpp, s + y * sstride + r.x() * bpp, bytes);
+		}
+	}
+}
+
+/**
+ * @brief 画像の中で矩形を移動する（移動元と移動先が重なってもよい）
+ */
+void moveRect(const QImage &image, const QRect &rect, const QPoint &delta)
+{
+	uchar *bits = writableBits(image);
+	qsizetype stride = image.bytesPerLine();
+	int bpp = image.depth() / 8;
+	size_t bytes = (size_t)rect.width() * bpp;
+	auto row = [&](int y){
+		memmove(bits + (y + delta.y()) * stride + (rect.x() + delta.x()) * bpp, bits + y * stride + rect.x() * bpp, bytes);
+	};
+	// 下へ移動する場合は下の行から写す
+	if (delta.y() > 0) {
+		for (int y = rect.bottom(); y >= rect.top(); y--) row(y);
+	} else {
+		for (int y = rect.top(); y <= rect.bottom(); y++) row(y);
+	}
+}
+
+} // namespace
+
+/**
+ * @brief 移動を適用した後の領域の位置（移動先は移動元の状態で置き換わる）
+ */
+QRegion FrameExchange::moveRegion(const QRegion &region, const Move &move)
+{
+	QRect dst = move.rect.translated(move.delta);
+	return region.subtracted(dst) + region.intersected(move.rect).translated(move.delta);
+}
+
+/**
+ * @brief 移動元と移動先がどちらもboundsに収まるように移動を切り詰める
+ */
+FrameExchange::Move FrameExchange::clipMove(const Move &move, const QRect &bounds)
+{
+	Move m;
+	m.rect = move.rect.intersected(bounds).intersected(bounds.translated(-move.delta));
+	m.delta = move.delta;
+	return m;
+}
+
+/**
+ * @brief 状態を初期化する（両スレッドが停止している時に呼ぶこと）
+ */
+void FrameExchange::reset()
+{
+	for (Slot &slot : slots_) {
+		slot = {};
+	}
+	middle_.store(1);
+	back_ = 0;
+	front_ = 2;
+	size_ = {};
+	unconsumed_ = {};
+	unconsumed_redraw_ = {};
+	unconsumed_moves_.clear();
+	sequence_ = 0;
+	published_ = 0;
+	acquired_ = 0;
+	dropped_ = 0;
+}
+
+/**
+ * @brief 書き込み側：各スロットのバッファをcapacityの大きさで確保しておく
+ */
+void FrameExchange::reserve(QSize capacity, QImage::Format format)
+{
+	for (Slot &slot : slots_) {
+		slot.pool.reserve(capacity, format);
+	}
+}
+
+/**
+ * @brief 書き込み側：sourceの変化した領域をバックバッファに反映して公開する
+ * @param source 最新の画面（GDIのプライマリバッファ）
+ * @param damage 前回のpublish()からの変化
+ * @param moves 前回のpublish()からの移動（順に起きたもの）
+ * @param moved damageのうち、movesを適用すれば前の画面から得られる部分
+ */
+void FrameExchange::publish(const QImage &source, const QRegion &damage, const std::vector<Move> &moves, const QRegion &moved)
+{
+	QRect bounds(QPoint(0, 0), source.size());
+	QRegion changed = damage.intersected(bounds);
+	std::vector<Move> clipped;
+	QRegion destinations;
+	for (Move const &move : moves) {
+		Move m = clipMove(move, bounds);
+		if (!m.rect.isEmpty() && !m.delta.isNull()) {
+			clipped.push_back(m);
+			destinations += m.rect.translated(m.delta);
+		}
+	}
+	QRegion redraw = changed.subtracted(moved.intersected(destinations));
+
+	if (source.size() != size_) {
+		size_ = source.size();
+		changed = bounds;
+		redraw = bounds;
+		clipped.clear();
+		unconsumed_ = bounds;
+		unconsumed_redraw_ = bounds;
+		unconsumed_moves_.clear();
+	}
+	if (changed.isEmpty()) return;
+
+	Slot &slot = slots_[back_];
+	if (slot.image.size() != source.size() || slot.image.format() != source.format()) {
+		slot.image = slot.pool.image(source.size(), source.format());
+		slot.missing = bounds;
+	}
+	// スロットの中で移動し、移動で得られない部分だけを写す
+	for (Move const &move : clipped) {
+		moveRect(slot.image, move.rect, move.delta);
+		slot.missing = moveRegion(slot.missing, move);
+	}
+	copyRegion(source, slot.image, slot.missing + redraw);
+	slot.missing = {};
+	for (unsigned i = 0; i < 3; i++) {
+		if (i != back_) {
+			slots_[i].missing += changed;
+		}
+	}
+
+	slot.sequence = ++sequence_;
+	slot.published = std::chrono::steady_clock::now();
+
+	// 描画側が前のフレームを取り出し済みなら、差分は今回の分だけでよい。
+	// 取り出したかどうかは入れ替えた時に確定するので、入れ替えに失敗したら
+	// （その間に描画側が取り出した）差分を作り直す。描画側はFRESHを消すだけなので、やり直しは1回で済む
+	unsigned prev = middle_.load(std::memory_order_acquire);
+	while (1) {
+		QRegion damage = unconsumed_;
+		QRegion redraw_all = unconsumed_redraw_;
+		std::vector<Move> moves = unconsumed_moves_;
+		if (!(prev & FRESH)) {
+			damage = {};
+			redraw_all = {};
+			moves.clear();
+		}
+		for (Move const &move : clipped) {
+			redraw_all = moveRegion(redraw_all, move);
+		}
+		damage += changed;
+		redraw_all += redraw;
+		moves.insert(moves.end(), clipped.begin(), clipped.end());
+		if ((int)moves.size() > MAX_MOVES) {
+			redraw_all = damage;
+			moves.clear();
+		}
+		slot.damage = damage;
+		slot.moves = moves;
+		slot.moved = damage.subtracted(redraw_all);
+		if (middle_.compare_exchange_strong(prev, back_ | FRESH, std::memory_order_acq_rel, std::memory_order_acquire)) {
+			unconsumed_ = damage;
+			unconsumed_redraw_ = redraw_all;
+			unconsumed_moves_ = std::move(moves);
+			break;
+		}
+	}
+	back_ = prev & INDEX_MASK;
+	published_.fetch_add(1, std::memory_order_relaxed);
+	if (prev & FRESH) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief 描画側：新しいフレームがあれば取り出す
+ * @return 新しいフレームが無ければfalse
+ */
+bool FrameExchange::acquire(Frame *out)
+{
+	if (!(middle_.load(std::memory_order_relaxed) & FRESH)) return false;
+
+	unsigned prev = middle_.exchange(front_, std::memory_order_acq_rel);
+	front_ = prev & INDEX_MASK;
+	Slot const &slot = slots_[front_];
+	out->image = slot.image;
+	out->damage = slot.damage;
+	out->moves = slot.moves;
+	out->moved = slot.moved;
+	out->sequence = slot.sequence;
+	out->published = slot.published;
+	acquired_.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+FrameExchange::Stats FrameExchange::stats() const
+{
+	Stats s;
+	s.published = published_.load(std::memory_order_relaxed);
+	s.acquired = acquired_.load(std::memory_order_relaxed);
+	s.dropped = dropped_.load(std::memory_order_relaxed);
+	return s;
+}
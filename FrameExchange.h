@@ -0,0 +1,82 @@
+#ifndef FRAMEEXCHANGE_H
+#define FRAMEEXCHANGE_H
+
+#include "FramebufferPool.h"
+#include <QImage>
+#include <QRegion>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/**
+ * @brief RDPスレッドとGUIスレッドの間で画面を受け渡すトリプルバッファ
+ *
+ * 書き込み側（RDPスレッド）は描画側を待たずにフレームを公開し、描画側は常に
+ * 最新の完成したフレームを受け取る。読まれないまま上書きされたフレームは
+ * 破棄してカウントする。publish()は書き込み側の1スレッドから、acquire()は
+ * 描画側の1スレッドからのみ呼ぶこと。
+ *
+ * 画面のコピー（スクロール）は移動として受け渡す。描画側は移動を自分の
+ * キャッシュに適用すれば、移動先を描き直さずに済む。
+ */
+class FrameExchange {
+public:
+	static constexpr int MAX_MOVES = 16; // 描画側が遅れてこれより溜まったら移動を諦めて描き直させる
+	struct Move {
+		QRect rect; // 移動元
+		QPoint delta;
+	};
+	struct Frame {
+		QImage image;
+		QRegion damage; // 前回acquire()したフレームからの変化
+		std::vector<Move> moves; // 前回acquire()したフレームからの移動（順に適用する）
+		QRegion moved; // damageのうち、movesを適用すれば描き直さなくてよい部分
+		quint64 sequence = 0;
+		std::chrono::steady_clock::time_point published; // publish()した時刻
+	};
+	struct Stats {
+		quint64 published = 0;
+		quint64 acquired = 0;
+		quint64 dropped = 0;
+	};
+private:
+	static constexpr unsigned INDEX_MASK = 3;
+	static constexpr unsigned FRESH = 4;
+
+	struct Slot {
+		QImage image;
+		QRegion damage;
+		std::vector<Move> moves;
+		QRegion moved;
+		QRegion missing; // 書き込み側専用：最新の画面から遅れている領域
+		quint64 sequence = 0;
+		std::chrono::steady_clock::time_point published;
+		FramebufferPool pool; // 書き込み側専用：解像度が変わっても確保し直さない
+	};
+	Slot slots_[3];
+	std::atomic<unsigned> middle_ { 1 };
+	unsigned back_ = 0;  // 書き込み側専用
+	unsigned front_ = 2; // 描画側専用
+
+	// 書き込み側専用
+	QSize size_;
+	QRegion unconsumed_;
+	QRegion unconsumed_redraw_; // unconsumed_のうち、移動を適用しても描き直しが必要な部分
+	std::vector<Move> unconsumed_moves_;
+	quint64 sequence_ = 0;
+
+	std::atomic<quint64> published_ { 0 };
+	std::atomic<quint64> acquired_ { 0 };
+	std::atomic<quint64> dropped_ { 0 };
+public:
+	void reset();
+	void reserve(QSize capacity, QImage::Format format);
+	void publish(const QImage &source, const QRegion &damage, const std::vector<Move> &moves = {}, const QRegion &moved = {});
+	bool acquire(Frame *out);
+	Stats stats() const;
+
+	static QRegion moveRegion(const QRegion &region, const Move &move);
+	static Move clipMove(const Move &move, const QRect &bounds);
+};
+
+#endif // FRAMEEXCHANGE_H
@@ -0,0 +1,355 @@
+#include "FramebufferExport.h"
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+FramebufferExport::FramebufferExport(QObject *parent)
+	: QObject(parent)
+{
+}
+
+FramebufferExport::~FramebufferExport()
+{
+	close();
+#ifndef _WIN32
+	if (fd_ >= 0) {
+		::close(fd_);
+	}
+#endif
+}
+
+/**
+ * @brief ローカルソケットで待ち受けを始める
+ * @param name ソケットの名前（絶対パスでなければ一時ディレクトリに作る）
+ */
+bool FramebufferExport::listen(const QString &name)
+{
+#ifdef _WIN32
+	qWarning() << "framebuffer export is not supported on this platform";
+	return false;
+#else
+	if (server_ && server_->serverName() == name) return true;
+	close();
+	server_ = new QLocalServer(this);
+	server_->setSocketOptions(QLocalServer::UserAccessOption);
+	if (!server_->listen(name)) {
+		// 前のプロセスが残したソケットなら消してやり直す
+		QLocalServer::removeServer(name);
+		if (!server_->listen(name)) {
+			qWarning() << "failed to listen" << name << server_->errorString();
+			delete server_;
+			server_ = nullptr;
+			return false;
+		}
+	}
+	connect(server_, &QLocalServer::newConnection, this, &FramebufferExport::onNewConnection);
+	listening_ = true;
+	return true;
+#endif
+}
+
+void FramebufferExport::close()
+{
+	listening_ = false;
+	for (Client &client : clients_) {
+		client.socket->disconnect(this);
+		client.socket->abort();
+		client.socket->deleteLater();
+	}
+	clients_.clear();
+	stats_.clients = 0;
+	if (server_) {
+		server_->close();
+		delete server_;
+		server_ = nullptr;
+	}
+}
+
+bool FramebufferExport::isListening() const
+{
+	return listening_;
+}
+
+QString FramebufferExport::serverName() const
+{
+	return server_ ? server_->fullServerName() : QString();
+}
+
+FramebufferExport::Stats const &FramebufferExport::stats() const
+{
+	return stats_;
+}
+
+/**
+ * @brief 公開するフレームバッファを設定する（任意のスレッドから）
+ * @param fd 共有メモリのファイル記述子（複製して持つので、呼んだ側は閉じてよい）。-1ならバッファなし
+ */
+void FramebufferExport::setBuffer(int fd, size_t bytes, qsizetype stride, QImage::Format format)
+{
+	if (!listening_) return;
+#ifndef _WIN32
+	int dup_fd = fd >= 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+#else
+	int dup_fd = -1;
+#endif
+	QMetaObject::invokeMethod(this, [this, dup_fd, bytes, stride, format](){
+		applyBuffer(dup_fd, bytes, stride, format);
+	}, Qt::QueuedConnection);
+}
+
+/**
+ * @brief フレームを公開したことを知らせる（任意のスレッドから）
+ * @param size 画面の大きさ（バッファの先頭から）
+ * @param damage 前回からの変化
+ */
+void FramebufferExport::publishFrame(QSize size, const QRegion &damage)
+{
+	if (!listening_) return;
+	stats_.frames++;
+	QMetaObject::invokeMethod(this, [this, size, damage](){
+		applyFrame(size, damage);
+	}, Qt::QueuedConnection);
+}
+
+void FramebufferExport::applyBuffer(int fd, size_t bytes, qsizetype stride, QImage::Format format)
+{
+#ifndef _WIN32
+	if (fd_ >= 0) {
+		::close(fd_);
+	}
+#endif
+	fd_ = fd;
+	bytes_ = fd >= 0 ? bytes : 0;
+	stride_ = stride;
+	format_ = format;
+	size_ = {};
+	generation_++;
+	for (Client &client : clients_) {
+		flush(&client);
+	}
+}
+
+void FramebufferExport::applyFrame(QSize size, const QRegion &damage)
+{
+	if (fd_ < 0) return;
+	sequence_++;
+	QRegion region = damage;
+	if (size != size_) {
+		size_ = size;
+		region = QRect(QPoint(0, 0), size);
+	}
+	for (Client &client : clients_) {
+		client.pending += region;
+		flush(&client);
+	}
+}
+
+void FramebufferExport::onNewConnection()
+{
+	while (QLocalSocket *socket = server_->nextPendingConnection()) {
+		Client client;
+		client.socket = socket;
+		clients_.push_back(client);
+		stats_.clients = (int)clients_.size();
+		// 送っている途中で切れることがあるので、clients_を回っていない時に取り除く
+		connect(socket, &QLocalSocket::disconnected, this, [this, socket](){
+			removeClient(socket);
+		}, Qt::QueuedConnection);
+		connect(socket, &QLocalSocket::bytesWritten, this, [this, socket](){
+			if (Client *client = findClient(socket)) {
+				flush(client);
+			}
+		});
+		// 受け取る側からのデータは使わない
+		connect(socket, &QLocalSocket::readyRead, socket, [socket](){
+			socket->readAll();
+		});
+		flush(&clients_.back());
+	}
+}
+
+FramebufferExport::Client *FramebufferExport::findClient(QLocalSocket *socket)
+{
+	auto it = std::find_if(clients_.begin(), clients_.end(), [socket](Client const &c){ return c.socket == socket; });
+	return it == clients_.end() ? nullptr : &*it;
+}
+
+void FramebufferExport::removeClient(QLocalSocket *socket)
+{
+	auto it = std::find_if(clients_.begin(), clients_.end(), [socket](Client const &c){ return c.socket == socket; });
+	if (it == clients_.end()) return;
+	clients_.erase(it);
+	stats_.clients = (int)clients_.size();
+	socket->deleteLater();
+}
+
+/**
+ * @brief 送れる状態なら、バッファと溜まっている無効領域を送る
+ */
+void FramebufferExport::flush(Client *client)
+{
+	QLocalSocket *socket = client->socket;
+	if (client->generation != generation_) {
+		// fdを添付するので、先に書いたメッセージが全部送られてから直接送る
+		if (socket->bytesToWrite() > 0) return;
+		if (!sendBuffer(client)) return;
+		client->generation = generation_;
+		client->pending = size_.isEmpty() ? QRegion() : QRegion(QRect(QPoint(0, 0), size_));
+	}
+	if (client->pending.isEmpty() || socket->bytesToWrite() > MAX_PENDING_BYTES) return;
+
+	QJsonArray damage;
+	for (QRect const &r : client->pending) {
+		damage.append(QJsonArray { r.x(), r.y(), r.width(), r.height() });
+	}
+	QJsonObject json;
+	json["type"] = "frame";
+	json["sequence"] = (qint64)sequence_;
+	json["width"] = size_.width();
+	json["height"] = size_.height();
+	json["damage"] = damage;
+	socket->write(QJsonDocument(json).toJson(QJsonDocument::Compact) + '\n');
+	client->pending = {};
+	stats_.messages++;
+}
+
+bool FramebufferExport::sendBuffer(Client *client)
+{
+	QJsonObject json;
+	json["type"] = "buffer";
+	json["size"] = (qint64)bytes_;
+	json["stride"] = (qint64)stride_;
+	json["format"] = pixelLayout(format_);
+	QByteArray data = QJsonDocument(json).toJson(QJsonDocument::Compact) + '\n';
+	if (!sendDescriptor(client->socket->socketDescriptor(), data, fd_)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			client->socket->abort();
+		}
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief ソケットの名前からパス（QLocalServerと同じ規則）
+ */
+QString FramebufferExport::socketPath(const QString &name)
+{
+	if (name.startsWith('/')) return name;
+	return QDir::tempPath() + '/' + name;
+}
+
+/**
+ * @brief 画素のメモリ上のバイトの並び
+ */
+char const *FramebufferExport::pixelLayout(QImage::Format format)
+{
+	switch (format) {
+	case QImage::Format_RGBX8888:
+	case QImage::Format_RGBA8888:
+	case QImage::Format_RGBA8888_Premultiplied:
+		return "RGBX";
+	case QImage::Format_RGB32:
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied:
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+		return "BGRX";
+#else
+		return "XRGB";
+#endif
+	default:
+		return "";
+	}
+}
+
+/**
+ * @brief dataを送り、fdをSCM_RIGHTSで添付する（fdが負なら添付しない）
+ */
+bool FramebufferExport::sendDescriptor(qintptr socket, const QByteArray &data, int fd)
+{
+#ifdef _WIN32
+	(void)socket;
+	(void)data;
+	(void)fd;
+	return false;
+#else
+	iovec iov;
+	iov.iov_base = const_cast<char *>(data.constData());
+	iov.iov_len = (size_t)data.size();
+	msghdr msg {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	if (fd >= 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	ssize_t n;
+	do {
+		n = sendmsg((int)socket, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	// 短いメッセージなので、空のソケットには一度で書ける
+	return n == (ssize_t)data.size();
+#endif
+}
+
+/**
+ * @brief データを受け取り、添付されたfdがあれば取り出す
+ * @param fd 受け取ったfd（なければ変えない）
+ * @return 受け取ったバイト数（0なら切断、負ならエラー）
+ */
+qint64 FramebufferExport::receiveDescriptor(qintptr socket, char *data, qint64 size, int *fd)
+{
+#ifdef _WIN32
+	(void)socket;
+	(void)data;
+	(void)size;
+	(void)fd;
+	return -1;
+#else
+	iovec iov;
+	iov.iov_base = data;
+	iov.iov_len = (size_t)size;
+	msghdr msg {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n;
+	do {
+		n = recvmsg((int)socket, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) return -1;
+	for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			int received;
+			memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+			if (*fd >= 0) {
+				::close(*fd);
+			}
+			*fd = received;
+		}
+	}
+	return n;
+#endif
+}
@@ -0,0 +1,88 @@
+#ifndef FRAMEBUFFEREXPORT_H
+#define FRAMEBUFFEREXPORT_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QRegion>
+#include <QSize>
+#include <QString>
+#include <atomic>
+#include <vector>
+
+class QLocalServer;
+class QLocalSocket;
+
+/**
+ * @brief 画面のフレームバッファを他のプロセスに公開する
+ *
+ * フレームバッファは共有メモリ（FramebufferPoolの共有モード）に置き、ローカル
+ * ソケットでそのファイル記述子を渡す。その後はフレームを公開するたびに番号と
+ * 無効領域だけを送るので、受け取る側はmmapした画面をコピーせずに読める。
+ *
+ * メッセージは1行に1つのJSON。
+ * - {"type":"buffer","size":バイト数,"stride":行の間隔,"format":"BGRX"|"RGBX"}
+ *   SCM_RIGHTSでfdを添付する。sizeが0ならバッファはない（切断した）
+ * - {"type":"frame","sequence":番号,"width":幅,"height":高さ,"damage":[[x,y,w,h],...]}
+ *   bufferを受け取った直後のframeは画面全体を無効領域とする
+ *
+ * 受け取る側が遅れている間は無効領域をまとめ、追いついた時に1つのframeとして送る。
+ * 画素はRDPスレッドが書き換えているバッファそのものなので、frameを受け取った時点で
+ * 無効領域は少なくともその番号の内容になっているが、次の更新を書きかけの場合もある。
+ *
+ * listen()/close()はGUIスレッドから、setBuffer()/publishFrame()は任意のスレッドから呼ぶ。
+ */
+class FramebufferExport : public QObject {
+	Q_OBJECT
+public:
+	static constexpr qint64 MAX_PENDING_BYTES = 64 * 1024; // 送信待ちがこれを超えたら無効領域をまとめる
+	struct Stats {
+		std::atomic<int> clients { 0 };
+		std::atomic<quint64> frames { 0 }; // 公開したフレーム数
+		std::atomic<quint64> messages { 0 }; // 送ったframeメッセージの数（まとめた分は1つ）
+	};
+private:
+	struct Client {
+		QLocalSocket *socket = nullptr;
+		quint64 generation = 0; // 最後に送ったバッファの世代
+		QRegion pending; // まだ送っていない無効領域
+	};
+	QLocalServer *server_ = nullptr;
+	std::vector<Client> clients_;
+	std::atomic<bool> listening_ { false };
+	Stats stats_;
+
+	// GUIスレッド専用（setBuffer()/publishFrame()からはキューで渡す）
+	int fd_ = -1; // setBuffer()で受け取ったfdを複製したもの
+	size_t bytes_ = 0;
+	qsizetype stride_ = 0;
+	QImage::Format format_ = QImage::Format_Invalid;
+	QSize size_;
+	quint64 generation_ = 0;
+	quint64 sequence_ = 0;
+
+	void onNewConnection();
+	void removeClient(QLocalSocket *socket);
+	Client *findClient(QLocalSocket *socket);
+	void flush(Client *client);
+	bool sendBuffer(Client *client);
+	void applyBuffer(int fd, size_t bytes, qsizetype stride, QImage::Format format);
+	void applyFrame(QSize size, const QRegion &damage);
+public:
+	explicit FramebufferExport(QObject *parent = nullptr);
+	~FramebufferExport() override;
+	bool listen(const QString &name);
+	void close();
+	bool isListening() const;
+	QString serverName() const;
+	void setBuffer(int fd, size_t bytes, qsizetype stride, QImage::Format format);
+	void publishFrame(QSize size, const QRegion &damage);
+	Stats const &stats() const;
+
+	static QString socketPath(const QString &name);
+	static char const *pixelLayout(QImage::Format format);
+	static bool sendDescriptor(qintptr socket, const QByteArray &data, int fd);
+	static qint64 receiveDescriptor(qintptr socket, char *data, qint64 size, int *fd);
+};
+
+#endif // FRAMEBUFFEREXPORT_H
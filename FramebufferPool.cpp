@@ -0,0 +1,173 @@
+#include "FramebufferPool.h"
+#include <QDebug>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t ALIGNMENT = 64;
+
+void releaseBuffer(void *info)
+{
+	delete static_cast<std::shared_ptr<void> *>(info);
+}
+
+} // namespace
+
+FramebufferPool::Buffer::~Buffer()
+{
+#ifndef _WIN32
+	if (fd >= 0) {
+		if (data) {
+			munmap(data, bytes);
+		}
+		close(fd);
+		return;
+	}
+#endif
+	std::free(data);
+}
+
+/**
+ * @brief 他のプロセスと共有できるメモリを確保する（mmapなのでページ境界に揃う）
+ */
+bool FramebufferPool::allocateShared(Buffer *buffer, size_t bytes)
+{
+#ifdef _WIN32
+	(void)buffer;
+	(void)bytes;
+	return false;
+#else
+#ifdef __linux__
+	int fd = memfd_create("rapsodia-framebuffer", MFD_CLOEXEC);
+#else
+	// 名前はすぐに消すので、fdを受け取ったプロセスだけが使える
+	QByteArray name = "/rapsodia-" + QByteArray::number(getpid()) + "-" + QByteArray::number((qulonglong)buffer, 16);
+	int fd = shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		shm_unlink(name.constData());
+	}
+#endif
+	if (fd < 0) {
+		qWarning() << "failed to create shared framebuffer";
+		return false;
+	}
+	if (ftruncate(fd, (off_t)bytes) != 0) {
+		close(fd);
+		return false;
+	}
+	void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	buffer->data = static_cast<uchar *>(p);
+	buffer->bytes = bytes;
+	buffer->fd = fd;
+	return true;
+#endif
+}
+
+/**
+ * @brief 少なくともcapacityの大きさを確保する（既に足りていれば何もしない）
+ */
+void FramebufferPool::reserve(QSize capacity, QImage::Format format)
+{
+	if (buffer_ && format == format_ && capacity_.width() >= capacity.width() && capacity_.height() >= capacity.height()) return;
+
+	capacity = capacity.expandedTo(capacity_.isValid() && format == format_ ? capacity_ : QSize());
+	int bpp = QImage::toPixelFormat(format).bitsPerPixel() / 8;
+	qsizetype stride = ((qsizetype)capacity.width() * bpp + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	size_t bytes = (size_t)stride * capacity.height();
+
+	auto buffer = std::make_shared<Buffer>();
+	if (shared_) {
+		if (!allocateShared(buffer.get(), bytes)) return;
+	} else {
+		buffer->data = static_cast<uchar *>(std::aligned_alloc(ALIGNMENT, bytes));
+		if (!buffer->data) return;
+		buffer->bytes = bytes;
+	}
+
+	buffer_ = buffer;
+	capacity_ = capacity;
+	format_ = format;
+	stride_ = stride;
+	allocations_++;
+}
+
+void FramebufferPool::clear()
+{
+	buffer_.reset();
+	capacity_ = {};
+	format_ = QImage::Format_Invalid;
+	stride_ = 0;
+}
+
+/**
+ * @brief バッファの先頭からsizeの大きさのQImageを切り出す
+ *
+ * 返したQImageはバッファを共有する（内容は前の大きさの時のまま）。QImageが
+ * 残っている間は、確保し直してもそのバッファは解放されない。
+ */
+QImage FramebufferPool::image(QSize size, QImage::Format format)
+{
+	reserve(size, format);
+	if (!buffer_) return {};
+	auto *ref = new std::shared_ptr<void>(buffer_);
+	return QImage(buffer_->data, size.width(), size.height(), stride_, format, releaseBuffer, ref);
+}
+
+QSize FramebufferPool::capacity() const
+{
+	return capacity_;
+}
+
+/**
+ * @brief 確保した回数
+ */
+quint64 FramebufferPool::allocations() const
+{
+	return allocations_;
+}
+
+bool FramebufferPool::isShared() const
+{
+	return shared_;
+}
+
+/**
+ * @brief 次に確保する時から、他のプロセスと共有できるメモリを使うかを設定する
+ */
+void FramebufferPool::setShared(bool shared)
+{
+	if (shared_ == shared) return;
+	shared_ = shared;
+	clear();
+}
+
+/**
+ * @brief 共有メモリのファイル記述子（共有モードでなければ-1）
+ */
+int FramebufferPool::fd() const
+{
+	return buffer_ ? buffer_->fd : -1;
+}
+
+/**
+ * @brief 確保したバッファのバイト数
+ */
+size_t FramebufferPool::bytes() const
+{
+	return buffer_ ? buffer_->bytes : 0;
+}
+
+qsizetype FramebufferPool::stride() const
+{
+	return stride_;
+}
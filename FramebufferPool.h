@@ -0,0 +1,48 @@
+#ifndef FRAMEBUFFERPOOL_H
+#define FRAMEBUFFERPOOL_H
+
+#include <QImage>
+#include <QSize>
+#include <memory>
+
+/**
+ * @brief 解像度が変わっても確保し直さないフレームバッファ
+ *
+ * 最大の大きさで一度だけ確保し、行の長さ（stride）を固定したまま、任意の
+ * 大きさのQImageとして切り出す。解像度の変更はメモリの再確保なしで済む。
+ * 最大を超える大きさを求められた時だけ確保し直す（古いバッファは、それを
+ * 参照するQImageがなくなるまで残る）。
+ *
+ * 共有モードでは、他のプロセスがマップできるメモリ（Linuxではmemfd、それ以外の
+ * POSIXではshm_open）に確保する。fd()を渡せば、コピーせずに画面を読める。
+ */
+class FramebufferPool {
+private:
+	struct Buffer {
+		uchar *data = nullptr;
+		size_t bytes = 0;
+		int fd = -1; // 共有モードの場合
+		~Buffer();
+	};
+	std::shared_ptr<Buffer> buffer_;
+	QSize capacity_;
+	QImage::Format format_ = QImage::Format_Invalid;
+	qsizetype stride_ = 0;
+	quint64 allocations_ = 0;
+	bool shared_ = false;
+
+	static bool allocateShared(Buffer *buffer, size_t bytes);
+public:
+	void reserve(QSize capacity, QImage::Format format);
+	void clear();
+	QImage image(QSize size, QImage::Format format);
+	QSize capacity() const;
+	quint64 allocations() const;
+	bool isShared() const;
+	void setShared(bool shared);
+	int fd() const;
+	size_t bytes() const;
+	qsizetype stride() const;
+};
+
+#endif // FRAMEBUFFERPOOL_H
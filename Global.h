@@ -25,6 +25,9 @@ public:
 class ApplicationGlobal : public ApplicationBasicData {
 public:
 	MainWindow *mainwindow = nullptr;
+	QString record_file; // --record：受信したPDUを記録するファイル
+	QString export_name; // --export：画面を他のプロセスに公開するローカルソケットの名前
+	int export_count = 0; // 公開したセッションの数（2つ目からは名前に番号を付ける）
 };
 
 extern ApplicationGlobal *global;
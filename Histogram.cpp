@@ -0,0 +1,83 @@
+#include "Histogram.h"
+
+Histogram::Histogram()
+{
+	reset();
+}
+
+int Histogram::indexOf(quint64 value)
+{
+	if (value < SUB_BUCKETS) return (int)value;
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BITS;
+	int sub = (int)(value >> shift) & (SUB_BUCKETS - 1);
+	return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief バケットに入る値の上限
+ */
+quint64 Histogram::upperBound(int index)
+{
+	if (index < SUB_BUCKETS) return (quint64)index;
+	int shift = index / SUB_BUCKETS - 1;
+	quint64 sub = (quint64)(index % SUB_BUCKETS);
+	quint64 lower = (SUB_BUCKETS + sub) << shift;
+	return lower + ((quint64)1 << shift) - 1;
+}
+
+void Histogram::reset()
+{
+	for (auto &b : buckets_) {
+		b.store(0, std::memory_order_relaxed);
+	}
+	count_.store(0, std::memory_order_relaxed);
+	sum_.store(0, std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record(quint64 value)
+{
+	buckets_[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(value, std::memory_order_relaxed);
+	quint64 m = max_.load(std::memory_order_relaxed);
+	while (value > m && !max_.compare_exchange_weak(m, value, std::memory_order_relaxed));
+}
+
+quint64 Histogram::count() const
+{
+	return count_.load(std::memory_order_relaxed);
+}
+
+quint64 Histogram::max() const
+{
+	return max_.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+	quint64 n = count();
+	return n ? (double)sum_.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+/**
+ * @brief パーセンタイル値（pは0〜100）。バケットの上限を返す
+ */
+quint64 Histogram::percentile(double p) const
+{
+	quint64 n = count();
+	if (n == 0) return 0;
+	quint64 rank = (quint64)(p / 100.0 * n + 0.5);
+	if (rank < 1) rank = 1;
+	quint64 seen = 0;
+	for (int i = 0; i < BUCKET_COUNT; i++) {
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			quint64 v = upperBound(i);
+			quint64 m = max();
+			return v < m ? v : m;
+		}
+	}
+	return max();
+}
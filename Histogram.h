@@ -0,0 +1,57 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+
+/**
+ * @brief ロックフリーの対数ヒストグラム（HDR Histogram風）
+ *
+ * 2のべき乗ごとにSUB_BUCKETS個のバケットに分けて数える。相対誤差は
+ * 1/SUB_BUCKETS以下。record()はどのスレッドから呼んでもよい。
+ */
+class Histogram {
+public:
+	static constexpr int SUB_BITS = 3;
+	static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+	static constexpr int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+private:
+	std::atomic<quint64> buckets_[BUCKET_COUNT];
+	std::atomic<quint64> count_ { 0 };
+	std::atomic<quint64> sum_ { 0 };
+	std::atomic<quint64> max_ { 0 };
+
+	static int indexOf(quint64 value);
+	static quint64 upperBound(int index);
+public:
+	Histogram();
+	void reset();
+	void record(quint64 value);
+	quint64 count() const;
+	quint64 max() const;
+	double mean() const;
+	quint64 percentile(double p) const;
+};
+
+/**
+ * @brief スコープの経過時間（マイクロ秒）をヒストグラムに記録する
+ */
+class HistogramTimer {
+private:
+	Histogram *histogram_;
+	std::chrono::steady_clock::time_point start_;
+public:
+	explicit HistogramTimer(Histogram *histogram)
+		: histogram_(histogram)
+		, start_(std::chrono::steady_clock::now())
+	{
+	}
+	~HistogramTimer()
+	{
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+		histogram_->record((quint64)us);
+	}
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,498 @@
+#include "ImageScaler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGESCALER_X86 1
+#include <immintrin.h>
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace ImageScaler {
+
+namespace {
+
+Isa detectIsa()
+{
+#ifdef IMAGESCALER_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+	if (__builtin_cpu_supports("sse4.1")) return Isa::SSE41;
+#endif
+	return Isa::Scalar;
+}
+
+std::atomic<Isa> current_isa { detectIsa() };
+
+inline uint32_t const *srcRow(Source const &src, int y)
+{
+	return reinterpret_cast<uint32_t const *>(src.bits + y * src.stride);
+}
+
+inline uint32_t *dstRow(Target const &dst, int y)
+{
+	return reinterpret_cast<uint32_t *>(dst.bits + y * dst.stride);
+}
+
+// 画素複製（整数倍拡大）の1行分
+
+void expandRowScalar(uint32_t const *s, uint32_t *d, int n, int factor)
+{
+	for (int i = 0; i < n; i++) {
+		uint32_t p = s[i];
+		for (int k = 0; k < factor; k++) {
+			*d++ = p;
+		}
+	}
+}
+
+#ifdef IMAGESCALER_X86
+TARGET_SSE41 void expandRowSSE41(uint32_t const *s, uint32_t *d, int n, int factor)
+{
+	int i = 0;
+	if (factor == 2) {
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((__m128i const *)(s + i));
+			_mm_storeu_si128((__m128i *)(d + i * 2), _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128((__m128i *)(d + i * 2 + 4), _mm_unpackhi_epi32(v, v));
+		}
+	} else if (factor == 3) {
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((__m128i const *)(s + i));
+			_mm_storeu_si128((__m128i *)(d + i * 3), _mm_shuffle_epi32(v, 0x40));
+			_mm_storeu_si128((__m128i *)(d + i * 3 + 4), _mm_shuffle_epi32(v, 0xa5));
+			_mm_storeu_si128((__m128i *)(d + i * 3 + 8), _mm_shuffle_epi32(v, 0xfe));
+		}
+	} else if (factor == 4) {
+		for (; i + 4 <= n; i += 4) {
+			__m128i v = _mm_loadu_si128((__m128i const *)(s + i));
+			_mm_storeu_si128((__m128i *)(d + i * 4), _mm_shuffle_epi32(v, 0x00));
+			_mm_storeu_si128((__m128i *)(d + i * 4 + 4), _mm_shuffle_epi32(v, 0x55));
+			_mm_storeu_si128((__m128i *)(d + i * 4 + 8), _mm_shuffle_epi32(v, 0xaa));
+			_mm_storeu_si128((__m128i *)(d + i * 4 + 12), _mm_shuffle_epi32(v, 0xff));
+		}
+	}
+	expandRowScalar(s + i, d + i * factor, n - i, factor);
+}
+
+TARGET_AVX2 void expandRowAVX2(uint32_t const *s, uint32_t *d, int n, int factor)
+{
+	int i = 0;
+	if (factor == 2) {
+		for (; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256((__m256i const *)(s + i));
+			__m256i lo = _mm256_unpacklo_epi32(v, v);
+			__m256i hi = _mm256_unpackhi_epi32(v, v);
+			_mm256_storeu_si256((__m256i *)(d + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i *)(d + i * 2 + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+	} else if (factor == 3) {
+		__m256i const i0 = _mm256_setr_epi32(0, 0, 0, 1, 1, 1, 2, 2);
+		__m256i const i1 = _mm256_setr_epi32(2, 3, 3, 3, 4, 4, 4, 5);
+		__m256i const i2 = _mm256_setr_epi32(5, 5, 6, 6, 6, 7, 7, 7);
+		for (; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256((__m256i const *)(s + i));
+			_mm256_storeu_si256((__m256i *)(d + i * 3), _mm256_permutevar8x32_epi32(v, i0));
+			_mm256_storeu_si256((__m256i *)(d + i * 3 + 8), _mm256_permutevar8x32_epi32(v, i1));
+			_mm256_storeu_si256((__m256i *)(d + i * 3 + 16), _mm256_permutevar8x32_epi32(v, i2));
+		}
+	} else if (factor == 4) {
+		__m256i const i0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+		__m256i const i1 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+		__m256i const i2 = _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5);
+		__m256i const i3 = _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7);
+		for (; i + 8 <= n; i += 8) {
+			__m256i v = _mm256_loadu_si256((__m256i const *)(s + i));
+			_mm256_storeu_si256((__m256i *)(d + i * 4), _mm256_permutevar8x32_epi32(v, i0));
+			_mm256_storeu_si256((__m256i *)(d + i * 4 + 8), _mm256_permutevar8x32_epi32(v, i1));
+			_mm256_storeu_si256((__m256i *)(d + i * 4 + 16), _mm256_permutevar8x32_epi32(v, i2));
+			_mm256_storeu_si256((__m256i *)(d + i * 4 + 24), _mm256_permutevar8x32_epi32(v, i3));
+		}
+	}
+	expandRowScalar(s + i, d + i * factor, n - i, factor);
+}
+#endif
+
+// バイリニア補間
+//
+// 重みは7ビット固定小数点。縦方向を先に補間して16ビットに収め、
+// 横方向の積和を32ビットで行う。スカラー版とSIMD版は同じ結果になる。
+
+struct BilinearColumns {
+	std::vector<int> offset; // 左側の画素の位置（画素単位）
+	std::vector<uint32_t> weight; // 下位16ビット：左の重み、上位16ビット：右の重み
+};
+
+inline void bilinearSample(double pos, int length, int *index, int *weight)
+{
+	if (length < 2) {
+		*index = 0;
+		*weight = 0;
+		return;
+	}
+	int i = (int)std::floor(pos);
+	double f = pos - i;
+	if (i < 0) {
+		i = 0;
+		f = 0;
+	} else if (i >= length - 1) {
+		i = length - 2;
+		f = 1;
+	}
+	*index = i;
+	*weight = (int)(f * 128 + 0.5);
+}
+
+void prepareColumns(Source const &src, Target const &dst, double scale, BilinearColumns *cols)
+{
+	cols->offset.resize(dst.width);
+	cols->weight.resize(dst.width);
+	for (int i = 0; i < dst.width; i++) {
+		int x, w;
+		bilinearSample((dst.x + i + 0.5) / scale - 0.5, src.width, &x, &w);
+		cols->offset[i] = x;
+		cols->weight[i] = ((uint32_t)w << 16) | (uint32_t)(128 - w);
+	}
+}
+
+inline uint32_t bilinearPixel(uint8_t const *t, uint8_t const *b, int wy, uint32_t wx)
+{
+	int wl = wx & 0xffff;
+	int wr = wx >> 16;
+	uint32_t out = 0;
+	for (int c = 0; c < 4; c++) {
+		int l = t[c] * (128 - wy) + b[c] * wy;
+		int r = t[c + 4] * (128 - wy) + b[c + 4] * wy;
+		int v = (l * wl + r * wr + 8192) >> 14;
+		out |= (uint32_t)v << (c * 8);
+	}
+	return out;
+}
+
+void bilinearRowScalar(uint8_t const *row0, uint8_t const *row1, int wy, BilinearColumns const &cols, int begin, int end, uint32_t *out)
+{
+	for (int i = begin; i < end; i++) {
+		int x = cols.offset[i] * 4;
+		out[i] = bilinearPixel(row0 + x, row1 + x, wy, cols.weight[i]);
+	}
+}
+
+#ifdef IMAGESCALER_X86
+TARGET_SSE41 void bilinearRowSSE41(uint8_t const *row0, uint8_t const *row1, int wy, BilinearColumns const &cols, int end, uint32_t *out)
+{
+	__m128i const wy0 = _mm_set1_epi16((short)(128 - wy));
+	__m128i const wy1 = _mm_set1_epi16((short)wy);
+	__m128i const shuf = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	__m128i const round = _mm_set1_epi32(8192);
+	for (int i = 0; i < end; i++) {
+		int x = cols.offset[i] * 4;
+		__m128i t = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *)(row0 + x)));
+		__m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const *)(row1 + x)));
+		__m128i v = _mm_add_epi16(_mm_mullo_epi16(t, wy0), _mm_mullo_epi16(b, wy1));
+		v = _mm_shuffle_epi8(v, shuf);
+		__m128i r = _mm_madd_epi16(v, _mm_set1_epi32((int)cols.weight[i]));
+		r = _mm_srai_epi32(_mm_add_epi32(r, round), 14);
+		r = _mm_packs_epi32(r, r);
+		r = _mm_packus_epi16(r, r);
+		out[i] = (uint32_t)_mm_cvtsi128_si32(r);
+	}
+}
+
+TARGET_AVX2 void bilinearRowAVX2(uint8_t const *row0, uint8_t const *row1, int wy, BilinearColumns const &cols, int end, uint32_t *out)
+{
+	__m256i const wy0 = _mm256_set1_epi16((short)(128 - wy));
+	__m256i const wy1 = _mm256_set1_epi16((short)wy);
+	__m256i const shuf = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+										  0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	__m256i const round = _mm256_set1_epi32(8192);
+	int i = 0;
+	for (; i + 2 <= end; i += 2) {
+		int x0 = cols.offset[i] * 4;
+		int x1 = cols.offset[i + 1] * 4;
+		__m128i t8 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)(row0 + x0)), _mm_loadl_epi64((__m128i const *)(row0 + x1)));
+		__m128i b8 = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i const *)(row1 + x0)), _mm_loadl_epi64((__m128i const *)(row1 + x1)));
+		__m256i t = _mm256_cvtepu8_epi16(t8);
+		__m256i b = _mm256_cvtepu8_epi16(b8);
+		__m256i v = _mm256_add_epi16(_mm256_mullo_epi16(t, wy0), _mm256_mullo_epi16(b, wy1));
+		v = _mm256_shuffle_epi8(v, shuf);
+		__m256i w = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi32((int)cols.weight[i])), _mm_set1_epi32((int)cols.weight[i + 1]), 1);
+		__m256i r = _mm256_madd_epi16(v, w);
+		r = _mm256_srai_epi32(_mm256_add_epi32(r, round), 14);
+		r = _mm256_packs_epi32(r, r);
+		r = _mm256_packus_epi16(r, r);
+		out[i] = (uint32_t)_mm256_extract_epi32(r, 0);
+		out[i + 1] = (uint32_t)_mm256_extract_epi32(r, 4);
+	}
+	bilinearRowScalar(row0, row1, wy, cols, i, end, out);
+}
+#endif
+
+// 平均画素法（縮小）
+
+inline void boxSpan(int i, double scale, int length, int *begin, int *end)
+{
+	int b = std::min((int)std::floor(i / scale), length - 1);
+	int e = std::min((int)std::floor((i + 1) / scale), length);
+	*begin = b;
+	*end = std::max(e, b + 1);
+}
+
+inline uint32_t boxResolve(uint32_t const sum[4], float inv)
+{
+	uint32_t out = 0;
+	for (int c = 0; c < 4; c++) {
+		uint32_t v = (uint32_t)(sum[c] * inv + 0.5f);
+		out |= std::min(v, 255u) << (c * 8);
+	}
+	return out;
+}
+
+void boxRowScalar(Source const &src, int y0, int y1, std::vector<int> const &xs, int x_begin, int end, uint32_t *out)
+{
+	for (int i = x_begin; i < end; i++) {
+		uint32_t sum[4] = {};
+		int xb = xs[i * 2];
+		int xe = xs[i * 2 + 1];
+		for (int y = y0; y < y1; y++) {
+			uint8_t const *p = src.bits + y * src.stride + xb * 4;
+			for (int x = xb; x < xe; x++) {
+				for (int c = 0; c < 4; c++) {
+					sum[c] += p[c];
+				}
+				p += 4;
+			}
+		}
+		out[i] = boxResolve(sum, 1.0f / ((xe - xb) * (y1 - y0)));
+	}
+}
+
+#ifdef IMAGESCALER_X86
+TARGET_SSE41 void boxRowSSE41(Source const &src, int y0, int y1, std::vector<int> const &xs, int end, uint32_t *out)
+{
+	for (int i = 0; i < end; i++) {
+		int xb = xs[i * 2];
+		int xe = xs[i * 2 + 1];
+		__m128i sum = _mm_setzero_si128();
+		for (int y = y0; y < y1; y++) {
+			uint32_t const *p = srcRow(src, y);
+			for (int x = xb; x < xe; x++) {
+				sum = _mm_add_epi32(sum, _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)p[x])));
+			}
+		}
+		__m128 inv = _mm_set1_ps(1.0f / ((xe - xb) * (y1 - y0)));
+		__m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), inv), _mm_set1_ps(0.5f)));
+		r = _mm_packs_epi32(r, r);
+		r = _mm_packus_epi16(r, r);
+		out[i] = (uint32_t)_mm_cvtsi128_si32(r);
+	}
+}
+
+TARGET_AVX2 void boxRowAVX2(Source const &src, int y0, int y1, std::vector<int> const &xs, int end, uint32_t *out)
+{
+	for (int i = 0; i < end; i++) {
+		int xb = xs[i * 2];
+		int xe = xs[i * 2 + 1];
+		__m256i sum2 = _mm256_setzero_si256();
+		__m128i sum1 = _mm_setzero_si128();
+		for (int y = y0; y < y1; y++) {
+			uint32_t const *p = srcRow(src, y);
+			int x = xb;
+			for (; x + 2 <= xe; x += 2) {
+				sum2 = _mm256_add_epi32(sum2, _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const *)(p + x))));
+			}
+			if (x < xe) {
+				sum1 = _mm_add_epi32(sum1, _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)p[x])));
+			}
+		}
+		__m128i sum = _mm_add_epi32(sum1, _mm_add_epi32(_mm256_castsi256_si128(sum2), _mm256_extracti128_si256(sum2, 1)));
+		__m128 inv = _mm_set1_ps(1.0f / ((xe - xb) * (y1 - y0)));
+		__m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), inv), _mm_set1_ps(0.5f)));
+		r = _mm_packs_epi32(r, r);
+		r = _mm_packus_epi16(r, r);
+		out[i] = (uint32_t)_mm_cvtsi128_si32(r);
+	}
+}
+#endif
+
+} // namespace
+
+Isa isa()
+{
+	return current_isa.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 使用する命令セットを変更する（ベンチマーク用）。CPUが対応していない場合は無視する
+ */
+void setIsa(Isa isa)
+{
+	if ((int)isa <= (int)detectIsa()) {
+		current_isa.store(isa, std::memory_order_relaxed);
+	}
+}
+
+char const *isaName(Isa isa)
+{
+	switch (isa) {
+	case Isa::AVX2:
+		return "AVX2";
+	case Isa::SSE41:
+		return "SSE4.1";
+	default:
+		return "Scalar";
+	}
+}
+
+/**
+ * @brief 長さlengthを倍率scaleで拡大縮小した後の長さ
+ *
+ * タイルの境界もこの関数で求めるので、隣り合うタイルに隙間や重なりはできない。
+ */
+int scaledLength(int length, double scale)
+{
+	return (int)std::floor(length * scale + 1e-6);
+}
+
+/**
+ * @brief 倍率に応じてカーネルを選んで拡大縮小する
+ */
+void scale(Source const &src, Target const &dst, double scale)
+{
+	if (dst.width <= 0 || dst.height <= 0 || src.width <= 0 || src.height <= 0) return;
+
+	int factor = (int)scale;
+	if (factor == scale) {
+		if (factor == 1) {
+			for (int y = 0; y < dst.height; y++) {
+				memcpy(dstRow(dst, y), srcRow(src, dst.y + y) + dst.x, dst.width * 4);
+			}
+		} else if (factor <= 4 && dst.x % factor == 0 && dst.y % factor == 0 && dst.width % factor == 0 && dst.height % factor == 0) {
+			replicate(src, dst, factor);
+		} else {
+			nearest(src, dst, scale);
+		}
+	} else if (scale > 1) {
+		bilinear(src, dst, scale);
+	} else {
+		box(src, dst, scale);
+	}
+}
+
+/**
+ * @brief 画素複製による整数倍拡大（factorは2〜4、矩形はfactorの倍数に揃っていること）
+ */
+void replicate(Source const &src, Target const &dst, int factor)
+{
+	auto expand = expandRowScalar;
+#ifdef IMAGESCALER_X86
+	switch (isa()) {
+	case Isa::AVX2:
+		expand = expandRowAVX2;
+		break;
+	case Isa::SSE41:
+		expand = expandRowSSE41;
+		break;
+	default:
+		break;
+	}
+#endif
+	int sx = dst.x / factor;
+	int sy = dst.y / factor;
+	int n = dst.width / factor;
+	size_t bytes = (size_t)dst.width * 4;
+	for (int j = 0; j < dst.height / factor; j++) {
+		uint32_t *d = dstRow(dst, j * factor);
+		expand(srcRow(src, sy + j) + sx, d, n, factor);
+		for (int k = 1; k < factor; k++) {
+			memcpy(dstRow(dst, j * factor + k), d, bytes);
+		}
+	}
+}
+
+/**
+ * @brief 最近傍法による任意倍率の拡大縮小
+ */
+void nearest(Source const &src, Target const &dst, double scale)
+{
+	std::vector<int> xs(dst.width);
+	for (int i = 0; i < dst.width; i++) {
+		xs[i] = std::clamp((int)((dst.x + i + 0.5) / scale), 0, src.width - 1);
+	}
+	for (int j = 0; j < dst.height; j++) {
+		int sy = std::clamp((int)((dst.y + j + 0.5) / scale), 0, src.height - 1);
+		uint32_t const *s = srcRow(src, sy);
+		uint32_t *d = dstRow(dst, j);
+		for (int i = 0; i < dst.width; i++) {
+			d[i] = s[xs[i]];
+		}
+	}
+}
+
+/**
+ * @brief バイリニア補間による拡大（小数倍率用）
+ */
+void bilinear(Source const &src, Target const &dst, double scale)
+{
+	if (src.width < 2) {
+		nearest(src, dst, scale);
+		return;
+	}
+	thread_local BilinearColumns cols;
+	prepareColumns(src, dst, scale, &cols);
+	Isa isa = ImageScaler::isa();
+	for (int j = 0; j < dst.height; j++) {
+		int y, wy;
+		bilinearSample((dst.y + j + 0.5) / scale - 0.5, src.height, &y, &wy);
+		uint8_t const *row0 = src.bits + y * src.stride;
+		uint8_t const *row1 = src.height < 2 ? row0 : row0 + src.stride;
+		uint32_t *out = dstRow(dst, j);
+#ifdef IMAGESCALER_X86
+		if (isa == Isa::AVX2) {
+			bilinearRowAVX2(row0, row1, wy, cols, dst.width, out);
+			continue;
+		}
+		if (isa == Isa::SSE41) {
+			bilinearRowSSE41(row0, row1, wy, cols, dst.width, out);
+			continue;
+		}
+#endif
+		(void)isa;
+		bilinearRowScalar(row0, row1, wy, cols, 0, dst.width, out);
+	}
+}
+
+/**
+ * @brief 平均画素法による縮小（ウィンドウに合わせる表示用）
+ */
+void box(Source const &src, Target const &dst, double scale)
+{
+	thread_local std::vector<int> xs;
+	xs.resize(dst.width * 2);
+	for (int i = 0; i < dst.width; i++) {
+		boxSpan(dst.x + i, scale, src.width, &xs[i * 2], &xs[i * 2 + 1]);
+	}
+	Isa isa = ImageScaler::isa();
+	for (int j = 0; j < dst.height; j++) {
+		int y0, y1;
+		boxSpan(dst.y + j, scale, src.height, &y0, &y1);
+		uint32_t *out = dstRow(dst, j);
+#ifdef IMAGESCALER_X86
+		if (isa == Isa::AVX2) {
+			boxRowAVX2(src, y0, y1, xs, dst.width, out);
+			continue;
+		}
+		if (isa == Isa::SSE41) {
+			boxRowSSE41(src, y0, y1, xs, dst.width, out);
+			continue;
+		}
+#endif
+		(void)isa;
+		boxRowScalar(src, y0, y1, xs, 0, dst.width, out);
+	}
+}
+
+} // namespace ImageScaler
@@ -0,0 +1,51 @@
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 32ビット画素（RGBX/BGRX）画像の拡大縮小カーネル
+ *
+ * 実行時にCPUを判定し、AVX2/SSE4.1/スカラー実装のいずれかを使う。
+ * 出力は拡大後の画像の一部の矩形として指定するので、タイル単位で呼び出せる。
+ */
+namespace ImageScaler {
+
+enum class Isa {
+	Scalar,
+	SSE41,
+	AVX2,
+};
+
+struct Source {
+	uint8_t const *bits = nullptr;
+	int width = 0;
+	int height = 0;
+	ptrdiff_t stride = 0;
+};
+
+struct Target {
+	uint8_t *bits = nullptr; // 矩形の左上の画素
+	ptrdiff_t stride = 0;
+	int x = 0; // 拡大後の画像における矩形の位置
+	int y = 0;
+	int width = 0;
+	int height = 0;
+};
+
+Isa isa();
+void setIsa(Isa isa);
+char const *isaName(Isa isa);
+
+int scaledLength(int length, double scale);
+void scale(Source const &src, Target const &dst, double scale);
+
+void replicate(Source const &src, Target const &dst, int factor);
+void nearest(Source const &src, Target const &dst, double scale);
+void bilinear(Source const &src, Target const &dst, double scale);
+void box(Source const &src, Target const &dst, double scale);
+
+} // namespace ImageScaler
+
+#endif // IMAGESCALER_H
@@ -0,0 +1,239 @@
+#include "InputQueue.h"
+#include "Histogram.h"
+#include <algorithm>
+
+InputQueue::Event InputQueue::Event::mouse(UINT16 flags, int x, int y)
+{
+	Event e;
+	e.type = Mouse;
+	e.flags = flags;
+	e.x = (UINT16)std::max(x, 0);
+	e.y = (UINT16)std::max(y, 0);
+	return e;
+}
+
+InputQueue::Event InputQueue::Event::keyboard(bool down, bool repeat, UINT32 code)
+{
+	Event e;
+	e.type = Keyboard;
+	e.down = down;
+	e.repeat = repeat;
+	e.code = code;
+	return e;
+}
+
+InputQueue::InputQueue()
+{
+	reset();
+}
+
+/**
+ * @brief キューを空にして統計をリセットする（読み書きが止まっている時に呼ぶこと）
+ */
+void InputQueue::reset()
+{
+	for (size_t i = 0; i < CAPACITY; i++) {
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	enqueue_pos_.store(0, std::memory_order_relaxed);
+	dequeue_pos_ = 0;
+	received_ = 0;
+	coalesced_ = 0;
+	sent_ = 0;
+	dropped_ = 0;
+	resynced_ = 0;
+	resync_ = false;
+	indicators_ = 0;
+	pressed_keys_.clear();
+	pressed_buttons_ = 0;
+	last_x_ = 0;
+	last_y_ = 0;
+}
+
+/**
+ * @brief イベントが積まれた時に呼ぶ関数（RDPスレッドを起こす）を設定する
+ */
+void InputQueue::setNotify(std::function<void ()> fn)
+{
+	notify_ = std::move(fn);
+}
+
+/**
+ * @brief 積まれてから送信するまでの時間（マイクロ秒）を記録するヒストグラムを設定する
+ */
+void InputQueue::setLatencyHistogram(Histogram *histogram)
+{
+	latency_ = histogram;
+}
+
+/**
+ * @brief サーバーが知らせたロックキーの状態を記録する（同期し直す時に使う。どのスレッドから呼んでもよい）
+ * @param flags KBD_SYNC_SCROLL_LOCK等
+ */
+void InputQueue::setKeyboardIndicators(UINT16 flags)
+{
+	indicators_.store(flags, std::memory_order_relaxed);
+}
+
+/**
+ * @brief イベントを積む（どのスレッドから呼んでもよい）
+ *
+ * 移動、ホイール、キーリピートは、キーとボタン専用の分を残して一杯なら捨てる。
+ * キーやボタンを捨てた場合は、次のdrain()で同期し直す。
+ * @return キューが一杯で積めなかった場合はfalse
+ */
+bool InputQueue::push(const Event &e)
+{
+	received_.fetch_add(1, std::memory_order_relaxed);
+
+	bool optional = isOptional(e);
+	Cell *cell;
+	size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+	while (1) {
+		cell = &cells_[pos & MASK];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0 && optional) {
+			// RESERVE個先がまだ読まれていなければ、残りはキーとボタンのために空けておく
+			size_t ahead = pos + RESERVE;
+			if ((intptr_t)cells_[ahead & MASK].sequence.load(std::memory_order_acquire) - (intptr_t)ahead < 0) {
+				dif = -1;
+			}
+		}
+		if (dif == 0) {
+			if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			if (!optional) {
+				resync_.store(true, std::memory_order_release);
+				if (notify_) {
+					notify_();
+				}
+			}
+			return false;
+		} else {
+			pos = enqueue_pos_.load(std::memory_order_relaxed);
+		}
+	}
+	cell->event = e;
+	cell->event.time = std::chrono::steady_clock::now();
+	cell->sequence.store(pos + 1, std::memory_order_release);
+
+	if (notify_) {
+		notify_();
+	}
+	return true;
+}
+
+bool InputQueue::pop(Event *out)
+{
+	Cell *cell = &cells_[dequeue_pos_ & MASK];
+	size_t seq = cell->sequence.load(std::memory_order_acquire);
+	if ((intptr_t)seq - (intptr_t)(dequeue_pos_ + 1) < 0) return false;
+	*out = cell->event;
+	cell->sequence.store(dequeue_pos_ + CAPACITY, std::memory_order_release);
+	dequeue_pos_++;
+	return true;
+}
+
+bool InputQueue::isMove(const Event &e)
+{
+	return e.type == Event::Mouse && e.flags == PTR_FLAGS_MOVE;
+}
+
+/**
+ * @brief 捨てても押した状態が食い違わないイベント（移動、ホイール、キーリピート）
+ */
+bool InputQueue::isOptional(const Event &e)
+{
+	if (e.type == Event::Keyboard) return e.down && e.repeat;
+	return !(e.flags & (PTR_FLAGS_BUTTON1 | PTR_FLAGS_BUTTON2 | PTR_FLAGS_BUTTON3));
+}
+
+/**
+ * @brief 1つ送り、押されているキーとボタンを記録する
+ */
+void InputQueue::send(rdpInput *input, const Event &e)
+{
+	if (e.type == Event::Mouse) {
+		freerdp_input_send_mouse_event(input, e.flags, e.x, e.y);
+		last_x_ = e.x;
+		last_y_ = e.y;
+		UINT16 buttons = e.flags & (PTR_FLAGS_BUTTON1 | PTR_FLAGS_BUTTON2 | PTR_FLAGS_BUTTON3);
+		if (e.flags & PTR_FLAGS_DOWN) {
+			pressed_buttons_ |= buttons;
+		} else {
+			pressed_buttons_ &= ~buttons;
+		}
+	} else {
+		freerdp_input_send_keyboard_event_ex(input, e.down, e.repeat, e.code);
+		auto it = std::find(pressed_keys_.begin(), pressed_keys_.end(), e.code);
+		if (e.down) {
+			if (it == pressed_keys_.end()) {
+				pressed_keys_.push_back(e.code);
+			}
+		} else if (it != pressed_keys_.end()) {
+			pressed_keys_.erase(it);
+		}
+	}
+}
+
+/**
+ * @brief キーやボタンを捨てた後：押したままのキーとボタンを離し、ロックキーの状態を同期する
+ */
+void InputQueue::resync(rdpInput *input)
+{
+	for (UINT32 code : pressed_keys_) {
+		freerdp_input_send_keyboard_event_ex(input, FALSE, FALSE, code);
+	}
+	pressed_keys_.clear();
+	for (UINT16 button : { PTR_FLAGS_BUTTON1, PTR_FLAGS_BUTTON2, PTR_FLAGS_BUTTON3 }) {
+		if (pressed_buttons_ & button) {
+			freerdp_input_send_mouse_event(input, button, last_x_, last_y_);
+		}
+	}
+	pressed_buttons_ = 0;
+	freerdp_input_send_synchronize_event(input, indicators_.load(std::memory_order_relaxed));
+	resynced_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief RDPスレッド：溜まったイベントを送信する
+ */
+void InputQueue::drain(rdpInput *input)
+{
+	batch_.clear();
+	Event e;
+	while (pop(&e)) {
+		batch_.push_back(e);
+	}
+	if (!input) return;
+
+	auto now = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < batch_.size(); i++) {
+		Event const &ev = batch_[i];
+		if (isMove(ev) && i + 1 < batch_.size() && isMove(batch_[i + 1])) {
+			coalesced_.fetch_add(1, std::memory_order_relaxed);
+			continue; // 次の移動で上書きされる
+		}
+		send(input, ev);
+		sent_.fetch_add(1, std::memory_order_relaxed);
+		if (latency_) {
+			latency_->record(std::chrono::duration_cast<std::chrono::microseconds>(now - ev.time).count());
+		}
+	}
+	if (resync_.exchange(false, std::memory_order_acq_rel)) {
+		resync(input);
+	}
+}
+
+InputQueue::Stats InputQueue::stats() const
+{
+	Stats s;
+	s.received = received_.load(std::memory_order_relaxed);
+	s.coalesced = coalesced_.load(std::memory_order_relaxed);
+	s.sent = sent_.load(std::memory_order_relaxed);
+	s.dropped = dropped_.load(std::memory_order_relaxed);
+	s.resynced = resynced_.load(std::memory_order_relaxed);
+	return s;
+}
@@ -0,0 +1,94 @@
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <freerdp/input.h>
+
+class Histogram;
+
+/**
+ * @brief GUIスレッドからRDPスレッドへ入力イベントを渡すロックフリーのキュー
+ *
+ * 複数の書き込み側と1つの読み出し側（RDPスレッド）を想定した固定長のリング
+ * バッファ。読み出し側は溜まったイベントをまとめて送信し、その際に連続する
+ * マウス移動は最後の位置だけに間引く。ボタンやキーとの順序は保たれる。
+ * リングの最後のRESERVE個はキーとボタンのイベント専用で、移動、ホイール、
+ * キーリピートはそれより前に一杯になった時点で捨てる。それでもキーやボタンを
+ * 捨てた場合は、次に送る時に押されているキーとボタンを離して同期し直す。
+ */
+class InputQueue {
+public:
+	struct Event {
+		enum Type : quint8 {
+			Mouse,
+			Keyboard,
+		};
+		Type type = Mouse;
+		bool down = false;   // Keyboard
+		bool repeat = false; // Keyboard
+		UINT16 flags = 0;    // Mouse
+		UINT16 x = 0;
+		UINT16 y = 0;
+		UINT32 code = 0;     // Keyboard（RDPスキャンコード）
+		std::chrono::steady_clock::time_point time; // push()した時刻
+
+		static Event mouse(UINT16 flags, int x, int y);
+		static Event keyboard(bool down, bool repeat, UINT32 code);
+	};
+	struct Stats {
+		quint64 received = 0;
+		quint64 coalesced = 0;
+		quint64 sent = 0;
+		quint64 dropped = 0;
+		quint64 resynced = 0; // キーやボタンを捨てたために同期し直した回数
+	};
+private:
+	static constexpr size_t CAPACITY = 1024;
+	static constexpr size_t MASK = CAPACITY - 1;
+	static constexpr size_t RESERVE = 64; // キーとボタン専用に空けておく数
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		Event event;
+	};
+	Cell cells_[CAPACITY];
+	std::atomic<size_t> enqueue_pos_ { 0 };
+	size_t dequeue_pos_ = 0; // 読み出し側専用
+	std::vector<Event> batch_; // 読み出し側専用
+	std::atomic<bool> resync_ { false }; // キーやボタンを捨てた
+	std::atomic<UINT16> indicators_ { 0 }; // サーバーが知らせたロックキーの状態（KBD_SYNC_*）
+	// 読み出し側専用：送った状態
+	std::vector<UINT32> pressed_keys_;
+	UINT16 pressed_buttons_ = 0; // PTR_FLAGS_BUTTON*
+	UINT16 last_x_ = 0;
+	UINT16 last_y_ = 0;
+	std::function<void ()> notify_;
+	Histogram *latency_ = nullptr;
+
+	std::atomic<quint64> received_ { 0 };
+	std::atomic<quint64> coalesced_ { 0 };
+	std::atomic<quint64> sent_ { 0 };
+	std::atomic<quint64> dropped_ { 0 };
+	std::atomic<quint64> resynced_ { 0 };
+
+	bool pop(Event *out);
+	static bool isMove(Event const &e);
+	static bool isOptional(Event const &e);
+	void send(rdpInput *input, Event const &e);
+	void resync(rdpInput *input);
+public:
+	InputQueue();
+	void reset();
+	void setNotify(std::function<void ()> fn);
+	void setLatencyHistogram(Histogram *histogram);
+	void setKeyboardIndicators(UINT16 flags);
+	bool push(Event const &e);
+	void drain(rdpInput *input);
+	Stats stats() const;
+};
+
+#endif // INPUTQUEUE_H
@@ -0,0 +1,613 @@
+#include "LoadGenerator.h"
+#include "Histogram.h"
+#include "Session.h"
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <winpr/input.h>
+#include <winpr/synch.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int REPLAY_POLL_MS = 1; // 記録を再生する時に1回に待つ時間（ミリ秒）
+
+std::atomic<bool> stop_requested { false };
+
+void onSignal(int)
+{
+	stop_requested = true;
+}
+
+struct Config {
+	QString hostname;
+	QString username; // %1はセッションの番号（1から）に置き換える
+	QString password;
+	QString domain;
+	QString replay_file; // 指定すればサーバーに接続せず、記録したPDUを再生する
+	QString report_file;
+	QSize size { 1280, 800 };
+	int sessions = 1;
+	int threads = 0; // 0ならCPUの数（セッション数まで）
+	int duration = 60; // 秒
+	int ramp = 500; // セッションを開始する間隔（ミリ秒）
+	LoadScript script;
+};
+
+/**
+ * @brief 1つの負荷セッション（担当のワーカースレッドだけが触る）
+ */
+struct LoadSession {
+	int index = 0;
+	std::unique_ptr<Session> session;
+	Session::Options options;
+	Clock::time_point start_time; // 接続を始める時刻
+	bool started = false;
+	bool connected = false;
+	bool finished = false;
+	QString error;
+	qint64 connect_ms = 0;
+	Clock::time_point connected_time;
+	Clock::time_point finished_time;
+
+	// 台本の実行
+	size_t step = 0;
+	Clock::time_point next_input;
+	std::mt19937 rng;
+	QPoint pointer;
+	quint64 inputs = 0;
+
+	// フレーム
+	quint64 presented = 0;
+	quint64 damaged_pixels = 0;
+	quint64 received_bytes = 0;
+};
+
+QString sessionUser(const Config &config, int index)
+{
+	if (!config.username.contains("%1")) return config.username;
+	return config.username.arg(index + 1, 2, 10, QChar('0'));
+}
+
+// 台本の文字をキーに直す（USキーボード）
+bool charToKey(QChar c, int *vk, bool *shift)
+{
+	*shift = false;
+	ushort u = c.unicode();
+	if (u >= 'a' && u <= 'z') {
+		*vk = 'A' + (u - 'a');
+	} else if (u >= 'A' && u <= 'Z') {
+		*vk = u;
+		*shift = true;
+	} else if (u >= '0' && u <= '9') {
+		*vk = u;
+	} else if (u == ' ') {
+		*vk = VK_SPACE;
+	} else if (u == '.') {
+		*vk = VK_OEM_PERIOD;
+	} else if (u == ',') {
+		*vk = VK_OEM_COMMA;
+	} else if (u == '-') {
+		*vk = VK_OEM_MINUS;
+	} else if (u == '/') {
+		*vk = VK_OEM_2;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void pushKey(InputQueue *queue, int vk, bool down)
+{
+	UINT32 code = GetVirtualScanCodeFromVirtualKeyCode((DWORD)vk, WINPR_KBD_TYPE_IBM_ENHANCED);
+	queue->push(InputQueue::Event::keyboard(down, false, code));
+}
+
+QPoint resolvePoint(LoadSession *s, QPoint pos)
+{
+	QSize size = s->options.size;
+	if (pos.x() < 0) {
+		pos.setX(std::uniform_int_distribution<int>(0, std::max(0, size.width() - 1))(s->rng));
+	}
+	if (pos.y() < 0) {
+		pos.setY(std::uniform_int_distribution<int>(0, std::max(0, size.height() - 1))(s->rng));
+	}
+	return pos;
+}
+
+/**
+ * @brief 台本の次の操作を入力のキューに積む
+ * @return 次の操作までの時間（ミリ秒）
+ */
+int runStep(LoadSession *s, const LoadScript &script)
+{
+	if (script.steps.empty()) return 1000;
+	LoadScript::Step const &step = script.steps[s->step];
+	s->step = (s->step + 1) % script.steps.size();
+	InputQueue *queue = s->session->inputQueue();
+
+	switch (step.op) {
+	case LoadScript::Step::Wait:
+		return step.ms;
+	case LoadScript::Step::Move:
+		s->pointer = resolvePoint(s, step.pos);
+		queue->push(InputQueue::Event::mouse(PTR_FLAGS_MOVE, s->pointer.x(), s->pointer.y()));
+		break;
+	case LoadScript::Step::Click:
+		s->pointer = resolvePoint(s, step.pos);
+		queue->push(InputQueue::Event::mouse(PTR_FLAGS_MOVE, s->pointer.x(), s->pointer.y()));
+		queue->push(InputQueue::Event::mouse(PTR_FLAGS_DOWN | step.button, s->pointer.x(), s->pointer.y()));
+		queue->push(InputQueue::Event::mouse(step.button, s->pointer.x(), s->pointer.y()));
+		break;
+	case LoadScript::Step::Type:
+		for (QChar c : step.text) {
+			int vk;
+			bool shift;
+			if (!charToKey(c, &vk, &shift)) continue;
+			if (shift) {
+				pushKey(queue, VK_LSHIFT, true);
+			}
+			pushKey(queue, vk, true);
+			pushKey(queue, vk, false);
+			if (shift) {
+				pushKey(queue, VK_LSHIFT, false);
+			}
+		}
+		break;
+	case LoadScript::Step::Key:
+		pushKey(queue, step.vk, true);
+		pushKey(queue, step.vk, false);
+		break;
+	case LoadScript::Step::Scroll:
+		{
+			int flags = PTR_FLAGS_WHEEL | std::min(std::abs(step.notches) * 120, 255);
+			if (step.notches < 0) {
+				flags |= PTR_FLAGS_WHEEL_NEGATIVE;
+			}
+			queue->push(InputQueue::Event::mouse((UINT16)flags, s->pointer.x(), s->pointer.y()));
+		}
+		break;
+	}
+	s->inputs++;
+	return 0;
+}
+
+void connectSession(LoadSession *s)
+{
+	s->started = true;
+	if (!s->session->connectToHost(s->options)) {
+		s->error = s->session->errorString();
+		s->finished = true;
+		s->finished_time = Clock::now();
+		return;
+	}
+	s->connected = true;
+	s->connect_ms = s->session->connectTiming().total();
+	s->connected_time = Clock::now();
+	s->next_input = s->connected_time;
+	s->pointer = QPoint(s->options.size.width() / 2, s->options.size.height() / 2);
+}
+
+void finishSession(LoadSession *s)
+{
+	if (s->finished) return;
+	if (s->connected && s->error.isEmpty() && !s->session->errorString().isEmpty()) {
+		s->error = s->session->errorString();
+	}
+	s->received_bytes = s->session->receivedBytes();
+	s->session->disconnectFromHost();
+	s->finished = true;
+	s->finished_time = Clock::now();
+}
+
+/**
+ * @brief 受け取ったフレームをすぐに表示したことにする（確認応答を遅らせないように）
+ */
+void drainFrames(LoadSession *s)
+{
+	Session *session = s->session.get();
+	for (int i = 0; i < session->outputCount(); i++) {
+		FrameExchange::Frame frame;
+		while (session->acquireFrame(&frame, i)) {
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - frame.published).count();
+			session->telemetry().record(Telemetry::Handoff, us);
+			for (QRect const &r : frame.damage) {
+				s->damaged_pixels += (quint64)r.width() * r.height();
+			}
+			session->framePresented(frame.sequence, i);
+			s->presented++;
+		}
+	}
+}
+
+/**
+ * @brief ワーカースレッド：担当するセッションのイベントをまとめて待って処理する
+ */
+void runWorker(std::vector<LoadSession *> sessions, const Config &config, Clock::time_point deadline)
+{
+	bool replay = !config.replay_file.isEmpty();
+	while (1) {
+		auto now = Clock::now();
+		bool stopping = stop_requested || now >= deadline;
+		if (stopping) break;
+
+		// 順に接続を始める（接続中はこのスレッドの他のセッションは止まる）
+		Clock::time_point wake_at = deadline;
+		bool active = false;
+		for (LoadSession *s : sessions) {
+			if (!s->started) {
+				if (now >= s->start_time) {
+					connectSession(s);
+					now = Clock::now();
+				} else {
+					wake_at = std::min(wake_at, s->start_time);
+				}
+			}
+			if (s->connected && !s->finished) {
+				active = true;
+				wake_at = std::min(wake_at, s->next_input);
+			}
+		}
+		if (!active && std::all_of(sessions.begin(), sessions.end(), [](LoadSession *s){ return s->started; })) break;
+
+		// 全セッションのハンドルをまとめて待つ。入りきらなければ短い間隔で回る
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		DWORD count = 0;
+		bool overflow = false;
+		for (LoadSession *s : sessions) {
+			if (!s->connected || s->finished) continue;
+			DWORD n = s->session->eventHandles(&handles[count], MAXIMUM_WAIT_OBJECTS - count);
+			if (n == 0) {
+				overflow = true;
+			} else {
+				count += n;
+			}
+		}
+		qint64 ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake_at - now).count();
+		ms = std::clamp<qint64>(ms, 0, 100);
+		if (replay) {
+			// 記録の再生ではハンドルが起きないので、短い間隔で待ってから次を読む
+			ms = std::min<qint64>(ms, REPLAY_POLL_MS);
+		} else if (overflow) {
+			ms = std::min<qint64>(ms, 5);
+		}
+		if (count > 0) {
+			WaitForMultipleObjects(count, handles, FALSE, (DWORD)ms);
+		} else if (ms > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+		}
+
+		now = Clock::now();
+		for (LoadSession *s : sessions) {
+			if (!s->connected || s->finished) continue;
+			if (!s->session->poll()) {
+				finishSession(s);
+				continue;
+			}
+			drainFrames(s);
+			// 再生中も台本を実行する（送った入力はFreeRDPの再生のトランスポートが捨てる）
+			while (now >= s->next_input) {
+				s->next_input += std::chrono::milliseconds(runStep(s, config.script));
+				if (s->next_input < now - std::chrono::seconds(1)) {
+					s->next_input = now; // 大きく遅れたら追いつこうとしない
+				}
+			}
+		}
+	}
+	for (LoadSession *s : sessions) {
+		if (s->connected) {
+			finishSession(s);
+		} else if (!s->started) {
+			s->error = "not started";
+		}
+	}
+}
+
+double msOf(quint64 us)
+{
+	return us / 1000.0;
+}
+
+QJsonObject sessionReport(LoadSession const &s)
+{
+	Telemetry &telemetry = s.session->telemetry();
+	double seconds = s.connected ? std::chrono::duration<double>(s.finished_time - s.connected_time).count() : 0;
+	auto input = s.session->inputStats();
+	QJsonObject json = telemetry.toJson();
+	json["session"] = s.index + 1;
+	json["username"] = s.options.username;
+	json["connected"] = s.connected;
+	json["error"] = s.error;
+	json["connect_ms"] = s.connect_ms;
+	json["seconds"] = seconds;
+	json["frames_presented"] = (qint64)s.presented;
+	json["damaged_pixels"] = (qint64)s.damaged_pixels;
+	json["received_bytes"] = (qint64)s.received_bytes;
+	json["inputs"] = (qint64)s.inputs;
+	json["input_events_sent"] = (qint64)input.sent;
+	return json;
+}
+
+bool parseArguments(int argc, char **argv, Config *config)
+{
+	for (int i = 2; i < argc; i++) {
+		auto arg = [&](){
+			return i + 1 < argc ? QString::fromLocal8Bit(argv[++i]) : QString();
+		};
+		if (strcmp(argv[i], "--host") == 0) {
+			config->hostname = arg();
+		} else if (strcmp(argv[i], "--user") == 0) {
+			config->username = arg();
+		} else if (strcmp(argv[i], "--password") == 0) {
+			config->password = arg();
+		} else if (strcmp(argv[i], "--domain") == 0) {
+			config->domain = arg();
+		} else if (strcmp(argv[i], "--replay") == 0) {
+			config->replay_file = arg();
+		} else if (strcmp(argv[i], "--report") == 0) {
+			config->report_file = arg();
+		} else if (strcmp(argv[i], "--sessions") == 0) {
+			config->sessions = std::max(1, arg().toInt());
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			config->threads = std::max(0, arg().toInt());
+		} else if (strcmp(argv[i], "--duration") == 0) {
+			config->duration = std::max(1, arg().toInt());
+		} else if (strcmp(argv[i], "--ramp") == 0) {
+			config->ramp = std::max(0, arg().toInt());
+		} else if (strcmp(argv[i], "--size") == 0) {
+			QStringList wh = arg().split('x');
+			if (wh.size() == 2 && wh[0].toInt() > 0 && wh[1].toInt() > 0) {
+				config->size = QSize(wh[0].toInt(), wh[1].toInt());
+			}
+		} else if (strcmp(argv[i], "--script") == 0) {
+			QString path = arg();
+			QString error;
+			if (!config->script.load(path, &error)) {
+				fprintf(stderr, "%s: %s\n", path.toUtf8().constData(), error.toUtf8().constData());
+				return false;
+			}
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	if (config->hostname.isEmpty() && config->replay_file.isEmpty()) {
+		fprintf(stderr, "usage: Rapsodia --load --host <host> --user <user%%1> [--password <password>] [--domain <domain>]\n"
+						"                      [--sessions N] [--threads N] [--duration sec] [--ramp ms] [--size WxH]\n"
+						"                      [--script file] [--report file] [--replay file]\n");
+		return false;
+	}
+	if (config->password.isEmpty()) {
+		config->password = QString::fromLocal8Bit(qgetenv("RAPSODIA_PASSWORD"));
+	}
+	return true;
+}
+
+} // namespace
+
+bool LoadScript::load(const QString &path, QString *error)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		*error = file.errorString();
+		return false;
+	}
+	QStringList lines;
+	QTextStream in(&file);
+	while (!in.atEnd()) {
+		lines.push_back(in.readLine());
+	}
+	return parse(lines, error);
+}
+
+bool LoadScript::parse(const QStringList &lines, QString *error)
+{
+	steps.clear();
+	auto coord = [](QString const &s, bool *ok){
+		if (s == "*") {
+			*ok = true;
+			return -1;
+		}
+		return s.toInt(ok);
+	};
+	for (int n = 0; n < lines.size(); n++) {
+		QString line = lines[n];
+		int hash = line.indexOf('#');
+		if (hash >= 0) {
+			line.truncate(hash);
+		}
+		line = line.trimmed();
+		if (line.isEmpty()) continue;
+		QString op = line.section(' ', 0, 0).toLower();
+		QString rest = line.section(' ', 1).trimmed();
+		QStringList args = rest.split(' ', Qt::SkipEmptyParts);
+		Step step;
+		bool ok = true;
+		if (op == "wait" && args.size() == 1) {
+			step.op = Step::Wait;
+			step.ms = args[0].toInt(&ok);
+		} else if ((op == "move" || op == "click") && args.size() >= 2) {
+			step.op = op == "move" ? Step::Move : Step::Click;
+			bool okx, oky;
+			step.pos = QPoint(coord(args[0], &okx), coord(args[1], &oky));
+			ok = okx && oky;
+			step.button = PTR_FLAGS_BUTTON1;
+			if (args.size() >= 3) {
+				if (args[2] == "right") {
+					step.button = PTR_FLAGS_BUTTON2;
+				} else if (args[2] == "middle") {
+					step.button = PTR_FLAGS_BUTTON3;
+				} else if (args[2] != "left") {
+					ok = false;
+				}
+			}
+		} else if (op == "type" && !rest.isEmpty()) {
+			step.op = Step::Type;
+			step.text = rest;
+		} else if (op == "key" && args.size() == 1) {
+			static const struct { char const *name; int vk; } keys[] = {
+				{ "enter", VK_RETURN },
+				{ "tab", VK_TAB },
+				{ "escape", VK_ESCAPE },
+				{ "backspace", VK_BACK },
+				{ "up", VK_UP },
+				{ "down", VK_DOWN },
+				{ "left", VK_LEFT },
+				{ "right", VK_RIGHT },
+				{ "pageup", VK_PRIOR },
+				{ "pagedown", VK_NEXT },
+			};
+			step.op = Step::Key;
+			ok = false;
+			for (auto const &k : keys) {
+				if (args[0].toLower() == k.name) {
+					step.vk = k.vk;
+					ok = true;
+				}
+			}
+		} else if (op == "scroll" && args.size() == 1) {
+			step.op = Step::Scroll;
+			step.notches = args[0].toInt(&ok);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			*error = QString("line %1: %2").arg(n + 1).arg(lines[n]);
+			return false;
+		}
+		steps.push_back(step);
+	}
+	return true;
+}
+
+/**
+ * @brief 台本を指定しない場合の操作（ポインタの移動、クリック、入力、スクロール）
+ */
+LoadScript LoadScript::defaultScript()
+{
+	LoadScript script;
+	QString error;
+	script.parse({
+		"move * *",
+		"wait 200",
+		"move * *",
+		"wait 200",
+		"click * *",
+		"wait 500",
+		"type hello world",
+		"key enter",
+		"wait 500",
+		"scroll -3",
+		"wait 500",
+		"scroll 3",
+		"wait 1000",
+	}, &error);
+	return script;
+}
+
+/**
+ * @brief ウィンドウを開かずに、複数のセッションで同時に接続して負荷をかける
+ *
+ * Rapsodia --load --host <host> --user <user%1> --sessions N ... で実行する。
+ * セッションはrampミリ秒おきに接続し、ワーカースレッド（既定はCPUの数）に
+ * 振り分ける。各ワーカーは担当の全セッションのイベントをまとめて待ち、
+ * 台本どおりに入力を送り、受け取ったフレームはすぐに表示したことにする。
+ * 終わったら、セッションごとのフレーム数、受信量、各段階の時間を表示する。
+ * --replay を指定すると、サーバーに接続せずに記録したPDUを再生する（動作確認用）。
+ */
+int runLoadGenerator(int argc, char **argv)
+{
+	Config config;
+	config.script = LoadScript::defaultScript();
+	if (!parseArguments(argc, argv, &config)) return 1;
+
+	std::signal(SIGINT, onSignal);
+	std::signal(SIGTERM, onSignal);
+
+	int threads = config.threads > 0 ? config.threads : QThread::idealThreadCount();
+	threads = std::clamp(threads, 1, config.sessions);
+
+	auto start = Clock::now();
+	std::vector<std::unique_ptr<LoadSession>> sessions;
+	for (int i = 0; i < config.sessions; i++) {
+		auto s = std::make_unique<LoadSession>();
+		s->index = i;
+		s->session = std::make_unique<Session>();
+		s->options.hostname = config.replay_file.isEmpty() ? config.hostname : QString("replay");
+		s->options.username = sessionUser(config, i);
+		s->options.password = config.password;
+		s->options.domain = config.domain;
+		s->options.size = config.size;
+		s->options.replay_file = config.replay_file;
+		s->start_time = start + std::chrono::milliseconds((qint64)config.ramp * i);
+		s->rng.seed((unsigned)i + 1);
+		sessions.push_back(std::move(s));
+	}
+
+	// 接続を終えるまでの時間を含めて、最後のセッションもdurationだけ動かす
+	auto deadline = start + std::chrono::milliseconds((qint64)config.ramp * (config.sessions - 1)) + std::chrono::seconds(config.duration);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		std::vector<LoadSession *> assigned;
+		for (int i = t; i < config.sessions; i += threads) {
+			assigned.push_back(sessions[i].get());
+		}
+		workers.emplace_back(runWorker, assigned, std::cref(config), deadline);
+	}
+	fprintf(stderr, "%d sessions on %d threads, %d s\n", config.sessions, threads, config.duration);
+	for (auto &w : workers) {
+		w.join();
+	}
+
+	QFile report;
+	if (!config.report_file.isEmpty()) {
+		report.setFileName(config.report_file);
+		if (!report.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			fprintf(stderr, "failed to open %s\n", config.report_file.toUtf8().constData());
+		}
+	}
+
+	printf("%-4s %-16s %8s %8s %8s %9s %17s %17s %13s\n", "#", "user", "connect", "frames", "fps", "MB", "decode p50/p99", "handoff p50/p99", "input p99");
+	int connected = 0;
+	quint64 total_frames = 0;
+	quint64 total_bytes = 0;
+	for (auto const &s : sessions) {
+		if (report.isOpen()) {
+			report.write(QJsonDocument(sessionReport(*s)).toJson(QJsonDocument::Compact) + '\n');
+		}
+		if (!s->connected) {
+			printf("%-4d %-16s failed: %s\n", s->index + 1, s->options.username.toUtf8().constData(), s->error.toUtf8().constData());
+			continue;
+		}
+		connected++;
+		total_frames += s->presented;
+		total_bytes += s->received_bytes;
+		double seconds = std::max(1e-9, std::chrono::duration<double>(s->finished_time - s->connected_time).count());
+		Telemetry &telemetry = s->session->telemetry();
+		Histogram const &decode = telemetry.histogram(Telemetry::Decode);
+		Histogram const &handoff = telemetry.histogram(Telemetry::Handoff);
+		Histogram const &input = telemetry.histogram(Telemetry::Input);
+		printf("%-4d %-16s %6lldms %8llu %8.1f %9.1f %7.2f/%7.2fms %7.2f/%7.2fms %11.2fms%s%s\n",
+			   s->index + 1, s->options.username.toUtf8().constData(), (long long)s->connect_ms,
+			   (unsigned long long)s->presented, s->presented / seconds, s->received_bytes / 1048576.0,
+			   msOf(decode.percentile(50)), msOf(decode.percentile(99)),
+			   msOf(handoff.percentile(50)), msOf(handoff.percentile(99)),
+			   msOf(input.percentile(99)),
+			   s->error.isEmpty() ? "" : "  ", s->error.toUtf8().constData());
+	}
+	printf("total: %d/%d connected, %llu frames, %.1f MB received\n", connected, config.sessions, (unsigned long long)total_frames, total_bytes / 1048576.0);
+	return connected == config.sessions ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QPoint>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/**
+ * @brief 負荷試験用の入力の台本
+ *
+ * 1行に1つの操作を書き、最後まで行ったら先頭に戻る。#から行末はコメント。
+ * 座標に * を書くと、画面の中の乱数の位置になる。
+ * - wait <ミリ秒>
+ * - move <x> <y>
+ * - click <x> <y> [left|right|middle]
+ * - type <文字列>（英数字、空白、. , - /）
+ * - key <enter|tab|escape|backspace|up|down|left|right|pageup|pagedown>
+ * - scroll <ノッチ数>（正なら上、負なら下）
+ */
+class LoadScript {
+public:
+	struct Step {
+		enum Op {
+			Wait,
+			Move,
+			Click,
+			Type,
+			Key,
+			Scroll,
+		};
+		Op op = Wait;
+		int ms = 0;
+		QPoint pos; // -1なら乱数
+		int button = 0; // PTR_FLAGS_BUTTON*
+		QString text;
+		int vk = 0;
+		int notches = 0;
+	};
+	std::vector<Step> steps;
+
+	bool load(const QString &path, QString *error);
+	bool parse(const QStringList &lines, QString *error);
+	static LoadScript defaultScript();
+};
+
+int runLoadGenerator(int argc, char **argv);
+
+#endif // LOADGENERATOR_H
@@ -2,118 +2,28 @@
 #include "ui_MainWindow.h"
 #include "ConnectionDialog.h"
 #include "MySettings.h"
+#include "PersistentCache.h"
+#include "MyView.h"
+#include "SessionWidget.h"
+#include "joinpath.h"
+#include <QDateTime>
+#include <QDir>
+#include <QLabel>
+#include <QPushButton>
 #include <QPainter>
+#include <QTabBar>
 #include <QWindow>
-#include <thread>
 #include "Global.h"
 
-struct MyClientContext {
-	rdpClientContext rdpcc;
-	MainWindow *self = nullptr;
-	DispClientContext *disp = nullptr;
-};
-
-class Session {
-public:
-	enum Version {
-		V1,
-		V2,
-	};
-#if 1
-	Version version() { return V1; }
-
-	freerdp *rdp = nullptr;
-
-	void context_new(MainWindow *self)
-	{
-		rdp = freerdp_new();
-		freerdp_context_new(rdp);
-	}
-
-	void context_free()
-	{
-		freerdp_free(rdp);
-		rdp = nullptr;
-	}
-
-	freerdp *rdp_instance()
-	{
-		return rdp;
-	}
-
-	s_disp_client_context *disp_client_context()
-	{
-		return nullptr;
-	}
-#else
-	Version version() { return V2; }
-
-	union {
-		rdpContext *rdp;
-		MyClientContext *cc;
-	} d = {};
-
-	void context_new(MainWindow *self)
-	{
-		RDP_CLIENT_ENTRY_POINTS entry = {};
-		entry.Version = RDP_CLIENT_INTERFACE_VERSION;
-		entry.Size = sizeof(RDP_CLIENT_ENTRY_POINTS_V1);
-		entry.ContextSize = sizeof(MyClientContext);
-		// entry.GlobalInit = clientGlobalInit;
-		// entry.GlobalUninit = clientGlobalUninit;
-		// entry.ClientNew = clientContextNew;
-		// entry.ClientFree = clientContextFree;
-		// entry.ClientStart = clientContextStart;
-		// entry.ClientStop = clientContextStop;
-
-		d.rdp = freerdp_client_context_new(&entry);
-		d.cc->self = self;
-
-		d.rdp->update->EndPaint = self->rdp_end_paint;
-	}
-
-	void context_free()
-	{
-		freerdp_client_context_free(d.rdp);
-		d.rdp = nullptr;
-	}
-
-	freerdp *rdp_instance()
-	{
-		return d.rdp ? d.rdp->instance : nullptr;
-	}
-
-	s_disp_client_context *disp_client_context()
-	{
-		return d.cc->disp;
-	}
-#endif
-	rdpSettings *rdp_settings()
-	{
-		auto *inst = rdp_instance();
-		return (inst && inst->context) ? inst->context->settings : nullptr;
-	}
-
-	rdpGdi *rdp_gdi()
-	{
-		auto *inst = rdp_instance();
-		return (inst && inst->context) ? inst->context->gdi : nullptr;
-	}
-};
-
 struct MainWindow::Private {
-	Session session;
 	QTimer update_timer;
-	bool connected = false;
-	QSize size { 1920, 1080 };
-	std::thread rdp_thread;
-	bool interrupted = false;
-	int dynamic_resize_counter = 0;
 
-	constexpr static UINT32 rdp_pixel_format = PIXEL_FORMAT_RGBX32;
-	constexpr static QImage::Format screen_image_foramt = QImage::Format_RGBX8888;
+	QString telemetry_file; // 統計を定期的に追記するファイル（JSON Lines）
+	int telemetry_interval = 10; // 秒
 
-	QImage screen_image;
+	QLabel *status_label = nullptr;
+	QPushButton *cancel_button = nullptr;
+	int status_counter = 0;
 };
 
 MainWindow::MainWindow(QWidget *parent)
@@ -131,7 +41,17 @@ MainWindow::MainWindow(QWidget *parent)
 	m->update_timer.setInterval(10);
 	m->update_timer.start();
 
-	connect(this, &MainWindow::requestUpdateScreen, this, &MainWindow::updateScreen);
+	connect(ui->tab_widget, &QTabWidget::tabCloseRequested, this, &MainWindow::closeTab);
+	connect(ui->tab_widget, &QTabWidget::currentChanged, this, &MainWindow::onCurrentTabChanged);
+
+	m->status_label = new QLabel(this);
+	statusBar()->addPermanentWidget(m->status_label);
+	m->cancel_button = new QPushButton("Cancel", this);
+	m->cancel_button->setVisible(false);
+	statusBar()->addPermanentWidget(m->cancel_button);
+	connect(m->cancel_button, &QPushButton::clicked, this, [this](){
+		doDisconnect();
+	});
 
 	{
 		Qt::WindowStates state = windowState();
@@ -140,21 +60,29 @@ MainWindow::MainWindow(QWidget *parent)
 		settings.beginGroup("MainWindow");
 		bool maximized = settings.value("Maximized").toBool();
 		restoreGeometry(settings.value("Geometry").toByteArray());
+		ui->action_view_multi_monitor->setChecked(settings.value("MultiMonitor", false).toBool());
 		settings.endGroup();
 		if (maximized) {
 			state |= Qt::WindowMaximized;
 			setWindowState(state);
 		}
+
+		settings.beginGroup("Telemetry");
+		m->telemetry_file = settings.value("File").toString();
+		m->telemetry_interval = std::max(1, settings.value("Interval", 10).toInt());
+		ui->action_view_statistics_overlay->setChecked(settings.value("Overlay", false).toBool());
+		settings.endGroup();
 	}
 
 	// フォーカスポリシーの設定
-	ui->widget_view->setFocusPolicy(Qt::StrongFocus);
 	setFocusPolicy(Qt::StrongFocus);
 }
 
 MainWindow::~MainWindow()
 {
-	doDisconnect();
+	while (ui->tab_widget->count() > 0) {
+		closeTab(0);
+	}
 	delete m;
 	delete ui;
 }
@@ -165,181 +93,217 @@ void MainWindow::setDefaultWindowTitle()
 	setWindowTitle(title);
 }
 
-freerdp *MainWindow::rdp_instance()
-{
-	return m->session.rdp_instance();
-}
-
-rdpSettings *MainWindow::rdp_settings()
+SessionWidget *MainWindow::currentSession() const
 {
-	return m->session.rdp_settings();
+	return qobject_cast<SessionWidget *>(ui->tab_widget->currentWidget());
 }
 
-s_disp_client_context *MainWindow::disp_client_context()
+SessionWidget *MainWindow::sessionAt(int index) const
 {
-	return m->session.disp_client_context();
+	return qobject_cast<SessionWidget *>(ui->tab_widget->widget(index));
 }
 
-rdpGdi *MainWindow::rdp_gdi()
+MyView *MainWindow::currentView() const
 {
-	return m->session.rdp_gdi();
-}
-
-QSize MainWindow::newSize() const
-{
-	int scale = ui->widget_view->scale();
-	int w = ui->widget_view->width() / scale;
-	int h = ui->widget_view->height() / scale;
-	w = std::clamp(w, DISPLAY_CONTROL_MIN_MONITOR_WIDTH, DISPLAY_CONTROL_MAX_MONITOR_WIDTH);
-	h = std::clamp(h, DISPLAY_CONTROL_MIN_MONITOR_HEIGHT, DISPLAY_CONTROL_MAX_MONITOR_HEIGHT);
-	return {w, h};
+	SessionWidget *s = currentSession();
+	return s ? s->view() : nullptr;
 }
 
+/**
+ * @brief 新しいタブを開いて接続を始める。セッションごとにRDPスレッドとフレームバッファを持つ
+ *
+ * 接続はRDPスレッドで行うので、その間もUIは止まらない。結果はonSessionConnected()で受け取る。
+ */
 void MainWindow::doConnect(const QString &hostname, const QString &username, const QString &password, const QString &domain)
 {
-	if (m->connected) {
-		doDisconnect();
-	}
-
-	// 動的解像度が有効な場合は、現在のビューサイズに合わせる
-	if (isDynamicResizingEnabled()) {
-		m->size = newSize();
+	Session::Options options;
+	options.hostname = hostname;
+	options.username = username;
+	options.password = password;
+	options.domain = domain;
+	options.record_file = global->record_file;
+	if (!global->export_name.isEmpty()) {
+		// 複数のセッションを公開する場合は、2つ目から名前に番号を付ける
+		int n = ++global->export_count;
+		options.export_name = n == 1 ? global->export_name : QString("%1-%2").arg(global->export_name).arg(n);
 	}
+	{
+		// 録画先のディレクトリが設定されていれば、接続ごとに画面を録画する
+		MySettings settings;
+		settings.beginGroup("Recording");
+		QString dir = settings.value("Directory").toString();
+		settings.endGroup();
+		if (!dir.isEmpty() && QDir().mkpath(dir)) {
+			QString name = hostname + "-" + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") + ".rrec";
+			options.video_file = dir / name;
+		}
 
-	m->interrupted = false;
-
-	m->session.context_new(this);
-
-	// コールバック関数の設定
-	rdp_instance()->PreConnect = rdp_pre_connect;
-	rdp_instance()->PostConnect = rdp_post_connect;
-	rdp_instance()->PostDisconnect = rdp_post_disconnect;
-	rdp_instance()->Authenticate = rdp_authenticate;
-
-	// 接続設定
-	rdpSettings *settings = rdp_instance()->context->settings;
-	freerdp_settings_set_string(settings, FreeRDP_ServerHostname, hostname.toUtf8().constData());
-	freerdp_settings_set_string(settings, FreeRDP_Username, username.toUtf8().constData());
-	freerdp_settings_set_string(settings, FreeRDP_Password, password.toUtf8().constData());
-	freerdp_settings_set_string(settings, FreeRDP_Domain, domain.toUtf8().constData());
-	freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, m->size.width());
-	freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, m->size.height());
-
-	if (m->session.version() == Session::V2) {
-		// Display拡張を有効化（動的解像度変更のため）
-		freerdp_settings_set_bool(settings, FreeRDP_SupportDisplayControl, TRUE);
-		freerdp_settings_set_bool(settings, FreeRDP_DynamicResolutionUpdate, TRUE);
+		// 永続ビットマップキャッシュ（ホストとユーザーごと）
+		settings.beginGroup("BitmapCache");
+		bool cache = settings.value("Enabled", true).toBool();
+		settings.endGroup();
+		if (cache && QDir().mkpath(PersistentCache::directory())) {
+			options.bitmap_cache_file = PersistentCache::filePath(hostname, username);
+		}
 	}
 
-	// 安全なパフォーマンス最適化設定のみ適用
-	freerdp_settings_set_bool(settings, FreeRDP_FastPathOutput, TRUE);
-	freerdp_settings_set_bool(settings, FreeRDP_FastPathInput, TRUE);
-	freerdp_settings_set_bool(settings, FreeRDP_BitmapCacheEnabled, TRUE);
-	freerdp_settings_set_uint32(settings, FreeRDP_CompressionLevel, PACKET_COMPR_TYPE_RDP8);
-	freerdp_settings_set_uint32(settings, FreeRDP_OffscreenSupportLevel, 1);
-	freerdp_settings_set_uint32(settings, FreeRDP_GlyphSupportLevel, 1);
-	freerdp_settings_set_bool(settings, FreeRDP_SurfaceCommandsEnabled, TRUE);
-	freerdp_settings_set_bool(settings, FreeRDP_NetworkAutoDetect, TRUE);
-
-#if 0
-	freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, true);
-#endif
-	freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, true);
-	freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444v2, true);
-	freerdp_settings_set_bool(settings, FreeRDP_GfxH264, true);
-	freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, true);
-	freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32);
-
-	// 接続実行
-	if (freerdp_connect(rdp_instance())) {
-		m->connected = true;
-		m->update_timer.start();
-		ui->widget_view->setRdpInstance(rdp_instance());
+	auto *session = new SessionWidget;
+	session->setTelemetryFile(m->telemetry_file, m->telemetry_interval);
+	session->setDynamicResolution(isDynamicResizingEnabled());
+	session->setMultiMonitor(ui->action_view_multi_monitor->isChecked());
+	session->view()->setFitToWindow(ui->action_view_fit_to_window->isChecked());
+	session->view()->setOverlayVisible(ui->action_view_statistics_overlay->isChecked());
+	int index = ui->tab_widget->addTab(session, hostname);
+	ui->tab_widget->setCurrentIndex(index);
 
-		start_rdp_thread();
+	connect(session, &SessionWidget::connected, this, &MainWindow::onSessionConnected);
+	connect(session, &SessionWidget::progress, this, [this, session](const QString &text){
+		if (session == currentSession()) {
+			statusBar()->showMessage(text);
+		}
+	});
+	connect(session, &SessionWidget::disconnected, this, [this](){
+		updateWindowTitle();
+		updateCancelButton();
+	});
 
-		statusBar()->showMessage("Connected to " + hostname);
+	// 接続開始
+	statusBar()->showMessage("Connecting to " + hostname);
+	session->connectToHost(options);
+	updateCancelButton();
+}
 
-		QString title = hostname + " - Rapsodia";
-		setWindowTitle(title);
+void MainWindow::onSessionConnected(bool ok, const QString &error)
+{
+	auto *session = qobject_cast<SessionWidget *>(sender());
+	if (!session || ui->tab_widget->indexOf(session) < 0) return; // 既に閉じたタブ
+	updateCancelButton();
+	if (ok) {
+		statusBar()->showMessage("Connected to " + session->hostname());
+		updateWindowTitle();
+		if (session == currentSession()) {
+			session->setFocus();
+		}
 	} else {
-		QMessageBox::critical(this, "Error", "Failed to connect to " + hostname);
-		m->session.context_free();
+		QString hostname = session->hostname();
+		closeTab(ui->tab_widget->indexOf(session));
+		if (error != "canceled") {
+			QMessageBox::critical(this, "Error", "Failed to connect to " + hostname + (error.isEmpty() ? QString() : "\n" + error));
+		}
+		statusBar()->clearMessage();
 	}
 }
 
+/**
+ * @brief 現在のタブが接続中の場合だけ、ステータスバーに中止ボタンを出す
+ */
+void MainWindow::updateCancelButton()
+{
+	SessionWidget *session = currentSession();
+	m->cancel_button->setVisible(session && session->isConnecting());
+}
+
+/**
+ * @brief 現在のタブを切断して閉じる（接続中なら中止する）
+ */
 void MainWindow::doDisconnect()
 {
-	ui->widget_view->setRdpInstance(nullptr);
-	m->update_timer.stop();
+	int index = ui->tab_widget->currentIndex();
+	if (index < 0) return;
+	closeTab(index);
+	statusBar()->showMessage("Disconnected");
+}
 
-	m->interrupted = true;
-	if (m->rdp_thread.joinable()) {
-		m->rdp_thread.join();
-	}
+void MainWindow::closeTab(int index)
+{
+	SessionWidget *session = sessionAt(index);
+	if (!session) return;
+	ui->tab_widget->removeTab(index);
+	// 切断はRDPスレッドで行い、終わったらタブを削除する
+	session->closeLater();
+	updateWindowTitle();
+	updateCancelButton();
+}
 
-	if (rdp_instance()) {
-		freerdp_disconnect(rdp_instance());
-		m->session.context_free();
+void MainWindow::onCurrentTabChanged(int index)
+{
+	(void)index;
+	updateWindowTitle();
+	updateCancelButton();
+	SessionWidget *session = currentSession();
+	m->status_label->setText(session ? session->statusText() : QString());
+	if (session) {
+		session->setFocus();
 	}
-	m->connected = false;
-	statusBar()->showMessage("Disconnected");
+}
 
-	QImage image(m->size.width(), m->size.height(), QImage::Format_RGBX8888);
-	image.fill(Qt::black);
-	m->screen_image = image;
-	if (m->session.version() == Session::V2) {
-		image = image.copy();
+void MainWindow::updateWindowTitle()
+{
+	SessionWidget *session = currentSession();
+	if (session && session->isConnected()) {
+		QString title = session->hostname() + " - Rapsodia";
+		setWindowTitle(title);
+	} else {
+		setDefaultWindowTitle();
 	}
-	ui->widget_view->setImage(image, QRect{});
-
-	setDefaultWindowTitle();
 }
 
 void MainWindow::onIntervalTimer()
 {
-	if (m->interrupted) return;
-	if (!m->connected) return;
+	int count = ui->tab_widget->count();
+	for (int i = 0; i < count; i++) {
+		sessionAt(i)->tick();
+	}
 
-	if (m->dynamic_resize_counter > 0) {
-		m->dynamic_resize_counter--;
-		if (m->dynamic_resize_counter == 0) {
-			resizeDynamic();
-			return;
+	if (++m->status_counter >= 100) { // 約1秒ごと
+		m->status_counter = 0;
+		for (int i = 0; i < count; i++) {
+			sessionAt(i)->updateStatistics();
 		}
+		updateStatusLabel();
 	}
 }
 
-void MainWindow::updateScreen()
+void MainWindow::updateStatusLabel()
 {
-	if (m->interrupted) return;
-	if (!m->connected) return;
-
-	QImage image;
-	std::swap(image, m->screen_image);
-	if (!image.isNull()) {
-		if (m->session.version() == Session::V1) {
-			ui->widget_view->setImage(image, QRect{});
-		}
+	SessionWidget *session = currentSession();
+	QString text = session ? session->statusText() : QString();
+	if (ui->tab_widget->count() > 1) {
+		text = QString("%1 sessions, ").arg(ui->tab_widget->count()) + text;
 	}
+	m->status_label->setText(text);
 }
 
-void MainWindow::updateScreen2(QImage const &image, QRect const &rect)
+/**
+ * @brief watchedが複数モニターのウィンドウなら、そのセッションとビューを返す
+ */
+static MyView *findMonitorView(QTabWidget *tabs, QObject *watched, SessionWidget **session)
 {
-	if (m->interrupted) return;
-	if (!m->connected) return;
-
-	if (!image.isNull()) {
-		if (m->session.version() == Session::V2) {
-			ui->widget_view->setImage(image, rect);
+	for (int i = 0; i < tabs->count(); i++) {
+		auto *s = qobject_cast<SessionWidget *>(tabs->widget(i));
+		MyView *view = s ? s->monitorView(watched) : nullptr;
+		if (view) {
+			*session = s;
+			return view;
 		}
 	}
+	return nullptr;
 }
 
 bool MainWindow::eventFilter(QObject *watched, QEvent *event)
 {
-	if (watched == windowHandle()) {
-		if (event->type() == QEvent::KeyPress || event->type() == QEvent::KeyRelease) {
+	if (event->type() == QEvent::KeyPress || event->type() == QEvent::KeyRelease) {
+		SessionWidget *session = nullptr;
+		MyView *view = nullptr;
+		bool monitor = false; // 複数モニターのウィンドウへのキー入力
+		if (watched == windowHandle()) {
+			session = currentSession();
+			view = currentView();
+		} else {
+			view = findMonitorView(ui->tab_widget, watched, &session);
+			monitor = view != nullptr;
+		}
+		if (watched == windowHandle() || monitor) {
 			bool press = (event->type() == QEvent::KeyPress);
 			QKeyEvent *e = static_cast<QKeyEvent *>(event);
 			int key = e->key();
@@ -348,31 +312,54 @@ bool MainWindow::eventFilter(QObject *watched, QEvent *event)
 			if (key == Qt::Key_F) {
 				if (press && (e->modifiers() & Qt::KeyboardModifierMask) == (Qt::ControlModifier | Qt::ShiftModifier | Qt::AltModifier)) {
 					// Ctrl+Fでフルスクリーン切り替え
-					if (isFullScreen()) {
+					if (session && session->hasMonitorWindows()) {
+						// 複数モニターではモニターのウィンドウを表示する、または隠してメインウィンドウに戻る
+						bool visible = !monitor && !session->isMonitorWindowsVisible();
+						session->setMonitorWindowsVisible(visible);
+						if (!visible) {
+							activateWindow();
+						}
+					} else if (isFullScreen()) {
 						menuBar()->setVisible(true);
 						statusBar()->setVisible(true);
+						ui->tab_widget->tabBar()->setVisible(true);
 						showNormal();
 					} else {
 						menuBar()->setVisible(false);
 						statusBar()->setVisible(false);
+						ui->tab_widget->tabBar()->setVisible(false);
 						showFullScreen();
 					}
 					return true; // イベントを処理済みとしてマーク
 				}
-			} else if (key == Qt::Key_D) {
+			} else if (key == Qt::Key_S) {
 				if (press && (e->modifiers() & Qt::KeyboardModifierMask) == (Qt::ControlModifier | Qt::ShiftModifier | Qt::AltModifier)) {
-					if (ui->widget_view->scale() == 1) {
-						ui->widget_view->setScale(2);
-					} else {
-						ui->widget_view->setScale(1);
+					ui->action_view_statistics_overlay->toggle();
+					return true;
+				}
+			} else if (key == Qt::Key_Tab) {
+				if (press && (e->modifiers() & Qt::KeyboardModifierMask) == (Qt::ControlModifier | Qt::ShiftModifier | Qt::AltModifier)) {
+					// Ctrl+Shift+Alt+Tabで次のタブへ
+					int count = ui->tab_widget->count();
+					if (count > 1) {
+						ui->tab_widget->setCurrentIndex((ui->tab_widget->currentIndex() + 1) % count);
 					}
-					if (isDynamicResizingEnabled()) {
-						resizeDynamicLater();
+					return true;
+				}
+			} else if (key == Qt::Key_D) {
+				if (press && (e->modifiers() & Qt::KeyboardModifierMask) == (Qt::ControlModifier | Qt::ShiftModifier | Qt::AltModifier)) {
+					if (view && !monitor) {
+						if (view->scale() == 1) {
+							view->setScale(2);
+						} else {
+							view->setScale(1);
+						}
+						currentSession()->resizeDynamicLater();
 					}
 					return true;
 				}
 			}
-			if (ui->widget_view->onKeyEvent(e)) return true;
+			if (view && view->onKeyEvent(e)) return true;
 		}
 	}
 #if 0
@@ -385,13 +372,6 @@ bool MainWindow::eventFilter(QObject *watched, QEvent *event)
 	return false;
 }
 
-void MainWindow::resizeEvent(QResizeEvent *event)
-{
-	QMainWindow::resizeEvent(event);
-	ui->widget_view->layoutView();
-	resizeDynamicLater();
-}
-
 void MainWindow::on_action_connect_triggered()
 {
 	MySettings settings;
@@ -424,48 +404,6 @@ void MainWindow::on_action_disconnect_triggered()
 	doDisconnect();
 }
 
-void MainWindow::start_rdp_thread()
-{
-	m->rdp_thread = std::thread([this]() {
-		while (true) {
-			if (m->interrupted) break;
-			int count = 0;
-			if (rdp_instance() && m->connected) {
-				// イベント処理
-				HANDLE handles[64];
-				count = freerdp_get_event_handles(rdp_instance()->context, handles, 64);
-				auto r = WaitForMultipleObjects(count, handles, FALSE, 100);
-				if (r == WAIT_FAILED) {
-					break;
-				}
-				if (!freerdp_check_event_handles(rdp_instance()->context)) {
-					break;
-				}
-				if (m->session.version() == Session::V1) {
-					QImage new_image;
-					if (m->screen_image.isNull()) {
-						auto *gdi = rdp_gdi();
-						if (gdi->primary_buffer) {
-							BYTE *data = gdi->primary_buffer;
-							int width = gdi->width;
-							int height = gdi->height;
-							int stride = gdi->stride;
-							new_image = QImage(data, width, height, stride, QImage::Format_RGBX8888);
-						}
-					}
-					if (!new_image.isNull()) {
-						m->screen_image = new_image;
-						emit requestUpdateScreen();
-					}
-				}
-			}
-			if (count == 0) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(5));
-			}
-		}
-	});
-}
-
 void MainWindow::closeEvent(QCloseEvent *event)
 {
 	if (isFullScreen()) {
@@ -473,14 +411,20 @@ void MainWindow::closeEvent(QCloseEvent *event)
 		return;
 	}
 
-	if (m->connected) {
+	bool connected = false;
+	for (int i = 0; i < ui->tab_widget->count(); i++) {
+		connected = connected || sessionAt(i)->isConnected();
+	}
+	if (connected) {
 		if (QMessageBox::question(this, "Confirm Disconnect", "Are you sure you want to close Remote Desktop Client?", QMessageBox::Yes | QMessageBox::No, QMessageBox::No) != QMessageBox::Yes) {
 			event->ignore();
 			return;
 		}
 	}
 
-	doDisconnect();
+	while (ui->tab_widget->count() > 0) {
+		closeTab(0);
+	}
 
 	{
 		MySettings settings;
@@ -502,77 +446,6 @@ void MainWindow::closeEvent(QCloseEvent *event)
 	QMainWindow::closeEvent(event);
 }
 
-// FreeRDPコールバック関数の実装
-BOOL MainWindow::rdp_pre_connect(freerdp *rdp)
-{
-	auto ctx = rdp->context;
-	int r = 0;
-	r = PubSub_SubscribeChannelConnected(ctx->pubSub, channelConnected);
-	r = PubSub_SubscribeChannelDisconnected(ctx->pubSub, channelDisconnected);
-	return TRUE;
-}
-
-BOOL MainWindow::onRdpPostConnect(freerdp *rdp)
-{
-	if (m->session.version() == Session::V1) {
-		if (!gdi_init(rdp, m->rdp_pixel_format)) {
-			return FALSE;
-		}
-	} else if (m->session.version() == Session::V2) {
-		m->screen_image = QImage(m->size.width(), m->size.height(), QImage::Format_RGBX8888);
-		if (!gdi_init_ex(rdp, m->rdp_pixel_format, m->screen_image.bytesPerLine(), m->screen_image.bits(), nullptr)) {
-			return FALSE;
-		}
-		if (isDynamicResizingEnabled()) {
-			resizeDynamicLater();
-		}
-	}
-	return TRUE;
-}
-
-BOOL MainWindow::rdp_post_connect(freerdp *instance)
-{
-	if (global->mainwindow) {
-		return global->mainwindow->onRdpPostConnect(instance);
-	}
-	return FALSE;
-}
-
-void MainWindow::rdp_post_disconnect(freerdp *instance)
-{
-	gdi_free(instance);
-}
-
-BOOL MainWindow::rdp_authenticate(freerdp *instance, char **username, char **password, char **domain)
-{
-	(void)instance;
-	(void)username;
-	(void)password;
-	(void)domain;
-	return TRUE;
-}
-
-BOOL MainWindow::rdp_begin_paint(rdpContext *context)
-{
-	(void)context;
-	return TRUE;
-}
-
-BOOL MainWindow::rdp_end_paint(rdpContext *context)
-{
-	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
-	MainWindow *self = ctx->self;
-	auto *gdi = self->rdp_gdi();
-	if (!gdi || !gdi->primary) return FALSE;
-
-	auto invalid = gdi->primary->hdc->hwnd->invalid;
-	QRect rect(invalid->x, invalid->y, invalid->w, invalid->h);
-
-	self->updateScreen2(self->m->screen_image, rect);
-
-	return TRUE;
-}
-
 bool MainWindow::isDynamicResizingEnabled() const
 {
 	return ui->action_view_dynamic_resolution->isChecked();
@@ -580,88 +453,37 @@ bool MainWindow::isDynamicResizingEnabled() const
 
 void MainWindow::on_action_view_dynamic_resolution_toggled(bool arg1)
 {
-	(void)arg1;
-	if (isDynamicResizingEnabled()) {
-		resizeDynamicLater();
+	for (int i = 0; i < ui->tab_widget->count(); i++) {
+		sessionAt(i)->setDynamicResolution(arg1);
 	}
 }
 
-void MainWindow::resizeDynamicLater()
+void MainWindow::on_action_view_fit_to_window_toggled(bool arg1)
 {
-	m->dynamic_resize_counter = isDynamicResizingEnabled() ? 50 : 0;
-}
-
-void MainWindow::resizeDynamic()
-{
-	if (m->interrupted) return;
-	if (!m->connected) return;
-	if (!rdp_instance()) return;
-	if (isDynamicResizingEnabled()) {
-		auto size = newSize();
-		if (size != m->size) {
-			m->size = size;
-			auto *settings = rdp_settings();
-			auto *disp = disp_client_context();
-			if (settings && disp && disp->DisplayControlCaps) {
-				DISPLAY_CONTROL_MONITOR_LAYOUT layout = { 0 };
-				layout.Flags = DISPLAY_CONTROL_MONITOR_PRIMARY;
-				layout.Left = 0;
-				layout.Top = 0;
-				layout.Width = m->size.width();
-				layout.Height = m->size.height();
-				layout.PhysicalWidth = m->size.width();
-				layout.PhysicalHeight = m->size.height();
-				layout.Orientation = freerdp_settings_get_uint16(settings, FreeRDP_DesktopOrientation);
-				layout.DesktopScaleFactor = freerdp_settings_get_uint32(settings, FreeRDP_DesktopScaleFactor);
-				layout.DeviceScaleFactor = freerdp_settings_get_uint32(settings, FreeRDP_DeviceScaleFactor);
-
-				disp->SendMonitorLayout(disp, 1, &layout);
-
-				freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, m->size.width());
-				freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, m->size.height());
-
-				auto gdi = rdp_gdi();
-				if (gdi) {
-					if (m->session.version() == Session::V1) {
-						gdi_resize(gdi, m->size.width(), m->size.height());
-					} else if (m->session.version() == Session::V2) {
-						m->screen_image = QImage(m->size, QImage::Format_RGBX8888);
-						gdi_resize_ex(gdi, m->size.width(), m->size.height(), m->screen_image.bytesPerLine(), m->rdp_pixel_format, m->screen_image.bits(), nullptr);
-					}
-				}
-			}
-		}
+	for (int i = 0; i < ui->tab_widget->count(); i++) {
+		sessionAt(i)->view()->setFitToWindow(arg1);
 	}
-	ui->widget_view->layoutView();
 }
 
-void MainWindow::channelConnected(void *context, const ChannelConnectedEventArgs *e)
+/**
+ * @brief 複数モニターの設定を変える（次の接続から）
+ */
+void MainWindow::on_action_view_multi_monitor_toggled(bool arg1)
 {
-	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
-	} else if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0) {
-		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
-		ctx->disp = reinterpret_cast<DispClientContext *>(e->pInterface);
-		ctx->disp->DisplayControlCaps = onDisplayControlCaps;
-		ctx->disp->custom = reinterpret_cast<void *>(ctx->self);
-	} else {
-		freerdp_client_OnChannelConnectedEventHandler(context, e);
-	}
+	MySettings settings;
+	settings.beginGroup("MainWindow");
+	settings.setValue("MultiMonitor", arg1);
+	settings.endGroup();
 }
 
-void MainWindow::channelDisconnected(void *context, const ChannelDisconnectedEventArgs *e)
+void MainWindow::on_action_view_statistics_overlay_toggled(bool arg1)
 {
-	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
-	} else if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0) {
-		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
-		ctx->disp->custom = nullptr;
-		ctx->disp = nullptr;
-	} else {
-		freerdp_client_OnChannelDisconnectedEventHandler(context, e);
+	for (int i = 0; i < ui->tab_widget->count(); i++) {
+		sessionAt(i)->view()->setOverlayVisible(arg1);
 	}
-}
 
-UINT MainWindow::onDisplayControlCaps(DispClientContext *disp, UINT32 maxNumMonitors, UINT32 maxMonitorAreaFactorA, UINT32 maxMonitorAreaFactorB)
-{
-	return CHANNEL_RC_OK;
+	MySettings settings;
+	settings.beginGroup("Telemetry");
+	settings.setValue("Overlay", arg1);
+	settings.endGroup();
 }
-
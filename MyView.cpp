@@ -1,84 +1,563 @@
 #include "MyView.h"
+#include "ImageScaler.h"
 #include <QApplication>
+#include <QFontMetrics>
+#include <QPaintEngine>
 #include <QPainter>
+#include <QPixmap>
 #include <QWheelEvent>
+#include <cmath>
 #include <freerdp/scancode.h>
 
 MyView::MyView(QWidget *parent)
 	: QWidget { parent }
-	, rdp_instance_(nullptr)
 {
 	setFocusPolicy(Qt::StrongFocus);
 	setMouseTracking(true);
+	pan_timer_.setInterval(16);
+	connect(&pan_timer_, &QTimer::timeout, this, &MyView::onPanTimer);
 }
 
 QPoint MyView::mapToRdp(const QPoint &pos) const
 {
+	if (stretched_ && width() > 0 && height() > 0) {
+		return origin_ + QPoint(pos.x() * image_.width() / width(), pos.y() * image_.height() / height());
+	}
 	// RDPの座標系に変換
-	return QPoint((pos.x() + offset_x_) / scale_, (pos.y() + offset_y_) / scale_);
+	int x = (int)std::floor((pos.x() + offset_x_) / view_scale_);
+	int y = (int)std::floor((pos.y() + offset_y_) / view_scale_);
+	return origin_ + QPoint(x, y);
+}
+
+QRect MyView::mapFromRdp(const QRect &rect) const
+{
+	// RDPの座標系からウィジェットの座標系に変換
+	int x0 = ImageScaler::scaledLength(rect.left(), view_scale_);
+	int y0 = ImageScaler::scaledLength(rect.top(), view_scale_);
+	int x1 = ImageScaler::scaledLength(rect.left() + rect.width(), view_scale_);
+	int y1 = ImageScaler::scaledLength(rect.top() + rect.height(), view_scale_);
+	return QRect(x0 - offset_x_, y0 - offset_y_, x1 - x0, y1 - y0);
+}
+
+/**
+ * @brief 無効領域を受け取って画像を更新する
+ * @param image 新しい画面
+ * @param damage 変化した領域（RDP座標）。空の場合は画面全体を更新する
+ * @param published フレームが公開された時刻（描画し終わるまでの時間を測る）
+ */
+void MyView::setImage(const QImage &image, const QRegion &damage, std::chrono::steady_clock::time_point published)
+{
+	FrameExchange::Frame frame;
+	frame.image = image;
+	frame.damage = damage;
+	frame.published = published;
+	setImage(frame);
 }
 
-void MyView::setImage(const QImage &image, QRect const &rect)
+/**
+ * @brief FrameExchangeから受け取ったフレームで画像を更新する
+ *
+ * フレームに移動（スクロール）があれば、拡大済みのタイルの画素を移し、
+ * 移動で得られない部分だけを拡大し直す。
+ */
+void MyView::setImage(const FrameExchange::Frame &frame)
 {
-	if (rect.isNull()) {
-		image_ = image;
-	} else if (image_.size() != image.size()) {
-		image_ = image.copy();
-	} else {
-		QPainter pr(&image_);
-		pr.drawImage(rect, image, rect);
+	QImage const &image = frame.image;
+	QRegion const &damage = frame.damage;
+	auto published = frame.published;
+
+	bool waiting = pending_present_.time_since_epoch().count() != 0; // 前のフレームの描画待ち
+	if (published.time_since_epoch().count() != 0 && !waiting) {
+		pending_present_ = published;
+	}
+
+	QRect bounds(QPoint(0, 0), image.size());
+	bool full = damage.isEmpty() || image_.size() != image.size() || image_.format() != image.format();
+	QRegion region = damage.isEmpty() ? QRegion(bounds) : damage.intersected(bounds);
+
+	quint64 damaged = 0;
+	for (QRect const &r : region) {
+		damaged += (quint64)r.width() * r.height();
+	}
+	stats_.frames++;
+	stats_.damaged_pixels += damaged;
+
+	image_ = image;
+
+	if (full) {
+		if (view_scale_ == 1) {
+			stats_.presented_pixels += (quint64)bounds.width() * bounds.height();
+		}
+		tiles_.clear();
+		layoutView();
+		return;
+	}
+
+	// 拡大表示の場合、再描画した画素数はタイルを作り直した時に数える
+	if (view_scale_ == 1) {
+		stats_.presented_pixels += damaged;
+	}
+	QRegion redraw = region;
+	if (!frame.moves.empty() && view_scale_ != 1 && !stretched_) {
+		bool moved = true;
+		for (FrameExchange::Move const &move : frame.moves) {
+			moved = tiles_.move(move.rect, move.delta) && moved;
+		}
+		if (moved) {
+			QRegion kept = region.intersected(frame.moved);
+			redraw = region.subtracted(kept);
+			for (QRect const &r : kept) {
+				stats_.moved_pixels += (quint64)r.width() * r.height();
+			}
+		}
+	}
+	tiles_.invalidate(redraw);
+	if (stretched_) {
+		update();
+		return;
+	}
+	bool integer = view_scale_ == std::floor(view_scale_);
+	bool visible = false;
+	for (QRect const &r : region) {
+		// 補間する場合は隣の画素も影響するので、1画素広げる
+		QRect u = mapFromRdp(integer ? r : r.adjusted(-1, -1, 1, 1));
+		visible = visible || u.intersects(rect());
+		update(u);
+	}
+
+	// 変化がすべて表示範囲の外ならpaintEventは来ないので、ここで表示し終わったことにする
+	if (!visible && !waiting) {
+		pending_present_ = {};
+		emit presented();
 	}
-	image_scaled_ = {};
-	layoutView();
+}
+
+/**
+ * @brief ウィジェットに表示されている範囲（RDP座標）
+ */
+QRect MyView::visibleRect() const
+{
+	int x = (int)std::floor(offset_x_ / view_scale_);
+	int y = (int)std::floor(offset_y_ / view_scale_);
+	int w = (int)std::ceil(width() / view_scale_) + 2;
+	int h = (int)std::ceil(height() / view_scale_) + 2;
+	return QRect(x, y, w, h).intersected(image_.rect());
 }
 
 void MyView::layoutView()
 {
-	int w = image_.width() * scale_;
-	int h = image_.height() * scale_;
-	int x = (w > width()) ? 0 : (width() - w) / 2;
-	int y = (h > height()) ? (height() - h) : (height() - h) / 2;
-	offset_x_ = -x;
-	offset_y_ = -y;
+	if (stretched_) {
+		// 引き伸ばしている間は倍率を変えない（タイルを作り直さない）
+		update();
+		return;
+	}
+	view_scale_ = scale_;
+	if (fit_to_window_ && image_.width() > 0 && image_.height() > 0) {
+		view_scale_ = std::min((double)width() / image_.width(), (double)height() / image_.height());
+		if (view_scale_ <= 0) {
+			view_scale_ = 1;
+		}
+	}
+	double old_scale = tiles_.scale();
+	tiles_.setScale(view_scale_);
+
+	// 倍率が変わったら表示範囲の中心を保つ
+	if (old_scale != view_scale_ && old_scale > 0) {
+		double k = view_scale_ / old_scale;
+		scroll_.setX((int)std::lround((scroll_.x() + width() / 2.0) * k - width() / 2.0));
+		scroll_.setY((int)std::lround((scroll_.y() + height() / 2.0) * k - height() / 2.0));
+	}
+
+	// ウィジェットより大きい方向は表示範囲の位置に従い、小さい方向は中央に置く
+	int w = ImageScaler::scaledLength(image_.width(), view_scale_);
+	int h = ImageScaler::scaledLength(image_.height(), view_scale_);
+	offset_x_ = (w > width()) ? std::clamp(scroll_.x(), 0, w - width()) : -((width() - w) / 2);
+	offset_y_ = (h > height()) ? std::clamp(scroll_.y(), 0, h - height()) : -((height() - h) / 2);
+	scroll_ = QPoint(std::max(offset_x_, 0), std::max(offset_y_, 0));
+	if (!isPannable()) {
+		pan_timer_.stop();
+	}
+	applyPointer();
 	update();
 }
 
-void MyView::setRdpInstance(freerdp *instance)
+/**
+ * @brief 画像がウィジェットより大きく、表示範囲を動かせるか
+ */
+bool MyView::isPannable() const
+{
+	if (stretched_ || image_.isNull()) return false;
+	int w = ImageScaler::scaledLength(image_.width(), view_scale_);
+	int h = ImageScaler::scaledLength(image_.height(), view_scale_);
+	return w > width() || h > height();
+}
+
+/**
+ * @brief 表示範囲を動かす
+ *
+ * 表示済みの画素はウィジェットの中で移し、新しく見えるようになった部分だけを描く。
+ * 表示範囲の外の変化はタイルを無効にしてあるので、見えた時に拡大し直される。
+ * @param delta 動かす量（ウィジェットの画素）
+ * @return 動いた場合はtrue（端に達していれば動かない）
+ */
+bool MyView::panBy(const QPoint &delta)
+{
+	if (!isPannable()) return false;
+	int w = ImageScaler::scaledLength(image_.width(), view_scale_);
+	int h = ImageScaler::scaledLength(image_.height(), view_scale_);
+	int x = (w > width()) ? std::clamp(offset_x_ + delta.x(), 0, w - width()) : offset_x_;
+	int y = (h > height()) ? std::clamp(offset_y_ + delta.y(), 0, h - height()) : offset_y_;
+	int dx = offset_x_ - x;
+	int dy = offset_y_ - y;
+	if (dx == 0 && dy == 0) return false;
+
+	offset_x_ = x;
+	offset_y_ = y;
+	scroll_ = QPoint(std::max(offset_x_, 0), std::max(offset_y_, 0));
+	scroll(dx, dy);
+	if (overlay_visible_) {
+		// オーバーレイは画像と一緒に動かさない
+		QRect r = overlayRect();
+		update(r);
+		update(r.translated(dx, dy));
+	}
+	return true;
+}
+
+/**
+ * @brief マウスの位置が画面の端に近ければ、表示範囲を動かし始める
+ */
+void MyView::updateEdgePan(const QPoint &pos)
+{
+	QPoint v;
+	if (isPannable()) {
+		auto speed = [](int depth){
+			depth = std::clamp(depth, 1, EDGE_PAN_MARGIN);
+			return (EDGE_PAN_SPEED * depth + EDGE_PAN_MARGIN - 1) / EDGE_PAN_MARGIN;
+		};
+		int w = ImageScaler::scaledLength(image_.width(), view_scale_);
+		int h = ImageScaler::scaledLength(image_.height(), view_scale_);
+		if (w > width()) {
+			if (pos.x() < EDGE_PAN_MARGIN) {
+				v.setX(-speed(EDGE_PAN_MARGIN - pos.x()));
+			} else if (pos.x() >= width() - EDGE_PAN_MARGIN) {
+				v.setX(speed(pos.x() - (width() - EDGE_PAN_MARGIN) + 1));
+			}
+		}
+		if (h > height()) {
+			if (pos.y() < EDGE_PAN_MARGIN) {
+				v.setY(-speed(EDGE_PAN_MARGIN - pos.y()));
+			} else if (pos.y() >= height() - EDGE_PAN_MARGIN) {
+				v.setY(speed(pos.y() - (height() - EDGE_PAN_MARGIN) + 1));
+			}
+		}
+	}
+	pan_velocity_ = v;
+	if (v.isNull()) {
+		pan_timer_.stop();
+	} else if (!pan_timer_.isActive()) {
+		pan_timer_.start();
+	}
+}
+
+void MyView::onPanTimer()
+{
+	if (!panBy(pan_velocity_)) {
+		pan_timer_.stop();
+		return;
+	}
+	// マウスは止まっていても、その下のRDP座標は変わったのでサーバーに知らせる
+	if (input_queue_) {
+		QPoint pos = mapToRdp(mapFromGlobal(QCursor::pos()));
+		input_queue_->push(InputQueue::Event::mouse(PTR_FLAGS_MOVE, pos.x(), pos.y()));
+	}
+}
+
+/**
+ * @brief サーバーのポインタをカーソルとして表示する
+ *
+ * 画像はidごとに1回だけ受け取り、表示の倍率に合わせたQCursorにして保持する。
+ * ポインタの移動はローカルで描くので、サーバーとの往復も画面の更新もない。
+ * @param id Sessionがポインタごとに付けた番号
+ * @param image ポインタの画像（idが既知なら使わない）
+ * @param hotspot ポインタの画像の中の指す位置
+ */
+void MyView::setPointer(quint64 id, const QImage &image, const QPoint &hotspot)
+{
+	auto it = pointers_.find(id);
+	if (it == pointers_.end()) {
+		Pointer p;
+		p.image = image;
+		p.hotspot = hotspot;
+		pointers_.insert(id, p);
+	}
+	pointer_ = id;
+	pointer_hidden_ = false;
+	applyPointer();
+}
+
+void MyView::freePointer(quint64 id)
+{
+	pointers_.remove(id);
+	if (pointer_ == id) {
+		pointer_ = 0;
+	}
+}
+
+void MyView::setPointerHidden()
+{
+	pointer_hidden_ = true;
+	applyPointer();
+}
+
+void MyView::setPointerDefault()
+{
+	pointer_ = 0;
+	pointer_hidden_ = false;
+	applyPointer();
+}
+
+/**
+ * @brief 保持しているポインタを捨て、ローカルの既定のカーソルに戻す（切断時）
+ */
+void MyView::clearPointers()
+{
+	pointers_.clear();
+	pointer_ = 0;
+	pointer_hidden_ = false;
+	unsetCursor();
+}
+
+/**
+ * @brief 現在のポインタを、表示の倍率に合わせたカーソルにして設定する
+ */
+void MyView::applyPointer()
+{
+	if (pointer_hidden_) {
+		setCursor(Qt::BlankCursor);
+		return;
+	}
+	auto it = pointers_.find(pointer_);
+	if (it == pointers_.end() || it->image.isNull()) {
+		unsetCursor();
+		return;
+	}
+	Pointer &p = *it;
+	if (p.scale != view_scale_) {
+		// 高DPIでは物理ピクセルの大きさで作る
+		qreal dpr = devicePixelRatioF();
+		double scale = view_scale_ * dpr;
+		QImage image = p.image;
+		if (scale != 1) {
+			int w = std::max(1, (int)std::lround(image.width() * scale));
+			int h = std::max(1, (int)std::lround(image.height() * scale));
+			image = image.scaled(w, h, Qt::IgnoreAspectRatio, scale == std::floor(scale) ? Qt::FastTransformation : Qt::SmoothTransformation);
+		}
+		QPixmap pixmap = QPixmap::fromImage(image);
+		pixmap.setDevicePixelRatio(dpr);
+		p.cursor = QCursor(pixmap, (int)(p.hotspot.x() * view_scale_), (int)(p.hotspot.y() * view_scale_));
+		p.scale = view_scale_;
+	}
+	setCursor(p.cursor);
+}
+
+/**
+ * @brief サーバーが動かしたポインタの位置にローカルのカーソルを移す
+ * @param pos RDP座標
+ * @return 位置がこのビューに表示されていて、カーソルを移した場合はtrue
+ */
+bool MyView::warpPointer(const QPoint &pos)
+{
+	if (!isActiveWindow() || !underMouse()) return false;
+	QRect r = mapFromRdp(QRect(pos - origin_, QSize(1, 1)));
+	if (!rect().contains(r.topLeft())) return false;
+	QCursor::setPos(mapToGlobal(r.topLeft()));
+	return true;
+}
+
+/**
+ * @brief 描画時間を記録する先を設定する
+ */
+void MyView::setTelemetry(Telemetry *telemetry)
+{
+	telemetry_ = telemetry;
+}
+
+bool MyView::isOverlayVisible() const
 {
-	rdp_instance_ = instance;
+	return overlay_visible_;
 }
 
-int MyView::scale() const
+/**
+ * @brief 統計のオーバーレイを表示するかどうか
+ */
+void MyView::setOverlayVisible(bool visible)
+{
+	overlay_visible_ = visible;
+	update(overlayRect());
+}
+
+void MyView::setOverlayText(const QStringList &lines)
+{
+	QRect old = overlayRect();
+	overlay_ = lines;
+	if (overlay_visible_) {
+		update(old.united(overlayRect()));
+	}
+}
+
+/**
+ * @brief オーバーレイを表示する範囲（ウィジェット座標）
+ */
+QRect MyView::overlayRect() const
+{
+	if (overlay_.isEmpty()) return {};
+	QFontMetrics fm(font());
+	int w = 0;
+	for (QString const &line : overlay_) {
+		w = std::max(w, fm.horizontalAdvance(line));
+	}
+	return QRect(8, 8, w + 16, fm.height() * overlay_.size() + 12);
+}
+
+void MyView::drawOverlay(QPainter *pr)
+{
+	QRect r = overlayRect();
+	if (r.isEmpty()) return;
+	QFontMetrics fm(font());
+	pr->fillRect(r, QColor(0, 0, 0, 160));
+	pr->setPen(Qt::white);
+	int y = r.top() + 6 + fm.ascent();
+	for (QString const &line : overlay_) {
+		pr->drawText(r.left() + 8, y, line);
+		y += fm.height();
+	}
+}
+
+/**
+ * @brief 入力イベントの送り先を設定する（切断時はnullptr）
+ */
+void MyView::setInputQueue(InputQueue *queue)
+{
+	input_queue_ = queue;
+}
+
+double MyView::scale() const
 {
 	return scale_;
 }
 
-void MyView::setScale(int scale)
+MyView::PresentStats const &MyView::presentStats() const
+{
+	return stats_;
+}
+
+void MyView::setScale(double scale)
 {
 	scale_ = scale;
-	image_scaled_ = {};
-	update();
+	layoutView();
+}
+
+bool MyView::isFitToWindow() const
+{
+	return fit_to_window_;
+}
+
+void MyView::setFitToWindow(bool fit)
+{
+	fit_to_window_ = fit;
+	layoutView();
+}
+
+bool MyView::isStretched() const
+{
+	return stretched_;
+}
+
+/**
+ * @brief 最後のフレームをウィジェット全体に引き伸ばして表示するかを設定する
+ *
+ * 動的解像度の変更中、新しい大きさのフレームが届くまでの間に使う。
+ */
+void MyView::setStretched(bool stretched)
+{
+	if (stretched_ == stretched) return;
+	stretched_ = stretched;
+	layoutView();
+}
+
+QPoint MyView::origin() const
+{
+	return origin_;
+}
+
+/**
+ * @brief 表示している画面のデスクトップ上の位置を設定する
+ *
+ * 複数モニターでモニター1つ分を表示する場合に、入力の座標をデスクトップの座標に直すために使う。
+ */
+void MyView::setOrigin(const QPoint &origin)
+{
+	origin_ = origin;
+}
+
+/**
+ * @brief 描画先（バッキングストア）の形式。一度も描画していなければFormat_Invalid
+ */
+QImage::Format MyView::nativeFormat() const
+{
+	return native_format_;
+}
+
+/**
+ * @brief 描画先の形式に対して、変換せずに描画できるフレームバッファの形式
+ *
+ * 不透明な画面なので、乗算済みアルファの描画先にもRGB32をそのままコピーできる。
+ * 描画先の形式が分からない場合や32ビットでない場合は、多くの環境の既定であるRGB32にする。
+ */
+QImage::Format MyView::frameFormat(QImage::Format native)
+{
+	switch (native) {
+	case QImage::Format_RGBX8888:
+	case QImage::Format_RGBA8888:
+	case QImage::Format_RGBA8888_Premultiplied:
+		return QImage::Format_RGBX8888;
+	default:
+		return QImage::Format_RGB32;
+	}
+}
+
+/**
+ * @brief 画像をそのまま（形式を変換せずに）描画先に書けるか
+ */
+static bool isDirectFormat(QImage::Format source, QImage::Format target)
+{
+	if (source == target) return true;
+	return source == QImage::Format_RGB32 && target == QImage::Format_ARGB32_Premultiplied;
 }
 
 void MyView::paintEvent(QPaintEvent *event)
 {
-	Q_UNUSED(event);
+	auto start = std::chrono::steady_clock::now();
 	QPainter painter(this);
+
+	// 描画先の形式を調べる（ラスターエンジンではバッキングストアのQImageに描く）
+	QPaintEngine *engine = painter.paintEngine();
+	if (engine && engine->type() == QPaintEngine::Raster && engine->paintDevice() && engine->paintDevice()->devType() == QInternal::Image) {
+		native_format_ = static_cast<QImage *>(engine->paintDevice())->format();
+	}
+
 	painter.fillRect(rect(), QColor(192, 192, 192));
 	if (!image_.isNull()) {
-		if (image_.size() != image_scaled_.size()) {
-			if (scale_ == 1) {
-				image_scaled_ = image_;
-			} else {
-				int w = image_.width() * scale_;
-				int h = image_.height() * scale_;
-				image_scaled_ = image_.scaled(w, h, Qt::KeepAspectRatio, Qt::FastTransformation);
-			}
-		}
 		int x = -offset_x_;
 		int y = -offset_y_;
-		int w = image_scaled_.width();
-		int h = image_scaled_.height();
+		int w = ImageScaler::scaledLength(image_.width(), view_scale_);
+		int h = ImageScaler::scaledLength(image_.height(), view_scale_);
+		if (native_format_ != QImage::Format_Invalid && !isDirectFormat(image_.format(), native_format_)) {
+			// QPainterが描画のたびに画素を変換している
+			QRect drawn = stretched_ ? rect() : event->rect().intersected(QRect(x, y, w, h));
+			stats_.converted_pixels += (quint64)drawn.width() * drawn.height();
+		}
 		{
 			painter.fillRect(x - 1, y - 1, w + 2, h + 2, Qt::black);
 			painter.fillRect(x - 2, y - 2, w + 2, 1, QColor(128, 128, 128));
@@ -86,19 +565,43 @@ void MyView::paintEvent(QPaintEvent *event)
 			painter.fillRect(x, y + h + 1, w + 2, 1, QColor(255, 255, 255));
 			painter.fillRect(x + w + 1, y, 1, h + 2, QColor(255, 255, 255));
 		}
-		painter.drawImage(x, y, image_scaled_, Qt::KeepAspectRatio, Qt::FastTransformation);
+		if (stretched_) {
+			painter.drawImage(rect(), image_);
+		} else if (view_scale_ == 1) {
+			QRect r = event->rect().translated(offset_x_, offset_y_).intersected(image_.rect());
+			painter.drawImage(r.topLeft() - QPoint(offset_x_, offset_y_), image_, r);
+		} else {
+			stats_.presented_pixels += tiles_.draw(&painter, image_, QPoint(x, y), event->rect());
+			tiles_.evictOutside(visibleRect());
+		}
+	}
+	if (overlay_visible_) {
+		drawOverlay(&painter);
 	}
+
+	if (telemetry_) {
+		auto end = std::chrono::steady_clock::now();
+		auto us = [](std::chrono::steady_clock::duration d){
+			return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+		};
+		telemetry_->record(Telemetry::Paint, us(end - start));
+		if (pending_present_.time_since_epoch().count() != 0) {
+			telemetry_->record(Telemetry::Present, us(end - pending_present_));
+		}
+	}
+	pending_present_ = {};
+	emit presented();
 }
 
 void MyView::mousePressEvent(QMouseEvent *event)
 {
-	if (rdp_instance_ && rdp_instance_->context) {
+	if (input_queue_) {
 		UINT16 flags = PTR_FLAGS_DOWN;
 		UINT16 button = qtToRdpMouseButton(event->button());
 		if (button != 0) {
 			flags |= button;
 			QPoint pos = mapToRdp(event);
-			freerdp_input_send_mouse_event(rdp_instance_->context->input, flags, pos.x(), pos.y());
+			input_queue_->push(InputQueue::Event::mouse(flags, pos.x(), pos.y()));
 		}
 	}
 	setFocus();
@@ -106,26 +609,33 @@ void MyView::mousePressEvent(QMouseEvent *event)
 
 void MyView::mouseReleaseEvent(QMouseEvent *event)
 {
-	if (rdp_instance_ && rdp_instance_->context) {
+	if (input_queue_) {
 		UINT16 button = qtToRdpMouseButton(event->button());
 		if (button != 0) {
 			QPoint pos = mapToRdp(event);
-			freerdp_input_send_mouse_event(rdp_instance_->context->input, button, pos.x(), pos.y());
+			input_queue_->push(InputQueue::Event::mouse(button, pos.x(), pos.y()));
 		}
 	}
 }
 
 void MyView::mouseMoveEvent(QMouseEvent *event)
 {
-	if (rdp_instance_ && rdp_instance_->context) {
+	if (input_queue_) {
 		QPoint pos = mapToRdp(event);
-		freerdp_input_send_mouse_event(rdp_instance_->context->input, PTR_FLAGS_MOVE, pos.x(), pos.y());
+		input_queue_->push(InputQueue::Event::mouse(PTR_FLAGS_MOVE, pos.x(), pos.y()));
 	}
+	updateEdgePan(event->pos());
+}
+
+void MyView::leaveEvent(QEvent *event)
+{
+	pan_timer_.stop();
+	QWidget::leaveEvent(event);
 }
 
 void MyView::wheelEvent(QWheelEvent *event)
 {
-	if (rdp_instance_ && rdp_instance_->context) {
+	if (input_queue_) {
 		auto delta = event->angleDelta();
 		QPoint pos = mapToRdp(event);
 		if (delta.y() != 0) {
@@ -136,7 +646,7 @@ void MyView::wheelEvent(QWheelEvent *event)
 			if (delta.y() < 0) {
 				flags |= PTR_FLAGS_WHEEL_NEGATIVE;
 			}
-			freerdp_input_send_mouse_event(rdp_instance_->context->input, (UINT16)flags, pos.x(), pos.y());
+			input_queue_->push(InputQueue::Event::mouse((UINT16)flags, pos.x(), pos.y()));
 		} else if (delta.x() != 0) {
 			// 水平スクロール（ホイールチルト）
 			int flags = std::abs(delta.x());
@@ -145,7 +655,7 @@ void MyView::wheelEvent(QWheelEvent *event)
 			if (delta.x() < 0) {
 				flags |= PTR_FLAGS_WHEEL_NEGATIVE;  // 左スクロール
 			}
-			freerdp_input_send_mouse_event(rdp_instance_->context->input, (UINT16)flags, pos.x(), pos.y());
+			input_queue_->push(InputQueue::Event::mouse((UINT16)flags, pos.x(), pos.y()));
 		}
 	}
 	
@@ -154,10 +664,10 @@ void MyView::wheelEvent(QWheelEvent *event)
 
 bool MyView::onKeyEvent(QKeyEvent *event)
 {
-	if (rdp_instance_ && rdp_instance_->context && rdp_instance_->context->input) {
+	if (input_queue_) {
 		auto vc = GetVirtualKeyCodeFromKeycode(event->nativeScanCode(), WINPR_KEYCODE_TYPE_XKB);
 		auto code = GetVirtualScanCodeFromVirtualKeyCode(vc, WINPR_KBD_TYPE_IBM_ENHANCED);
-		freerdp_input_send_keyboard_event_ex(rdp_instance_->context->input, event->type() == QEvent::KeyPress, event->isAutoRepeat(), code);
+		input_queue_->push(InputQueue::Event::keyboard(event->type() == QEvent::KeyPress, event->isAutoRepeat(), code));
 		return true;
 	}
 	return false;
@@ -1,22 +1,70 @@
 #ifndef MYVIEW_H
 #define MYVIEW_H
 
+#include <QCursor>
+#include <QHash>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QTimer>
 #include <QWidget>
+#include "FrameExchange.h"
+#include "TileCache.h"
+#include "InputQueue.h"
+#include "Telemetry.h"
 #include <freerdp/freerdp.h>
 #include <freerdp/input.h>
+#include <chrono>
 #include <type_traits>
 
 class MyView : public QWidget {
 	Q_OBJECT
+public:
+	struct PresentStats {
+		quint64 frames = 0;
+		quint64 damaged_pixels = 0;   // 受信した無効領域の画素数
+		quint64 presented_pixels = 0; // 実際に再スケール・再描画した画素数
+		quint64 moved_pixels = 0; // 無効領域のうち、スクロールとしてキャッシュの画素を移して済ませた画素数
+		quint64 converted_pixels = 0; // 描画先と形式が異なるため、描画時に形式を変換した画素数
+	};
 private:
 	QImage image_;
-	QImage image_scaled_;
-	int scale_ = 1;
-	int offset_x_ = 0;
+	TileCache tiles_;
+	double scale_ = 1;
+	double view_scale_ = 1; // 実際の表示倍率（ウィンドウに合わせる場合はscale_と異なる）
+	bool fit_to_window_ = false;
+	bool stretched_ = false; // 解像度の変更待ちの間、最後のフレームをウィジェット全体に引き伸ばして表示する
+	int offset_x_ = 0; // 表示範囲の左上（拡大後の画像の座標）。画像が小さい方向は中央に置くので負になる
 	int offset_y_ = 0;
-	freerdp *rdp_instance_;
+	QPoint scroll_; // 画像がウィジェットより大きい場合の表示範囲の位置（拡大後の画像の座標）
+
+	// 画面の端にマウスを置くと、その方向に表示範囲を動かす
+	static constexpr int EDGE_PAN_MARGIN = 24; // 端からこの距離に入ると動かし始める
+	static constexpr int EDGE_PAN_SPEED = 32; // 1回に動かす最大の画素数
+	QTimer pan_timer_;
+	QPoint pan_velocity_;
+	void updateEdgePan(const QPoint &pos);
+	void onPanTimer();
+	QPoint origin_; // 表示している画面のデスクトップ上の位置（複数モニターの場合）
+	InputQueue *input_queue_ = nullptr;
+	PresentStats stats_;
+	Telemetry *telemetry_ = nullptr;
+	QImage::Format native_format_ = QImage::Format_Invalid; // 描画先（バッキングストア）の形式。描画するまで分からない
+	std::chrono::steady_clock::time_point pending_present_; // 描画待ちのフレームを公開した時刻
+	bool overlay_visible_ = false;
+	QStringList overlay_;
+	QRect overlay_rect_;
+
+	// サーバーから受け取ったマウスポインタ
+	struct Pointer {
+		QImage image;
+		QPoint hotspot;
+		QCursor cursor; // view_scale_に合わせて作ったカーソル
+		double scale = 0; // cursorを作った時の倍率
+	};
+	QHash<quint64, Pointer> pointers_;
+	quint64 pointer_ = 0; // 表示中のポインタ（0ならローカルの既定のカーソル）
+	bool pointer_hidden_ = false;
+	void applyPointer();
 
 protected:
 	void paintEvent(QPaintEvent *event) override;
@@ -24,19 +72,50 @@ protected:
 	void mouseReleaseEvent(QMouseEvent *event) override;
 	void mouseMoveEvent(QMouseEvent *event) override;
 	void wheelEvent(QWheelEvent *event) override;  // マウスホイールイベント追加
+	void leaveEvent(QEvent *event) override;
 
 public:
 	explicit MyView(QWidget *parent = nullptr);
-	void setImage(const QImage &image, const QRect &rect);
-	void setRdpInstance(freerdp *instance);
+	void setImage(const QImage &image, const QRegion &damage, std::chrono::steady_clock::time_point published = {});
+	void setImage(const FrameExchange::Frame &frame);
+	void setInputQueue(InputQueue *queue);
+	void setTelemetry(Telemetry *telemetry);
+	bool isOverlayVisible() const;
+	void setOverlayVisible(bool visible);
+	void setOverlayText(const QStringList &lines);
 
-	int scale() const;
-	void setScale(int scale);
+	double scale() const;
+	void setScale(double scale);
+	bool isFitToWindow() const;
+	void setFitToWindow(bool fit);
+	bool isStretched() const;
+	void setStretched(bool stretched);
+	QPoint origin() const;
+	void setOrigin(const QPoint &origin);
 
 	void layoutView();
+	bool isPannable() const;
+	bool panBy(const QPoint &delta);
+
+	void setPointer(quint64 id, const QImage &image, const QPoint &hotspot);
+	void freePointer(quint64 id);
+	void setPointerHidden();
+	void setPointerDefault();
+	void clearPointers();
+	bool warpPointer(const QPoint &pos);
+
+	PresentStats const &presentStats() const;
+	QImage::Format nativeFormat() const;
+	static QImage::Format frameFormat(QImage::Format native);
+	QRect visibleRect() const;
 	
 	bool onKeyEvent(QKeyEvent *event);
+signals:
+	void presented(); // setImage()で受け取った画面を描画し終わった
 private:
+	QRect mapFromRdp(const QRect &rect) const;
+	QRect overlayRect() const;
+	void drawOverlay(QPainter *pr);
 	QPoint mapToRdp(const QPoint &pos) const;
 	template <typename T> QPoint mapToRdp(T const *e) const
 	{
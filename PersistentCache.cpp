@@ -0,0 +1,96 @@
+#include "PersistentCache.h"
+#include "Global.h"
+#include "MySettings.h"
+#include "joinpath.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+/**
+ * @brief ファイル名に使えない文字を置き換える
+ */
+QString sanitize(QString const &s)
+{
+	QString r;
+	for (QChar c : s) {
+		if (c.isLetterOrNumber() || c == '.' || c == '-') {
+			r += c;
+		} else {
+			r += '_';
+		}
+	}
+	return r;
+}
+
+} // namespace
+
+/**
+ * @brief キャッシュのディレクトリ（設定ディレクトリの下）
+ */
+QString PersistentCache::directory()
+{
+	return global->app_config_dir / "cache";
+}
+
+/**
+ * @brief ホストとユーザーに対応するキャッシュファイルのパス
+ */
+QString PersistentCache::filePath(QString const &hostname, QString const &username)
+{
+	QString name = sanitize(hostname.toLower()) + "-" + sanitize(username) + ".bmc";
+	return directory() / name;
+}
+
+/**
+ * @brief ディレクトリ全体の上限（バイト）。BitmapCache/MaxSize（MB）
+ */
+qint64 PersistentCache::maxSize()
+{
+	MySettings settings;
+	settings.beginGroup("BitmapCache");
+	qint64 mb = settings.value("MaxSize", 256).toLongLong();
+	settings.endGroup();
+	return std::max<qint64>(mb, 0) * 1024 * 1024;
+}
+
+/**
+ * @brief ファイルの更新日時を現在時刻にする（LRUの順序に使う）
+ */
+void PersistentCache::touch(QString const &path)
+{
+	QFile file(path);
+	if (!file.exists()) return;
+	if (file.open(QFile::ReadWrite)) {
+		file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+	}
+}
+
+/**
+ * @brief 上限を超えた分を、更新日時の古いファイルから消す
+ * @param keep 消さないファイル（接続中のキャッシュ）
+ */
+void PersistentCache::trim(QString const &keep)
+{
+	QDir dir(directory());
+	if (!dir.exists()) return;
+
+	QFileInfoList files = dir.entryInfoList({ "*.bmc" }, QDir::Files, QDir::Time); // 新しい順
+	qint64 limit = maxSize();
+	qint64 total = 0;
+	for (QFileInfo const &info : files) {
+		total += info.size();
+	}
+	while (total > limit && !files.isEmpty()) {
+		QFileInfo info = files.takeLast();
+		if (info.absoluteFilePath() == QFileInfo(keep).absoluteFilePath()) continue;
+		if (QFile::remove(info.absoluteFilePath())) {
+			total -= info.size();
+		} else {
+			qWarning() << "failed to remove" << info.absoluteFilePath();
+		}
+	}
+}
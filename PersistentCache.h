@@ -0,0 +1,23 @@
+#ifndef PERSISTENTCACHE_H
+#define PERSISTENTCACHE_H
+
+#include <QString>
+
+/**
+ * @brief 永続ビットマップキャッシュのファイルの管理
+ *
+ * ファイルの中身はFreeRDPが読み書きする（BitmapCachePersistFile）。
+ * 接続先のホストとユーザーごとに1つのファイルを置き、ディレクトリ全体の
+ * 大きさが上限を超えたら、最後に使ってから最も時間の経ったファイルから消す。
+ */
+namespace PersistentCache {
+
+QString directory();
+QString filePath(QString const &hostname, QString const &username);
+qint64 maxSize();
+void touch(QString const &path);
+void trim(QString const &keep = {});
+
+} // namespace PersistentCache
+
+#endif // PERSISTENTCACHE_H
@@ -0,0 +1,135 @@
+#include "QualityController.h"
+#include <QDebug>
+#include <algorithm>
+
+char const *QualityController::levelName(Level level)
+{
+	switch (level) {
+	case Low:    return "low";
+	case Medium: return "medium";
+	case High:   return "high";
+	default:     return "";
+	}
+}
+
+/**
+ * @brief 段階ごとの設定
+ *
+ * どの段階でもH.264を使えるようにし（サーバーが文字等にはProgressive/ClearCodecを選ぶ）、
+ * 帯域が狭くなるにつれてAVC420とフレームレートの制限で帯域を減らす。
+ * lossless_highなら、highではH.264を使わずに画質を優先する（設定Quality/LosslessHigh）。
+ * 色深度は常に32。WindowsのサーバーはクライアントがRDPGFXを32bppで要求した時だけ
+ * グラフィックスパイプラインを使い、それ以下ではビットマップの更新に戻るため
+ * （H.264、フレームの確認応答、SurfaceToSurfaceの移動が使えなくなる）。
+ * 色深度を下げるのは、グラフィックスパイプラインを使わない段階を加える場合だけにする。
+ */
+QualityController::Profile QualityController::profile(Level level, bool lossless_high)
+{
+	Profile p;
+	switch (level) {
+	case Low:
+		p.h264 = true;
+		p.avc444 = false;
+		p.fps = 15;
+		break;
+	case Medium:
+		p.h264 = true;
+		p.avc444 = true;
+		p.fps = 30;
+		break;
+	case High:
+		p.h264 = !lossless_high;
+		p.avc444 = !lossless_high;
+		p.fps = 60;
+		break;
+	}
+	return p;
+}
+
+void QualityController::reset(QString const &host, Level level, Level min, Level max)
+{
+	host_ = host;
+	min_ = min;
+	max_ = std::max(min, max);
+	level_ = std::clamp(level, min_, max_);
+	bad_ = 0;
+	good_ = 0;
+	reason_.clear();
+}
+
+/**
+ * @brief 計測値に見合う段階。上げる方向の閾値は下げる方向より厳しい
+ */
+QualityController::Level QualityController::target(Sample const &s, QString *reason) const
+{
+	bool rtt = s.rtt > 0;
+	bool bw = s.bandwidth > 0;
+
+	// クライアントが追いつけない時は、ネットワークに関係なく下げる
+	if (s.decode_load > 0.8 || s.dropped > 10) {
+		*reason = QString("client backlog (decode %1%, dropped %2/s)").arg(s.decode_load * 100, 0, 'f', 0).arg(s.dropped);
+		return Level(std::max(int(Low), int(level_) - 1));
+	}
+	if ((rtt && s.rtt > 150) || (bw && s.bandwidth < 5000)) {
+		*reason = QString("poor network (rtt %1 ms, bandwidth %2 kbit/s)").arg(s.rtt).arg(s.bandwidth);
+		return Low;
+	}
+	if ((rtt && s.rtt > 50) || (bw && s.bandwidth < 20000)) {
+		*reason = QString("limited network (rtt %1 ms, bandwidth %2 kbit/s)").arg(s.rtt).arg(s.bandwidth);
+		return level_ < Medium ? level_ : Medium;
+	}
+
+	// 上げるのは十分に余裕がある時だけ
+	bool idle = s.decode_load < 0.5 && s.dropped == 0;
+	if (idle && rtt && bw && s.rtt < 30 && s.bandwidth > 30000) {
+		*reason = QString("good network (rtt %1 ms, bandwidth %2 kbit/s)").arg(s.rtt).arg(s.bandwidth);
+		return High;
+	}
+	if (idle && level_ == Low && rtt && bw && s.rtt < 100 && s.bandwidth > 8000) {
+		*reason = QString("recovered network (rtt %1 ms, bandwidth %2 kbit/s)").arg(s.rtt).arg(s.bandwidth);
+		return Medium;
+	}
+	return level_;
+}
+
+/**
+ * @brief 計測値を1つ加える
+ * @return 段階を変えた場合はtrue
+ */
+bool QualityController::update(Sample const &sample)
+{
+	QString reason;
+	Level t = std::clamp(target(sample, &reason), min_, max_);
+	if (t < level_) {
+		good_ = 0;
+		if (++bad_ < DEGRADE_SAMPLES) return false;
+	} else if (t > level_) {
+		bad_ = 0;
+		if (++good_ < UPGRADE_SAMPLES) return false;
+	} else {
+		bad_ = 0;
+		good_ = 0;
+		return false;
+	}
+
+	qInfo().noquote() << QString("quality %1: %2 -> %3, %4")
+						 .arg(host_).arg(levelName(level_)).arg(levelName(t)).arg(reason);
+	level_ = t;
+	reason_ = reason;
+	bad_ = 0;
+	good_ = 0;
+	return true;
+}
+
+QualityController::Level QualityController::level() const
+{
+	return level_;
+}
+
+/**
+ * @brief 最後に段階を変えた理由
+ */
+QString QualityController::reason() const
+{
+	return reason_;
+}
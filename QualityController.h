@@ -0,0 +1,57 @@
+#ifndef QUALITYCONTROLLER_H
+#define QUALITYCONTROLLER_H
+
+#include <QString>
+
+/**
+ * @brief ネットワーク自動検出の結果とクライアントの処理の遅れから画質を決める
+ *
+ * 約1秒ごとにupdate()に計測値を渡す。下げる時は悪い計測値が続いた時だけ、
+ * 上げる時はさらに長く良い計測値が続いた時だけ段階を変える（ヒステリシス）。
+ * 段階を変えた時は理由をログに出す。
+ *
+ * フレームレートは接続中に変えられる。コーデックと色深度は接続時に決まるので、
+ * 最後に決めた段階を次の接続に使う。
+ */
+class QualityController {
+public:
+	enum Level {
+		Low,
+		Medium,
+		High,
+	};
+	struct Profile {
+		bool h264 = true; // H.264を使うか（falseならProgressive等）
+		bool avc444 = true; // AVC444（色差を間引かない）を使うか
+		int color_depth = 32; // RDPGFXは32でしか使われないので、グラフィックスパイプラインを使う段階では32
+		int fps = 60; // 画面を公開し、RDPGFXのフレームに確認応答する最大のフレームレート
+	};
+	struct Sample {
+		quint32 rtt = 0; // ミリ秒（0なら未計測）
+		quint32 bandwidth = 0; // kbit/s（0なら未計測）
+		double decode_load = 0; // RDPスレッドがデコードに使った時間の割合
+		quint64 dropped = 0; // 表示されずに捨てられたフレーム数（1秒あたり）
+	};
+	static constexpr int DEGRADE_SAMPLES = 3;
+	static constexpr int UPGRADE_SAMPLES = 10;
+private:
+	Level level_ = High;
+	Level min_ = Low;
+	Level max_ = High;
+	int bad_ = 0;
+	int good_ = 0;
+	QString host_;
+	QString reason_;
+
+	Level target(Sample const &s, QString *reason) const;
+public:
+	static char const *levelName(Level level);
+	static Profile profile(Level level, bool lossless_high = false);
+
+	void reset(QString const &host, Level level, Level min, Level max);
+	bool update(Sample const &sample);
+	Level level() const;
+	QString reason() const;
+};
+
+#endif // QUALITYCONTROLLER_H
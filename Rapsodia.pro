@@ -1,5 +1,5 @@
 TARGET = Rapsodia
-QT += core gui widgets
+QT += core gui widgets network
 CONFIG += c++17
 
 INCLUDEPATH += /usr/include/freerdp3
@@ -9,19 +9,62 @@ LIBS += -lfreerdp3 -lfreerdp-client3 -lwinpr3
 
 SOURCES += \
     ConnectionDialog.cpp \
+    DamageFilter.cpp \
+    ExportBenchmark.cpp \
+    ExportClient.cpp \
+    FrameExchange.cpp \
+    FramebufferExport.cpp \
+    FramebufferPool.cpp \
     Global.cpp \
+    Histogram.cpp \
+    ImageScaler.cpp \
+    InputQueue.cpp \
+    LoadGenerator.cpp \
     MySettings.cpp \
     MyView.cpp \
+    PersistentCache.cpp \
+    QualityController.cpp \
+    RecordingPlayer.cpp \
+    RecordingReader.cpp \
+    ReplayBenchmark.cpp \
+    ScaleBenchmark.cpp \
+    ScreenRecorder.cpp \
+    Session.cpp \
+    SessionWidget.cpp \
+    Telemetry.cpp \
+    TileCache.cpp \
     joinpath.cpp \
     main.cpp \
     MainWindow.cpp
 
 HEADERS += \
     ConnectionDialog.h \
+    DamageFilter.h \
+    ExportBenchmark.h \
+    ExportClient.h \
+    FrameExchange.h \
+    FramebufferExport.h \
+    FramebufferPool.h \
     Global.h \
+    Histogram.h \
+    ImageScaler.h \
+    InputQueue.h \
+    LoadGenerator.h \
     MainWindow.h \
     MySettings.h \
     MyView.h \
+    PersistentCache.h \
+    QualityController.h \
+    RecordingFormat.h \
+    RecordingPlayer.h \
+    RecordingReader.h \
+    ReplayBenchmark.h \
+    ScaleBenchmark.h \
+    ScreenRecorder.h \
+    Session.h \
+    SessionWidget.h \
+    Telemetry.h \
+    TileCache.h \
     joinpath.h
 
 FORMS += \
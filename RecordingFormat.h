@@ -0,0 +1,59 @@
+#ifndef RECORDINGFORMAT_H
+#define RECORDINGFORMAT_H
+
+#include <QtGlobal>
+
+/**
+ * @brief 画面録画ファイルの形式
+ *
+ * ファイルヘッダの後にフレームを追記していく。各フレームは変化したタイルだけを
+ * 持ち、キーフレームは画面全体のタイルを持つ。タイルの画素はqCompress()で
+ * 圧縮する。閉じる時にキーフレームの索引と末尾情報を書く。末尾情報がない
+ * （録画中に終了した）ファイルは、フレームを先頭から辿って索引を作り直す。
+ * 数値はすべてリトルエンディアン。
+ */
+namespace RecordingFormat {
+
+constexpr char MAGIC[8] = { 'R', 'A', 'P', 'S', 'R', 'E', 'C', '1' };
+constexpr quint32 FRAME_MAGIC = 0x454d5246; // "FRME"
+constexpr quint32 INDEX_MAGIC = 0x58444952; // "RIDX"
+constexpr quint32 KEYFRAME = 1;
+
+struct FrameHeader {
+	quint32 magic = FRAME_MAGIC;
+	quint32 flags = 0;
+	qint64 timestamp = 0; // 録画開始からのミリ秒
+	quint32 width = 0;
+	quint32 height = 0;
+	quint32 format = 0; // QImage::Format
+	quint32 tile_count = 0;
+	quint64 size = 0; // このヘッダに続くタイルの合計バイト数
+};
+
+struct TileHeader {
+	quint16 x = 0;
+	quint16 y = 0;
+	quint16 width = 0;
+	quint16 height = 0;
+	quint32 size = 0; // 圧縮した画素のバイト数
+};
+
+struct IndexEntry {
+	qint64 timestamp = 0;
+	quint64 offset = 0; // キーフレームのFrameHeaderの位置
+};
+
+struct IndexTrailer {
+	quint64 index_offset = 0;
+	quint32 count = 0;
+	quint32 magic = INDEX_MAGIC;
+};
+
+static_assert(sizeof(FrameHeader) == 40, "unexpected padding");
+static_assert(sizeof(TileHeader) == 12, "unexpected padding");
+static_assert(sizeof(IndexEntry) == 16, "unexpected padding");
+static_assert(sizeof(IndexTrailer) == 16, "unexpected padding");
+
+} // namespace RecordingFormat
+
+#endif // RECORDINGFORMAT_H
@@ -0,0 +1,48 @@
+#include "RecordingPlayer.h"
+#include "MyView.h"
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QSlider>
+#include <QTime>
+#include <QVBoxLayout>
+
+RecordingPlayer::RecordingPlayer(QWidget *parent)
+	: QWidget(parent)
+{
+	view_ = new MyView(this);
+	view_->setFitToWindow(true);
+	slider_ = new QSlider(Qt::Horizontal, this);
+	slider_->setSingleStep(100);
+	slider_->setPageStep(10000);
+	label_ = new QLabel(this);
+
+	auto *bar = new QHBoxLayout;
+	bar->addWidget(slider_, 1);
+	bar->addWidget(label_);
+	auto *layout = new QVBoxLayout(this);
+	layout->addWidget(view_, 1);
+	layout->addLayout(bar);
+
+	connect(slider_, &QSlider::valueChanged, this, &RecordingPlayer::seek);
+	resize(1280, 800);
+}
+
+bool RecordingPlayer::open(const QString &path)
+{
+	if (!reader_.open(path)) return false;
+
+	setWindowTitle(path + " - Rapsodia");
+	slider_->setRange(0, (int)reader_.duration());
+	slider_->setValue(0);
+	seek(0);
+	return true;
+}
+
+void RecordingPlayer::seek(int timestamp)
+{
+	QImage image = reader_.frame(timestamp);
+	if (!image.isNull()) {
+		view_->setImage(image, QRegion{});
+	}
+	label_->setText(QTime(0, 0).addMSecs(timestamp).toString("hh:mm:ss.zzz"));
+}
@@ -0,0 +1,28 @@
+#ifndef RECORDINGPLAYER_H
+#define RECORDINGPLAYER_H
+
+#include "RecordingReader.h"
+#include <QWidget>
+
+class MyView;
+class QLabel;
+class QSlider;
+
+/**
+ * @brief 画面録画ファイルを再生するウィンドウ
+ */
+class RecordingPlayer : public QWidget {
+	Q_OBJECT
+private:
+	RecordingReader reader_;
+	MyView *view_ = nullptr;
+	QSlider *slider_ = nullptr;
+	QLabel *label_ = nullptr;
+private slots:
+	void seek(int timestamp);
+public:
+	explicit RecordingPlayer(QWidget *parent = nullptr);
+	bool open(const QString &path);
+};
+
+#endif // RECORDINGPLAYER_H
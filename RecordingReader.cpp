@@ -0,0 +1,166 @@
+#include "RecordingReader.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace RecordingFormat;
+
+RecordingReader::~RecordingReader()
+{
+	close();
+}
+
+bool RecordingReader::open(const QString &path)
+{
+	close();
+
+	file_.setFileName(path);
+	if (!file_.open(QFile::ReadOnly)) {
+		return false;
+	}
+	size_ = file_.size();
+	if (size_ >= sizeof(MAGIC)) {
+		data_ = file_.map(0, size_);
+	}
+	if (!data_ || memcmp(data_, MAGIC, sizeof(MAGIC)) != 0 || !buildIndex()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void RecordingReader::close()
+{
+	if (data_) {
+		file_.unmap(const_cast<uchar *>(data_));
+		data_ = nullptr;
+	}
+	file_.close();
+	size_ = 0;
+	end_ = 0;
+	index_.clear();
+	duration_ = 0;
+}
+
+bool RecordingReader::isOpen() const
+{
+	return data_ != nullptr;
+}
+
+int RecordingReader::keyframeCount() const
+{
+	return (int)index_.size();
+}
+
+/**
+ * @brief 最後のフレームの時刻（ミリ秒）
+ */
+qint64 RecordingReader::duration() const
+{
+	return duration_;
+}
+
+/**
+ * @brief offsetにあるフレームのヘッダを読む。壊れている・途中までしかない場合はfalse
+ */
+bool RecordingReader::readFrame(quint64 offset, FrameHeader *out) const
+{
+	if (offset + sizeof(FrameHeader) > end_) return false;
+	memcpy(out, data_ + offset, sizeof(FrameHeader));
+	if (out->magic != FRAME_MAGIC) return false;
+	return out->size <= end_ - offset - sizeof(FrameHeader);
+}
+
+bool RecordingReader::buildIndex()
+{
+	end_ = size_;
+	index_.clear();
+
+	// 末尾に索引があればそれを使う
+	if (size_ >= sizeof(MAGIC) + sizeof(IndexTrailer)) {
+		IndexTrailer trailer;
+		memcpy(&trailer, data_ + size_ - sizeof(trailer), sizeof(trailer));
+		quint64 bytes = (quint64)trailer.count * sizeof(IndexEntry);
+		if (trailer.magic == INDEX_MAGIC && trailer.index_offset >= sizeof(MAGIC) && trailer.index_offset + bytes + sizeof(trailer) == size_) {
+			end_ = trailer.index_offset;
+			index_.resize(trailer.count);
+			memcpy(index_.data(), data_ + trailer.index_offset, bytes);
+		}
+	}
+
+	// 索引がなければフレームを先頭から辿って作る。索引があっても
+	// 最後のキーフレーム以降は辿って、最後のフレームの時刻を得る
+	quint64 offset = index_.empty() ? sizeof(MAGIC) : index_.back().offset;
+	bool rebuild = index_.empty();
+	FrameHeader frame;
+	while (readFrame(offset, &frame)) {
+		if (rebuild && (frame.flags & KEYFRAME)) {
+			IndexEntry entry;
+			entry.timestamp = frame.timestamp;
+			entry.offset = offset;
+			index_.push_back(entry);
+		}
+		duration_ = frame.timestamp;
+		offset += sizeof(FrameHeader) + frame.size;
+	}
+	if (rebuild) {
+		end_ = offset; // 途中で切れたフレームは使わない
+	}
+	return !index_.empty();
+}
+
+void RecordingReader::apply(quint64 offset, FrameHeader const &frame, QImage *image) const
+{
+	int const bpp = image->depth() / 8;
+	uchar const *p = data_ + offset + sizeof(FrameHeader);
+	uchar const *end = p + frame.size;
+	for (quint32 i = 0; i < frame.tile_count; i++) {
+		TileHeader tile;
+		if (p + sizeof(tile) > end) break;
+		memcpy(&tile, p, sizeof(tile));
+		p += sizeof(tile);
+		if (tile.size > (quint64)(end - p)) break;
+
+		QRect r(tile.x, tile.y, tile.width, tile.height);
+		QByteArray pixels = qUncompress(p, tile.size);
+		p += tile.size;
+		if (!image->rect().contains(r) || pixels.size() != (qsizetype)r.width() * r.height() * bpp) continue;
+
+		int n = r.width() * bpp;
+		char const *src = pixels.constData();
+		for (int y = r.top(); y <= r.bottom(); y++) {
+			memcpy(image->scanLine(y) + r.left() * bpp, src, n);
+			src += n;
+		}
+	}
+}
+
+/**
+ * @brief 時刻timestamp（ミリ秒）に表示されていた画面を作る
+ */
+QImage RecordingReader::frame(qint64 timestamp) const
+{
+	if (index_.empty()) return {};
+
+	auto it = std::upper_bound(index_.begin(), index_.end(), timestamp, [](qint64 t, IndexEntry const &e){
+		return t < e.timestamp;
+	});
+	if (it != index_.begin()) {
+		--it;
+	}
+
+	QImage image;
+	quint64 offset = it->offset;
+	FrameHeader frame;
+	while (readFrame(offset, &frame)) {
+		if (frame.timestamp > timestamp && !image.isNull()) break;
+		if (frame.flags & KEYFRAME) {
+			image = QImage(frame.width, frame.height, (QImage::Format)frame.format);
+			image.fill(Qt::black);
+		}
+		if (!image.isNull()) {
+			apply(offset, frame, &image);
+		}
+		offset += sizeof(FrameHeader) + frame.size;
+	}
+	return image;
+}
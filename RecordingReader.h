@@ -0,0 +1,37 @@
+#ifndef RECORDINGREADER_H
+#define RECORDINGREADER_H
+
+#include "RecordingFormat.h"
+#include <QFile>
+#include <QImage>
+#include <vector>
+
+/**
+ * @brief 画面録画ファイルを読む
+ *
+ * ファイルをメモリにマップし、指定した時刻の直前のキーフレームから
+ * フレームを順に適用して画面を作る。処理量はキーフレーム以降のタイル数に比例する。
+ */
+class RecordingReader {
+private:
+	QFile file_;
+	uchar const *data_ = nullptr;
+	quint64 size_ = 0;
+	quint64 end_ = 0; // フレームが続く範囲の終わり（索引の位置）
+	std::vector<RecordingFormat::IndexEntry> index_;
+	qint64 duration_ = 0;
+
+	bool readFrame(quint64 offset, RecordingFormat::FrameHeader *out) const;
+	bool buildIndex();
+	void apply(quint64 offset, RecordingFormat::FrameHeader const &frame, QImage *image) const;
+public:
+	~RecordingReader();
+	bool open(const QString &path);
+	void close();
+	bool isOpen() const;
+	int keyframeCount() const;
+	qint64 duration() const;
+	QImage frame(qint64 timestamp) const;
+};
+
+#endif // RECORDINGREADER_H
@@ -0,0 +1,140 @@
+#include "ReplayBenchmark.h"
+#include "Histogram.h"
+#include "ImageScaler.h"
+#include "Session.h"
+#include "TileCache.h"
+#include <QElapsedTimer>
+#include <QPainter>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+/**
+ * @brief MyViewと同じ方法で、変化した領域を拡大して描画先に合成する
+ * @return スクロールとしてタイルの画素を移して済ませた画素数
+ */
+quint64 present(QImage *target, TileCache *tiles, const FrameExchange::Frame &frame, double scale)
+{
+	QImage const &source = frame.image;
+	QRegion const &damage = frame.damage;
+	quint64 moved_pixels = 0;
+	QSize size(ImageScaler::scaledLength(source.width(), scale), ImageScaler::scaledLength(source.height(), scale));
+	bool full = damage.isEmpty() || target->size() != size || target->format() != source.format();
+	if (full) {
+		*target = QImage(size, source.format());
+		tiles->clear();
+	} else {
+		QRegion redraw = damage;
+		if (!frame.moves.empty() && scale != 1) {
+			bool moved = true;
+			for (FrameExchange::Move const &move : frame.moves) {
+				moved = tiles->move(move.rect, move.delta) && moved;
+			}
+			if (moved) {
+				redraw = damage.subtracted(frame.moved);
+				for (QRect const &r : damage.intersected(frame.moved)) {
+					moved_pixels += (quint64)r.width() * r.height();
+				}
+			}
+		}
+		tiles->invalidate(redraw);
+	}
+	QRegion region = full ? QRegion(source.rect()) : damage;
+
+	QPainter pr(target);
+	bool integer = scale == std::floor(scale);
+	for (QRect r : region) {
+		if (scale == 1) {
+			pr.drawImage(r.topLeft(), source, r);
+			continue;
+		}
+		if (!integer) {
+			r.adjust(-1, -1, 1, 1);
+		}
+		int x0 = ImageScaler::scaledLength(r.left(), scale);
+		int y0 = ImageScaler::scaledLength(r.top(), scale);
+		int x1 = ImageScaler::scaledLength(r.left() + r.width(), scale);
+		int y1 = ImageScaler::scaledLength(r.top() + r.height(), scale);
+		QRect clip = QRect(x0, y0, x1 - x0, y1 - y0).intersected(target->rect());
+		pr.setClipRect(clip);
+		tiles->draw(&pr, source, QPoint(0, 0), clip);
+	}
+	return moved_pixels;
+}
+
+double ms(quint64 us)
+{
+	return us / 1000.0;
+}
+
+} // namespace
+
+/**
+ * @brief 記録したセッションを再生し、デコードと表示の速度を測る
+ *
+ * Rapsodia --replay <file> [--scale <n>] で実行する。サーバーには接続せず、
+ * --record で記録したPDUを受信した順にデコードし、MyViewと同じ方法で
+ * 拡大・合成する。1フレームの時間は、PDUの処理を始めてから合成し終わるまで。
+ */
+int runReplayBenchmark(const QString &path, double scale)
+{
+	Session session;
+	Session::Options options;
+	options.hostname = "replay";
+	options.replay_file = path;
+
+	if (!session.connectToHost(options)) {
+		fprintf(stderr, "failed to replay %s\n", path.toUtf8().constData());
+		return 1;
+	}
+	if (session.isReplayPaced()) {
+		// 記録時の間隔で再生されるので、時間とスループットはデコードの速さを表さない
+		fprintf(stderr, "warning: FreeRDP cannot replay without the recorded delays; time and throughput follow the recording\n");
+	}
+
+	TileCache tiles;
+	tiles.setScale(scale);
+	QImage target;
+	Histogram latency;
+	quint64 presented = 0;
+	quint64 moved_pixels = 0;
+
+	std::clock_t cpu = std::clock();
+	QElapsedTimer elapsed;
+	elapsed.start();
+	while (1) {
+		QElapsedTimer t;
+		t.start();
+		if (!session.processEvents()) break;
+
+		FrameExchange::Frame frame;
+		if (!session.acquireFrame(&frame)) continue;
+		moved_pixels += present(&target, &tiles, frame, scale);
+		session.framePresented(frame.sequence);
+		latency.record(t.nsecsElapsed() / 1000);
+		presented++;
+	}
+	double seconds = elapsed.nsecsElapsed() / 1e9;
+	double cpu_seconds = (double)(std::clock() - cpu) / CLOCKS_PER_SEC;
+	quint64 received_bytes = session.receivedBytes();
+	auto frames = session.frameStats();
+	auto const &gfx = session.gfxStats();
+	Histogram const &decode = session.telemetry().histogram(Telemetry::Decode);
+
+	session.disconnectFromHost();
+
+	if (seconds <= 0) {
+		seconds = 1e-9;
+	}
+	printf("file        %s\n", path.toUtf8().constData());
+	printf("scale       %g (%s)\n", scale, ImageScaler::isaName(ImageScaler::isa()));
+	printf("frames      %llu presented, %llu published, %llu dropped\n", (unsigned long long)presented, (unsigned long long)frames.published, (unsigned long long)frames.dropped);
+	printf("time        %.3f s wall, %.3f s cpu\n", seconds, cpu_seconds);
+	printf("throughput  %.1f frames/s, %.2f MB/s%s\n", presented / seconds, received_bytes / 1048576.0 / seconds, session.isReplayPaced() ? " (paced by the recording)" : "");
+	printf("latency     p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", ms(latency.percentile(50)), ms(latency.percentile(99)), ms(latency.max()));
+	printf("scrolled    %.1f Mpx moved instead of rescaled\n", moved_pixels / 1000000.0);
+	printf("gfx decode  %llu frames, p50 %.2f ms, p99 %.2f ms\n", (unsigned long long)gfx.frames.load(), ms(decode.percentile(50)), ms(decode.percentile(99)));
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef REPLAYBENCHMARK_H
+#define REPLAYBENCHMARK_H
+
+#include <QString>
+
+int runReplayBenchmark(const QString &path, double scale);
+
+#endif // REPLAYBENCHMARK_H
@@ -0,0 +1,151 @@
+#include "ScaleBenchmark.h"
+#include "ImageScaler.h"
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <cstdio>
+
+namespace {
+
+struct Case {
+	char const *name;
+	double scale;
+	Qt::TransformationMode qt_mode;
+};
+
+struct Format {
+	char const *name;
+	QImage::Format format;
+};
+
+QImage makeSource(int width, int height)
+{
+	QImage image(width, height, QImage::Format_RGBX8888);
+	QRandomGenerator rand(1);
+	for (int y = 0; y < height; y++) {
+		auto *p = reinterpret_cast<quint32 *>(image.scanLine(y));
+		for (int x = 0; x < width; x++) {
+			p[x] = rand.generate() | 0xff000000;
+		}
+	}
+	return image;
+}
+
+template <typename F> double measure(F fn)
+{
+	fn(); // ウォームアップ
+	int count = 0;
+	QElapsedTimer t;
+	t.start();
+	do {
+		fn();
+		count++;
+	} while (t.elapsed() < 500 || count < 3);
+	return (double)t.nsecsElapsed() / count / 1000000.0;
+}
+
+/**
+ * @brief フレームバッファの形式と描画先の形式の組み合わせごとに、QPainter::drawImage()の時間を測る
+ *
+ * 形式が異なると描画のたびに画素を変換するので、同じ形式の場合より遅くなる。
+ */
+void drawBenchmark(QSize const &size)
+{
+	static const Format formats[] = {
+		{ "RGBX8888", QImage::Format_RGBX8888 },
+		{ "RGB32", QImage::Format_RGB32 },
+		{ "ARGB32PM", QImage::Format_ARGB32_Premultiplied },
+	};
+
+	printf("\n%-10s %-9s", "draw", "source");
+	for (Format const &target : formats) {
+		printf(" %10s", target.name);
+	}
+	printf("   [ms/frame, target format]\n");
+
+	QImage base = makeSource(size.width(), size.height());
+	QString label = QString("%1x%2").arg(size.width()).arg(size.height());
+	for (Format const &source : formats) {
+		QImage image = base.convertToFormat(source.format);
+		printf("%-10s %-9s", label.toUtf8().constData(), source.name);
+		for (Format const &target : formats) {
+			QImage surface(size, target.format);
+			double ms = measure([&](){
+				QPainter painter(&surface);
+				painter.drawImage(0, 0, image);
+			});
+			printf(" %10.2f", ms);
+		}
+		printf("\n");
+	}
+}
+
+} // namespace
+
+/**
+ * @brief 拡大縮小カーネルとQImage::scaled()の速度を比較する
+ *
+ * Rapsodia --bench-scale で実行する。1フレーム全体を拡大縮小するのに掛かる
+ * 時間（ミリ秒）と、形式の組み合わせごとの描画の時間を表示する。
+ */
+int runScaleBenchmark()
+{
+	static const QSize sizes[] = {
+		{ 1920, 1080 },
+		{ 2560, 1440 },
+		{ 3840, 2160 },
+	};
+	static const Case cases[] = {
+		{ "2x", 2.0, Qt::FastTransformation },
+		{ "3x", 3.0, Qt::FastTransformation },
+		{ "1.5x", 1.5, Qt::SmoothTransformation },
+		{ "fit 0.5x", 0.5, Qt::SmoothTransformation },
+	};
+	ImageScaler::Isa const native = ImageScaler::isa();
+
+	printf("%-10s %-9s %10s", "source", "scale", "Qt");
+	for (int i = 0; i <= (int)native; i++) {
+		printf(" %10s", ImageScaler::isaName((ImageScaler::Isa)i));
+	}
+	printf("   [ms/frame]\n");
+
+	for (QSize const &size : sizes) {
+		QImage source = makeSource(size.width(), size.height());
+		ImageScaler::Source src;
+		src.bits = source.constBits();
+		src.width = source.width();
+		src.height = source.height();
+		src.stride = source.bytesPerLine();
+
+		for (Case const &c : cases) {
+			int w = ImageScaler::scaledLength(size.width(), c.scale);
+			int h = ImageScaler::scaledLength(size.height(), c.scale);
+			QImage scaled(w, h, source.format());
+			ImageScaler::Target dst;
+			dst.bits = scaled.bits();
+			dst.stride = scaled.bytesPerLine();
+			dst.width = w;
+			dst.height = h;
+
+			QString label = QString("%1x%2").arg(size.width()).arg(size.height());
+			double qt = measure([&](){
+				QImage tmp = source.scaled(w, h, Qt::IgnoreAspectRatio, c.qt_mode);
+				Q_UNUSED(tmp);
+			});
+			printf("%-10s %-9s %10.2f", label.toUtf8().constData(), c.name, qt);
+			for (int i = 0; i <= (int)native; i++) {
+				ImageScaler::setIsa((ImageScaler::Isa)i);
+				double ms = measure([&](){
+					ImageScaler::scale(src, dst, c.scale);
+				});
+				printf(" %10.2f", ms);
+			}
+			printf("\n");
+			ImageScaler::setIsa(native);
+		}
+	}
+
+	drawBenchmark(sizes[0]);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef SCALEBENCHMARK_H
+#define SCALEBENCHMARK_H
+
+int runScaleBenchmark();
+
+#endif // SCALEBENCHMARK_H
@@ -0,0 +1,247 @@
+#include "ScreenRecorder.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace RecordingFormat;
+
+ScreenRecorder::~ScreenRecorder()
+{
+	close();
+}
+
+/**
+ * @brief 録画を開始する（RDPスレッドが止まっている時に呼ぶこと）
+ */
+bool ScreenRecorder::open(const QString &path)
+{
+	close();
+
+	file_.setFileName(path);
+	if (!file_.open(QFile::WriteOnly | QFile::Truncate)) {
+		return false;
+	}
+	file_.write(MAGIC, sizeof(MAGIC));
+	index_.clear();
+
+	frames_ = 0;
+	keyframes_ = 0;
+	tiles_ = 0;
+	dropped_ = 0;
+	bytes_ = sizeof(MAGIC);
+	submit_ns_ = 0;
+
+	size_ = {};
+	last_keyframe_ = 0;
+	need_keyframe_ = true;
+	pending_ = {};
+	queued_bytes_ = 0;
+	closing_ = false;
+	clock_.start();
+	thread_ = std::thread([this](){
+		run();
+	});
+	return true;
+}
+
+/**
+ * @brief キューに残ったフレームを書き終えてから閉じる
+ */
+void ScreenRecorder::close()
+{
+	if (!thread_.joinable()) return;
+	{
+		std::lock_guard lock(mutex_);
+		closing_ = true;
+	}
+	cond_.notify_one();
+	thread_.join();
+}
+
+bool ScreenRecorder::isOpen() const
+{
+	return thread_.joinable();
+}
+
+/**
+ * @brief RDPスレッド：変化したタイルの画素をコピーしてエンコーダに渡す
+ */
+void ScreenRecorder::submit(const QImage &image, const QRegion &damage)
+{
+	if (!thread_.joinable()) return;
+
+	QElapsedTimer t;
+	t.start();
+
+	bool full;
+	bool behind;
+	{
+		std::lock_guard lock(mutex_);
+		full = queue_.size() >= MAX_QUEUE || queued_bytes_ >= MAX_QUEUE_BYTES;
+		behind = !queue_.empty();
+	}
+	if (full) {
+		// 変化は次のフレームに含める（キーフレームにするとエンコーダがさらに遅れる）
+		dropped_++;
+		pending_ += damage;
+		submit_ns_ += t.nsecsElapsed();
+		return;
+	}
+
+	Job job;
+	job.timestamp = clock_.elapsed();
+	// 定期的なキーフレームは、エンコーダが追いついている時に作る
+	job.key = need_keyframe_ || image.size() != size_ || (!behind && job.timestamp - last_keyframe_ >= KEYFRAME_INTERVAL);
+	job.size = image.size();
+	job.format = image.format();
+
+	QRect bounds = image.rect();
+	auto tileRect = [&](int tx, int ty){
+		return QRect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE).intersected(bounds);
+	};
+	if (job.key) {
+		for (int ty = 0; ty * TILE_SIZE < bounds.height(); ty++) {
+			for (int tx = 0; tx * TILE_SIZE < bounds.width(); tx++) {
+				job.rects.push_back(tileRect(tx, ty));
+			}
+		}
+	} else {
+		std::vector<quint32> keys;
+		for (QRect const &r : damage + pending_) {
+			QRect c = r.intersected(bounds);
+			if (c.isEmpty()) continue;
+			for (int ty = c.top() / TILE_SIZE; ty <= c.bottom() / TILE_SIZE; ty++) {
+				for (int tx = c.left() / TILE_SIZE; tx <= c.right() / TILE_SIZE; tx++) {
+					keys.push_back(((quint32)ty << 16) | (quint32)tx);
+				}
+			}
+		}
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		for (quint32 key : keys) {
+			job.rects.push_back(tileRect(key & 0xffff, key >> 16));
+		}
+	}
+	pending_ = {};
+	if (job.rects.empty()) {
+		submit_ns_ += t.nsecsElapsed();
+		return;
+	}
+
+	int const bpp = image.depth() / 8;
+	qsizetype total = 0;
+	for (QRect const &r : job.rects) {
+		total += (qsizetype)r.width() * r.height() * bpp;
+	}
+	job.pixels.resize(total);
+	char *dst = job.pixels.data();
+	for (QRect const &r : job.rects) {
+		int n = r.width() * bpp;
+		for (int y = r.top(); y <= r.bottom(); y++) {
+			memcpy(dst, image.constScanLine(y) + r.left() * bpp, n);
+			dst += n;
+		}
+	}
+
+	if (job.key) {
+		size_ = image.size();
+		last_keyframe_ = job.timestamp;
+		need_keyframe_ = false;
+	}
+	{
+		std::lock_guard lock(mutex_);
+		queued_bytes_ += job.pixels.size();
+		queue_.push_back(std::move(job));
+	}
+	cond_.notify_one();
+	submit_ns_ += t.nsecsElapsed();
+}
+
+/**
+ * @brief エンコーダのスレッド
+ */
+void ScreenRecorder::run()
+{
+	while (1) {
+		Job job;
+		{
+			std::unique_lock lock(mutex_);
+			cond_.wait(lock, [&](){
+				return closing_ || !queue_.empty();
+			});
+			if (queue_.empty()) break; // 閉じる要求があり、すべて書き終えた
+			job = std::move(queue_.front());
+			queue_.pop_front();
+			queued_bytes_ -= job.pixels.size();
+		}
+		write(job);
+	}
+	writeIndex();
+	file_.close();
+}
+
+void ScreenRecorder::write(Job const &job)
+{
+	int const bpp = QImage::toPixelFormat(job.format).bitsPerPixel() / 8;
+
+	std::vector<QByteArray> compressed;
+	compressed.reserve(job.rects.size());
+	FrameHeader frame;
+	frame.flags = job.key ? KEYFRAME : 0;
+	frame.timestamp = job.timestamp;
+	frame.width = job.size.width();
+	frame.height = job.size.height();
+	frame.format = job.format;
+	frame.tile_count = (quint32)job.rects.size();
+	uchar const *src = reinterpret_cast<uchar const *>(job.pixels.constData());
+	for (QRect const &r : job.rects) {
+		qsizetype n = (qsizetype)r.width() * r.height() * bpp;
+		compressed.push_back(qCompress(src, n, 1));
+		src += n;
+		frame.size += sizeof(TileHeader) + compressed.back().size();
+	}
+
+	if (job.key) {
+		IndexEntry entry;
+		entry.timestamp = job.timestamp;
+		entry.offset = file_.pos();
+		index_.push_back(entry);
+		keyframes_++;
+	}
+	file_.write(reinterpret_cast<char const *>(&frame), sizeof(frame));
+	for (size_t i = 0; i < job.rects.size(); i++) {
+		QRect const &r = job.rects[i];
+		TileHeader tile;
+		tile.x = (quint16)r.x();
+		tile.y = (quint16)r.y();
+		tile.width = (quint16)r.width();
+		tile.height = (quint16)r.height();
+		tile.size = (quint32)compressed[i].size();
+		file_.write(reinterpret_cast<char const *>(&tile), sizeof(tile));
+		file_.write(compressed[i]);
+	}
+	frames_++;
+	tiles_ += job.rects.size();
+	bytes_ += sizeof(frame) + frame.size;
+}
+
+void ScreenRecorder::writeIndex()
+{
+	IndexTrailer trailer;
+	trailer.index_offset = file_.pos();
+	trailer.count = (quint32)index_.size();
+	file_.write(reinterpret_cast<char const *>(index_.data()), index_.size() * sizeof(IndexEntry));
+	file_.write(reinterpret_cast<char const *>(&trailer), sizeof(trailer));
+	bytes_ += index_.size() * sizeof(IndexEntry) + sizeof(trailer);
+}
+
+ScreenRecorder::Stats ScreenRecorder::stats() const
+{
+	Stats s;
+	s.frames = frames_.load();
+	s.keyframes = keyframes_.load();
+	s.tiles = tiles_.load();
+	s.dropped = dropped_.load();
+	s.bytes = bytes_.load();
+	s.submit_ns = submit_ns_.load();
+	return s;
+}
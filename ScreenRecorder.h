@@ -0,0 +1,88 @@
+#ifndef SCREENRECORDER_H
+#define SCREENRECORDER_H
+
+#include "RecordingFormat.h"
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QRegion>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 画面の変化をタイル単位で可逆圧縮して録画する
+ *
+ * submit()はRDPスレッドから呼び、変化したタイルの画素をコピーしてキューに
+ * 積むだけにする。圧縮と書き込みはエンコーダのスレッドで行う。キューが
+ * 一杯の場合（フレーム数かバイト数が上限を超えた）はフレームを捨てて数え、
+ * その変化は次のフレームに含める。エンコーダが遅れている間は、定期的な
+ * キーフレームを遅らせる。
+ */
+class ScreenRecorder {
+public:
+	static constexpr int TILE_SIZE = 64;
+	static constexpr size_t MAX_QUEUE = 16;
+	static constexpr qsizetype MAX_QUEUE_BYTES = 64 * 1024 * 1024; // キューに積んだ画素の合計の上限
+	static constexpr qint64 KEYFRAME_INTERVAL = 10000; // ミリ秒
+
+	struct Stats {
+		quint64 frames = 0;
+		quint64 keyframes = 0;
+		quint64 tiles = 0;
+		quint64 dropped = 0;
+		quint64 bytes = 0; // ファイルに書いたバイト数
+		quint64 submit_ns = 0; // submit()に掛かった時間の合計（RDPスレッドの負荷）
+	};
+private:
+	struct Job {
+		qint64 timestamp = 0;
+		bool key = false;
+		QSize size;
+		QImage::Format format = QImage::Format_Invalid;
+		std::vector<QRect> rects;
+		QByteArray pixels; // rectsの画素を順に詰めたもの
+	};
+
+	// 書き込み側（RDPスレッド）専用
+	QElapsedTimer clock_;
+	QSize size_;
+	qint64 last_keyframe_ = 0;
+	bool need_keyframe_ = true;
+	QRegion pending_; // 捨てたフレームの変化（次のフレームに含める）
+
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<Job> queue_;
+	qsizetype queued_bytes_ = 0; // queue_の画素の合計
+	bool closing_ = false;
+	std::thread thread_;
+
+	// エンコーダのスレッド専用
+	QFile file_;
+	std::vector<RecordingFormat::IndexEntry> index_;
+
+	std::atomic<quint64> frames_ { 0 };
+	std::atomic<quint64> keyframes_ { 0 };
+	std::atomic<quint64> tiles_ { 0 };
+	std::atomic<quint64> dropped_ { 0 };
+	std::atomic<quint64> bytes_ { 0 };
+	std::atomic<quint64> submit_ns_ { 0 };
+
+	void run();
+	void write(Job const &job);
+	void writeIndex();
+public:
+	~ScreenRecorder();
+	bool open(const QString &path);
+	void close();
+	bool isOpen() const;
+	void submit(const QImage &image, const QRegion &damage);
+	Stats stats() const;
+};
+
+#endif // SCREENRECORDER_H
@@ -0,0 +1,1905 @@
+#include "Session.h"
+#include "MySettings.h"
+#include "QualityController.h"
+#include <QDebug>
+#include <QRegion>
+#include <QStringList>
+#include <QThread>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <freerdp/client.h>
+#include <freerdp/client/cliprdr.h>
+#include <freerdp/codec/color.h>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
+
+struct Session::Private {
+	Options options;
+#if 0
+	freerdp *rdp = nullptr;
+#else
+	union {
+		rdpContext *rdp;
+		MyClientContext *cc;
+	} d = {};
+#endif
+	std::atomic<bool> connected { false };
+	std::atomic<bool> connecting { false };
+	std::atomic<bool> running { false }; // RDPスレッドが動いている
+	bool torn_down = false; // RDPスレッドがfreerdp_disconnectを済ませた
+	QString error; // 接続に失敗した理由（connectFinished(false)の後に読む）
+	ConnectTiming timing; // RDPスレッドが書き、connectFinished()やframeReady()の後に読む
+	bool first_frame = false; // RDPスレッド専用
+	std::thread rdp_thread;
+	std::atomic<bool> interrupted { false };
+	HANDLE wakeup_event = nullptr; // RDPスレッドを起こすためのイベント
+
+	std::mutex request_mutex;
+	QSize requested_size; // RDPスレッドで適用する解像度
+
+	LoopStats loop_stats;
+
+	// GDIのフレームバッファの形式（接続ごとにOptions::pixel_formatから決める）
+	UINT32 rdp_pixel_format = PIXEL_FORMAT_RGBX32;
+	QImage::Format screen_image_foramt = QImage::Format_RGBX8888;
+
+	FramebufferPool screen_pool;
+	QImage screen_image; // screen_poolから切り出したGDIのプライマリバッファ
+
+	// 表示先ごとの画面（複数モニターならモニターごと、それ以外はデスクトップ全体の1つ）
+	struct Output {
+		QRect rect; // デスクトップ上の位置（空ならデスクトップ全体）
+		FrameExchange frames;
+		std::atomic<bool> update_requested { false };
+		std::atomic<quint64> presented_sequence { 0 }; // 表示し終わったフレームの番号
+	};
+	std::vector<std::unique_ptr<Output>> outputs; // 接続中は変えない
+	InputQueue input;
+
+	std::atomic<int> target_fps { 0 }; // 画面を公開する最大のフレームレート（0なら制限しない）
+	std::chrono::steady_clock::time_point next_publish; // RDPスレッド専用
+	bool publish_deferred = false; // RDPスレッド専用：フレームレートの制限で公開を遅らせている
+
+	// 表示側からのフィードバック
+	std::atomic<bool> waiting_for_presenter { false }; // RDPスレッドが表示の進み具合を待っている
+	bool output_visible = true; // request_mutexで保護
+	QRect output_area; // request_mutexで保護：再開時に再送を求める領域（RDP座標）
+	bool output_changed = false; // request_mutexで保護
+	std::deque<UINT32> pending_acks; // RDPスレッド専用：確認応答を遅らせているフレーム
+	std::chrono::steady_clock::time_point next_ack; // RDPスレッド専用：フレームレートの制限で次に応答できる時刻
+	bool ack_deferred = false; // RDPスレッド専用：フレームレートの制限で確認応答を遅らせている
+	bool hidden = false; // RDPスレッド専用：表示されていないので画面の送信を止めている
+	OutputStats output_stats;
+
+	GfxStats gfx_stats;
+	CacheStats cache_stats;
+	std::vector<bool> imported_slots; // RDPスレッド専用：永続キャッシュから読み込んだスロット
+	// 画面のコピーを移動として公開するための記録（RDPスレッド専用、公開するたびに空にする）
+	std::vector<FrameExchange::Move> moves; // 前回の公開からの移動
+	QRegion move_damage; // 移動を記録する時にGDIから取り出した無効領域
+	QRegion move_dirty; // 移動を適用した前の画面と内容が異なる部分
+	QRegion moved; // 移動先の合計
+	DamageFilter damage_filter; // RDPスレッド専用（統計は他のスレッドからも読む）
+	FramebufferExport frame_export; // GUIスレッドで待ち受け、RDPスレッドから公開する
+	quint64 exported_allocation = 0; // RDPスレッド専用：最後にframe_exportに渡したscreen_poolのバッファ
+
+	quint64 pointer_serial = 0; // RDPスレッド専用：最後に作ったポインタの番号（接続し直しても戻さない）
+	Telemetry telemetry;
+	ScreenRecorder recorder;
+	bool replay_paced = false; // 再生が記録時の間隔を待つ（FreeRDPに速く再生する設定がない）
+};
+
+/**
+ * @brief マウスポインタ（FreeRDPのポインタキャッシュの1エントリ）
+ *
+ * FreeRDPがcallocで確保し、rdpPointerの部分だけを初期化するので、
+ * コンストラクタを持つメンバーは置かない。
+ */
+struct SessionPointer {
+	rdpPointer pointer;
+	quint64 id; // Sessionの中で一意な番号（表示側はこれをキーにカーソルを保持する）
+	QImage *image; // デコードした画像（ARGB32）
+};
+
+/**
+ * @brief QImageの形式に対応するFreeRDPの画素形式（メモリ上のバイトの並びが同じもの）
+ * @return 対応しない形式なら0
+ */
+static UINT32 rdpPixelFormat(QImage::Format format)
+{
+	switch (format) {
+	case QImage::Format_RGBX8888:
+		return PIXEL_FORMAT_RGBX32;
+	case QImage::Format_RGBA8888:
+	case QImage::Format_RGBA8888_Premultiplied:
+		return PIXEL_FORMAT_RGBA32; // 画面は不透明なので乗算済みでも同じ
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	case QImage::Format_RGB32:
+		return PIXEL_FORMAT_BGRX32;
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied:
+		return PIXEL_FORMAT_BGRA32;
+#else
+	case QImage::Format_RGB32:
+		return PIXEL_FORMAT_XRGB32;
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied:
+		return PIXEL_FORMAT_ARGB32;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief GDIに蓄積された無効領域を取り出してリセットする
+ */
+static QRegion takeInvalidRegion(rdpGdi *gdi)
+{
+	QRegion region;
+	if (!gdi || !gdi->primary || !gdi->primary->hdc || !gdi->primary->hdc->hwnd) return region;
+
+	HGDI_WND hwnd = gdi->primary->hdc->hwnd;
+	if (!hwnd->invalid || hwnd->invalid->null) return region;
+
+	if (hwnd->ninvalid > 0 && hwnd->cinvalid) {
+		for (INT32 i = 0; i < hwnd->ninvalid; i++) {
+			GDI_RGN const &r = hwnd->cinvalid[i];
+			region += QRect(r.x, r.y, r.w, r.h);
+		}
+	} else {
+		region = QRect(hwnd->invalid->x, hwnd->invalid->y, hwnd->invalid->w, hwnd->invalid->h);
+	}
+	hwnd->invalid->null = TRUE;
+	hwnd->ninvalid = 0;
+
+	return region.intersected(QRect(0, 0, gdi->width, gdi->height));
+}
+
+Session::Session(QObject *parent)
+	: QObject(parent)
+	, m(new Private)
+{
+	m->wakeup_event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	m->outputs.emplace_back(new Private::Output);
+	m->input.setNotify([this](){
+		wake();
+	});
+	m->input.setLatencyHistogram(&m->telemetry.histogram(Telemetry::Input));
+}
+
+Session::~Session()
+{
+	disconnectFromHost();
+	if (m->wakeup_event) {
+		CloseHandle(m->wakeup_event);
+	}
+	delete m;
+}
+
+#if 0
+Session::Version Session::version() const
+{
+	return V1;
+}
+
+void Session::context_new()
+{
+	m->rdp = freerdp_new();
+	m->rdp->ContextSize = sizeof(MyClientContext);
+	freerdp_context_new(m->rdp);
+	reinterpret_cast<MyClientContext *>(m->rdp->context)->self = this;
+}
+
+void Session::context_free()
+{
+	freerdp_context_free(m->rdp);
+	freerdp_free(m->rdp);
+	m->rdp = nullptr;
+}
+
+freerdp *Session::rdp_instance()
+{
+	return m->rdp;
+}
+
+DispClientContext *Session::disp_client_context()
+{
+	return nullptr;
+}
+#else
+Session::Version Session::version() const
+{
+	return V2;
+}
+
+void Session::context_new()
+{
+	RDP_CLIENT_ENTRY_POINTS entry = {};
+	entry.Version = RDP_CLIENT_INTERFACE_VERSION;
+	entry.Size = sizeof(RDP_CLIENT_ENTRY_POINTS_V1);
+	entry.ContextSize = sizeof(MyClientContext);
+
+	m->d.rdp = freerdp_client_context_new(&entry);
+	m->d.cc->self = this;
+
+	m->d.rdp->update->EndPaint = rdp_end_paint;
+}
+
+void Session::context_free()
+{
+	freerdp_client_context_free(m->d.rdp);
+	m->d.rdp = nullptr;
+}
+
+freerdp *Session::rdp_instance()
+{
+	return m->d.rdp ? m->d.rdp->instance : nullptr;
+}
+
+DispClientContext *Session::disp_client_context()
+{
+	return m->d.cc ? m->d.cc->disp : nullptr;
+}
+#endif
+
+rdpContext *Session::rdp_context()
+{
+	auto *inst = rdp_instance();
+	return inst ? inst->context : nullptr;
+}
+
+/**
+ * @brief このアプリのコンテキスト（V1、V2のどちらでもContextSizeをMyClientContextにしている）
+ */
+MyClientContext *Session::client_context()
+{
+	return reinterpret_cast<MyClientContext *>(rdp_context());
+}
+
+rdpSettings *Session::rdp_settings()
+{
+	auto *context = rdp_context();
+	return context ? context->settings : nullptr;
+}
+
+rdpGdi *Session::rdp_gdi()
+{
+	auto *context = rdp_context();
+	return context ? context->gdi : nullptr;
+}
+
+Session::Options const &Session::options() const
+{
+	return m->options;
+}
+
+bool Session::isConnected() const
+{
+	return m->connected;
+}
+
+bool Session::isConnecting() const
+{
+	return m->connecting;
+}
+
+bool Session::isRunning() const
+{
+	return m->running;
+}
+
+QString Session::errorString() const
+{
+	return m->error;
+}
+
+Session::ConnectTiming const &Session::connectTiming() const
+{
+	return m->timing;
+}
+
+char const *Session::ConnectTiming::phaseName(Phase phase)
+{
+	switch (phase) {
+	case Dns:          return "dns";
+	case Tcp:          return "tcp";
+	case Tls:          return "tls";
+	case Nla:          return "nla";
+	case Capabilities: return "capabilities";
+	case FirstFrame:   return "first_frame";
+	default:           return "";
+	}
+}
+
+/**
+ * @brief 段階に掛かった時間（ミリ秒）。終わっていなければ-1
+ */
+qint64 Session::ConnectTiming::duration(Phase phase) const
+{
+	if (end[phase].time_since_epoch().count() == 0) return -1;
+	auto begin = start;
+	for (int i = phase - 1; i >= 0; i--) {
+		if (end[i].time_since_epoch().count() != 0) {
+			begin = end[i];
+			break;
+		}
+	}
+	return std::chrono::duration_cast<std::chrono::milliseconds>(end[phase] - begin).count();
+}
+
+/**
+ * @brief 開始から最後に終わった段階までの時間（ミリ秒）
+ */
+qint64 Session::ConnectTiming::total() const
+{
+	for (int i = PhaseCount - 1; i >= 0; i--) {
+		if (end[i].time_since_epoch().count() != 0) {
+			return std::chrono::duration_cast<std::chrono::milliseconds>(end[i] - start).count();
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief 接続する（freerdp_connectが終わるまで戻らない）
+ *
+ * 接続後、start()でRDPスレッドを開始するか、processEvents()を呼び続けること。
+ */
+bool Session::connectToHost(Options const &options)
+{
+	if (!prepare(options)) return false;
+	m->connecting = true;
+	return establish();
+}
+
+/**
+ * @brief RDPスレッドで接続し、そのままイベント処理を始める（すぐに戻る）
+ *
+ * 結果はconnectFinished()で、途中経過はconnectProgress()で通知する。
+ * disconnectAsync()で接続を中止できる。
+ */
+void Session::connectAsync(Options const &options)
+{
+	if (!prepare(options)) {
+		emit connectFinished(false);
+		emit disconnected();
+		return;
+	}
+	m->connecting = true;
+	m->running = true;
+	m->rdp_thread = std::thread([this]() {
+		bool ok = establish();
+		emit connectFinished(ok);
+		if (ok) {
+			run();
+		}
+		teardown();
+		m->running = false;
+		emit disconnected();
+	});
+}
+
+/**
+ * @brief 接続の準備（コンテキストの作成と設定）
+ */
+bool Session::prepare(Options const &options)
+{
+	disconnectFromHost();
+
+	m->options = options;
+	m->outputs.clear();
+	if (options.monitors.size() > 1) {
+		// デスクトップはモニター全体を囲む矩形。RDPの座標はその左上を(0,0)とする
+		QRect desktop;
+		for (QRect const &r : options.monitors) {
+			desktop |= r;
+		}
+		m->options.size = desktop.size();
+		m->options.max_size = {};
+		for (QRect const &r : options.monitors) {
+			auto *output = new Private::Output;
+			output->rect = r.translated(-desktop.topLeft());
+			m->outputs.emplace_back(output);
+		}
+	} else {
+		m->outputs.emplace_back(new Private::Output);
+	}
+	m->rdp_pixel_format = rdpPixelFormat(options.pixel_format);
+	m->screen_image_foramt = options.pixel_format;
+	if (m->rdp_pixel_format == 0) {
+		qWarning() << "unsupported pixel format" << options.pixel_format;
+		m->rdp_pixel_format = PIXEL_FORMAT_RGBX32;
+		m->screen_image_foramt = QImage::Format_RGBX8888;
+	}
+	m->options.pixel_format = m->screen_image_foramt;
+	m->error.clear();
+	m->torn_down = false;
+	m->timing = {};
+	m->first_frame = false;
+	m->interrupted = false;
+	ResetEvent(m->wakeup_event);
+	m->requested_size = {};
+	m->input.reset();
+	m->gfx_stats.frames = 0;
+	m->gfx_stats.avc_commands = 0;
+	m->cache_stats.imported = 0;
+	m->cache_stats.hits = 0;
+	m->cache_stats.misses = 0;
+	m->cache_stats.persistent_hits = 0;
+	m->cache_stats.saved_bytes = 0;
+	m->imported_slots.clear();
+	m->moves.clear();
+	m->move_damage = {};
+	m->move_dirty = {};
+	m->moved = {};
+	m->damage_filter.reset();
+	// 共有メモリに確保したフレームバッファを公開する（V2のみ。V1はGDIが自分で確保する）
+	if (!options.export_name.isEmpty() && version() == V2 && m->frame_export.listen(options.export_name)) {
+		m->screen_pool.setShared(true);
+	} else {
+		m->frame_export.close();
+		m->screen_pool.setShared(false);
+	}
+	m->exported_allocation = 0;
+	m->telemetry.reset();
+	m->target_fps = options.quality >= 0 ? QualityController::profile(QualityController::Level(options.quality)).fps : 0;
+	m->next_publish = {};
+	m->publish_deferred = false;
+	m->waiting_for_presenter = false;
+	m->output_visible = true;
+	m->output_changed = false;
+	m->pending_acks.clear();
+	m->next_ack = {};
+	m->ack_deferred = false;
+	m->hidden = false;
+	m->output_stats.acks = 0;
+	m->output_stats.delayed_acks = 0;
+	m->output_stats.suppressed = 0;
+	m->output_stats.refreshed = 0;
+	m->output_stats.suppressing = false;
+
+	context_new();
+	if (!rdp_instance()) {
+		m->error = "failed to create FreeRDP context";
+		return false;
+	}
+
+	// コールバック関数の設定
+	rdp_instance()->PreConnect = rdp_pre_connect;
+	rdp_instance()->PostConnect = rdp_post_connect;
+	rdp_instance()->PostDisconnect = rdp_post_disconnect;
+	rdp_instance()->Authenticate = rdp_authenticate;
+
+	applySettings(rdp_settings());
+
+	if (!options.video_file.isEmpty()) {
+		if (!m->recorder.open(options.video_file)) {
+			qWarning() << "failed to open" << options.video_file;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief 接続を実行する（プロセス内のどのスレッドで呼んでもよい）
+ */
+bool Session::establish()
+{
+	m->timing.start = std::chrono::steady_clock::now();
+
+	if (m->options.replay_file.isEmpty()) {
+		emit connectProgress("Resolving " + m->options.hostname);
+	}
+
+	bool ok = !m->interrupted && freerdp_connect(rdp_instance());
+	m->connecting = false;
+	if (!ok) {
+		UINT32 code = freerdp_get_last_error(rdp_context());
+		m->error = m->interrupted ? QString("canceled") : QString::fromUtf8(freerdp_get_last_error_string(code));
+		m->recorder.close();
+		m->torn_down = true;
+		return false;
+	}
+	m->connected = true;
+	return true;
+}
+
+/**
+ * @brief RDPスレッド：段階が終わった時刻を記録し、次の段階を通知する
+ */
+void Session::setPhase(ConnectTiming::Phase phase, QString const &next)
+{
+	if (m->timing.end[phase].time_since_epoch().count() != 0) return;
+	m->timing.end[phase] = std::chrono::steady_clock::now();
+	if (!next.isEmpty()) {
+		emit connectProgress(next);
+	}
+}
+
+/**
+ * @brief RDPスレッド：切断する（コンテキストの解放は呼び出し側のスレッドで行う）
+ */
+void Session::teardown()
+{
+	m->connected = false;
+	m->connecting = false;
+	m->recorder.close();
+	if (!m->torn_down && rdp_instance()) {
+		freerdp_disconnect(rdp_instance());
+	}
+	m->torn_down = true;
+}
+
+/**
+ * @brief 接続設定
+ */
+void Session::applySettings(rdpSettings *settings)
+{
+	Options const &o = m->options;
+	freerdp_settings_set_string(settings, FreeRDP_ServerHostname, o.hostname.toUtf8().constData());
+	freerdp_settings_set_string(settings, FreeRDP_Username, o.username.toUtf8().constData());
+	freerdp_settings_set_string(settings, FreeRDP_Password, o.password.toUtf8().constData());
+	freerdp_settings_set_string(settings, FreeRDP_Domain, o.domain.toUtf8().constData());
+	freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, o.size.width());
+	freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, o.size.height());
+	if (m->outputs.size() > 1) {
+		// 複数モニター。座標はプライマリモニターの左上を(0,0)とする
+		UINT32 count = (UINT32)o.monitors.size();
+		freerdp_settings_set_bool(settings, FreeRDP_UseMultimon, TRUE);
+		freerdp_settings_set_pointer_len(settings, FreeRDP_MonitorDefArray, nullptr, count);
+		for (UINT32 i = 0; i < count; i++) {
+			auto *monitor = (rdpMonitor *)freerdp_settings_get_pointer_array_writable(settings, FreeRDP_MonitorDefArray, i);
+			if (!monitor) break;
+			QRect const &r = o.monitors[i];
+			monitor->x = r.x();
+			monitor->y = r.y();
+			monitor->width = r.width();
+			monitor->height = r.height();
+			monitor->is_primary = (i == 0);
+		}
+		freerdp_settings_set_uint32(settings, FreeRDP_MonitorCount, count);
+	}
+
+	if (version() == V2) {
+		// Display拡張を有効化（動的解像度変更のため）
+		freerdp_settings_set_bool(settings, FreeRDP_SupportDisplayControl, TRUE);
+		freerdp_settings_set_bool(settings, FreeRDP_DynamicResolutionUpdate, TRUE);
+
+		// グラフィックスパイプライン（RDPGFX）を有効化
+		freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, TRUE);
+		freerdp_settings_set_bool(settings, FreeRDP_GfxProgressive, TRUE);
+		freerdp_settings_set_bool(settings, FreeRDP_GfxProgressiveV2, TRUE);
+	}
+
+	// 安全なパフォーマンス最適化設定のみ適用
+	freerdp_settings_set_bool(settings, FreeRDP_FastPathOutput, TRUE);
+	freerdp_settings_set_bool(settings, FreeRDP_FastPathInput, TRUE);
+	freerdp_settings_set_bool(settings, FreeRDP_BitmapCacheEnabled, TRUE);
+	if (!o.bitmap_cache_file.isEmpty()) {
+		// 永続ビットマップキャッシュ。接続時に読み込んでサーバーに通知し、切断時に書き出す（FreeRDPが行う）
+		freerdp_settings_set_bool(settings, FreeRDP_BitmapCachePersistEnabled, TRUE);
+		freerdp_settings_set_string(settings, FreeRDP_BitmapCachePersistFile, o.bitmap_cache_file.toUtf8().constData());
+	}
+	freerdp_settings_set_uint32(settings, FreeRDP_CompressionLevel, PACKET_COMPR_TYPE_RDP8);
+	freerdp_settings_set_uint32(settings, FreeRDP_OffscreenSupportLevel, 1);
+	freerdp_settings_set_uint32(settings, FreeRDP_GlyphSupportLevel, 1);
+	freerdp_settings_set_bool(settings, FreeRDP_SurfaceCommandsEnabled, TRUE);
+	freerdp_settings_set_bool(settings, FreeRDP_NetworkAutoDetect, TRUE);
+
+	{
+		// デコーダの設定。Multithreaded=falseでコーデックのマルチスレッド処理を無効にする（スレッド数は選べない）
+		MySettings s;
+		s.beginGroup("Decoder");
+		bool h264 = s.value("H264", true).toBool();
+		bool multithreaded = s.value("Multithreaded", true).toBool();
+		s.endGroup();
+		bool lossless_high = s.value("Quality/LosslessHigh", false).toBool();
+		bool avc444 = h264;
+		int color_depth = 32;
+		if (o.quality >= 0) {
+			// 画質の段階。H264=falseの場合はH.264を使わない
+			auto profile = QualityController::profile(QualityController::Level(o.quality), lossless_high);
+			h264 = h264 && profile.h264;
+			avc444 = h264 && profile.avc444;
+			color_depth = profile.color_depth;
+		}
+		freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, avc444);
+		freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444v2, avc444);
+		freerdp_settings_set_bool(settings, FreeRDP_GfxH264, h264);
+		freerdp_settings_set_uint32(settings, FreeRDP_ThreadingFlags, multithreaded ? 0 : THREADING_FLAGS_DISABLE_THREADS);
+		freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, color_depth);
+	}
+	freerdp_settings_set_bool(settings, FreeRDP_RemoteFxCodec, true);
+
+	// 受信したPDU（TLS復号後）の記録と再生。FreeRDPのトランスポートダンプを使う
+	if (!o.record_file.isEmpty()) {
+		freerdp_settings_set_bool(settings, FreeRDP_TransportDump, TRUE);
+		freerdp_settings_set_string(settings, FreeRDP_TransportDumpFile, o.record_file.toUtf8().constData());
+	}
+	if (!o.replay_file.isEmpty()) {
+		freerdp_settings_set_bool(settings, FreeRDP_TransportDumpReplay, TRUE);
+		freerdp_settings_set_string(settings, FreeRDP_TransportDumpFile, o.replay_file.toUtf8().constData());
+		// 記録時の間隔を待たずにできるだけ速く再生する
+		m->replay_paced = !freerdp_settings_set_value_for_name(settings, "TransportDumpReplayNodelay", "true");
+		if (m->replay_paced) {
+			qWarning() << "this FreeRDP has no TransportDumpReplayNodelay; replaying at the recorded speed";
+		}
+	} else {
+		m->replay_paced = false;
+	}
+}
+
+/**
+ * @brief 切断する（RDPスレッドが終わるまで戻らない）
+ */
+void Session::disconnectFromHost()
+{
+	disconnectAsync();
+	if (m->rdp_thread.joinable()) {
+		m->rdp_thread.join();
+	}
+	m->running = false;
+
+	if (rdp_instance()) {
+		if (!m->torn_down) {
+			m->recorder.close();
+			freerdp_disconnect(rdp_instance());
+		}
+		context_free();
+	}
+	m->connected = false;
+	m->connecting = false;
+	m->screen_image = {};
+	m->screen_pool.clear();
+	if (m->exported_allocation != 0) {
+		m->frame_export.setBuffer(-1, 0, 0, m->screen_image_foramt);
+		m->exported_allocation = 0;
+	}
+	for (auto &output : m->outputs) {
+		output->frames.reset();
+	}
+}
+
+/**
+ * @brief 接続中なら中止し、接続済みなら切断を始める（すぐに戻る）
+ *
+ * RDPスレッドが切断を終えるとdisconnected()を送出する。コンテキストは
+ * 次の接続かdisconnectFromHost()、デストラクタで解放する。
+ */
+void Session::disconnectAsync()
+{
+	m->interrupted = true;
+	if (m->connecting && rdp_context()) {
+		freerdp_abort_connect_context(rdp_context());
+	}
+	wake();
+}
+
+/**
+ * @brief RDPスレッドを起こす（どのスレッドから呼んでもよい）
+ */
+void Session::wake()
+{
+	if (m->wakeup_event) {
+		SetEvent(m->wakeup_event);
+	}
+}
+
+/**
+ * @brief 解像度の変更を要求する（RDPスレッドで適用される）
+ */
+void Session::requestSize(const QSize &size)
+{
+	{
+		std::lock_guard lock(m->request_mutex);
+		m->requested_size = size;
+	}
+	wake();
+}
+
+/**
+ * @brief 画面を公開する最大のフレームレートを設定する（どのスレッドから呼んでもよい）
+ * @param fps 0なら制限しない
+ */
+void Session::setTargetFrameRate(int fps)
+{
+	m->target_fps = std::max(fps, 0);
+	wake();
+}
+
+int Session::targetFrameRate() const
+{
+	return m->target_fps;
+}
+
+/**
+ * @brief 表示されているかどうかを設定する（どのスレッドから呼んでもよい）
+ *
+ * 表示されていない間はSuppress Outputでサーバーに画面の送信を止めてもらい、
+ * 再び表示された時にareaの再送を求める。
+ * @param area 表示されている領域（RDP座標）
+ */
+void Session::setOutputVisible(bool visible, const QRect &area)
+{
+	{
+		std::lock_guard lock(m->request_mutex);
+		if (m->output_visible == visible) return;
+		m->output_visible = visible;
+		m->output_area = area;
+		m->output_changed = true;
+	}
+	wake();
+}
+
+/**
+ * @brief 表示し終わったフレームを知らせる（表示側のスレッドから呼ぶ）
+ * @param sequence FrameExchange::Frame::sequence
+ * @param output 出力の番号
+ */
+void Session::framePresented(quint64 sequence, int output)
+{
+	if (output < 0 || output >= (int)m->outputs.size()) return;
+	auto &presented = m->outputs[output]->presented_sequence;
+	quint64 prev = presented.load();
+	while (prev < sequence && !presented.compare_exchange_weak(prev, sequence));
+	if (m->waiting_for_presenter.exchange(false)) {
+		wake();
+	}
+}
+
+/**
+ * @brief 公開したが表示されていないフレームの数（出力のうち最も遅れているもの）
+ */
+quint64 Session::backlog() const
+{
+	quint64 backlog = 0;
+	for (auto const &output : m->outputs) {
+		quint64 published = output->frames.stats().published;
+		quint64 presented = output->presented_sequence.load();
+		if (published > presented) {
+			backlog = std::max(backlog, published - presented);
+		}
+	}
+	return backlog;
+}
+
+/**
+ * @brief 受信したデータを処理し、溜まった入力を送信する（待たずに戻る）
+ * @return 切断された場合はfalse
+ */
+bool Session::processEvents()
+{
+	auto *context = rdp_context();
+	if (!context) return false;
+
+	{
+		HistogramTimer t(&m->telemetry.histogram(Telemetry::Process));
+		if (!freerdp_check_event_handles(context)) {
+			return false;
+		}
+	}
+	if (context->autodetect) {
+		m->telemetry.setNetwork(context->autodetect->netCharAverageRTT, context->autodetect->netCharBandwidth);
+	}
+	m->input.drain(context->input);
+	if (version() == V1) {
+		publishScreen();
+	}
+	return true;
+}
+
+/**
+ * @brief 待つべきイベントのハンドル（wake()のイベントとFreeRDPのハンドル）
+ *
+ * 1つのスレッドで複数のセッションを扱う場合に、全セッションのハンドルをまとめて待つために使う。
+ * @return 入れたハンドルの数。足りなければ0
+ */
+DWORD Session::eventHandles(HANDLE *handles, DWORD count)
+{
+	if (!rdp_context() || count < 2) return 0;
+	handles[0] = m->wakeup_event;
+	DWORD n = freerdp_get_event_handles(rdp_context(), handles + 1, count - 1);
+	return n == 0 ? 0 : n + 1;
+}
+
+/**
+ * @brief run()の1回分の処理をする（待たない）
+ *
+ * connectToHost()で接続し、RDPスレッドを使わずに呼び出し側のスレッドで動かす場合に、
+ * eventHandles()のどれかが起きるたびに呼ぶ。
+ * @return 切断された場合や中断された場合はfalse
+ */
+bool Session::poll()
+{
+	if (!rdp_instance() || !m->connected || m->interrupted) return false;
+	m->loop_stats.iterations++;
+	if (WaitForSingleObject(m->wakeup_event, 0) == WAIT_OBJECT_0) {
+		m->loop_stats.wakeup++;
+		ResetEvent(m->wakeup_event);
+		applyRequestedSize();
+		applyOutputState();
+		flushFrameAcks();
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (m->publish_deferred && now >= m->next_publish) {
+		publishScreen();
+	}
+	if (m->ack_deferred && now >= m->next_ack) {
+		flushFrameAcks();
+	}
+	return processEvents();
+}
+
+/**
+ * @brief RDPスレッドを開始する（connectToHost()で接続した場合）
+ */
+void Session::start()
+{
+	m->running = true;
+	m->rdp_thread = std::thread([this]() {
+		run();
+		teardown();
+		m->running = false;
+		emit disconnected();
+	});
+}
+
+/**
+ * @brief RDPスレッド：切断されるか中断されるまでイベントを処理する
+ */
+void Session::run()
+{
+	while (!m->interrupted) {
+		if (!rdp_instance() || !m->connected) break;
+
+		// イベント処理（公開か確認応答を遅らせている場合はそれができる時刻まで、それ以外はタイムアウトなしで待つ）
+		DWORD timeout = INFINITE;
+		if (m->publish_deferred || m->ack_deferred) {
+			auto until = m->publish_deferred ? m->next_publish : m->next_ack;
+			if (m->publish_deferred && m->ack_deferred) {
+				until = std::min(m->next_publish, m->next_ack);
+			}
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+			timeout = (DWORD)std::max<qint64>(ms, 1);
+		}
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		DWORD count = 0;
+		handles[count++] = m->wakeup_event;
+		DWORD n = freerdp_get_event_handles(rdp_context(), &handles[count], ARRAYSIZE(handles) - count);
+		if (n == 0) {
+			break;
+		}
+		count += n;
+		auto r = WaitForMultipleObjects(count, handles, FALSE, timeout);
+		if (r == WAIT_FAILED) {
+			break;
+		}
+		m->loop_stats.iterations++;
+		if (r == WAIT_TIMEOUT) {
+			if (m->publish_deferred) {
+				publishScreen();
+			}
+			if (m->ack_deferred) {
+				flushFrameAcks();
+			}
+			continue;
+		}
+		if (r == WAIT_OBJECT_0) {
+			m->loop_stats.wakeup++;
+			ResetEvent(m->wakeup_event);
+			if (m->interrupted) break;
+			applyRequestedSize();
+			applyOutputState();
+			flushFrameAcks();
+		} else {
+			m->loop_stats.network++;
+		}
+		if (!processEvents()) {
+			break;
+		}
+	}
+}
+
+/**
+ * @brief RDPスレッド：GDIの無効領域をフレームとして公開し、受け取り側に通知する
+ */
+void Session::publishScreen()
+{
+	auto *gdi = rdp_gdi();
+	if (!gdi || !gdi->primary_buffer) return;
+
+	// フレームレートの制限。無効領域はGDIに溜めたままにして、次に公開する時にまとめる
+	auto now = std::chrono::steady_clock::now();
+	int fps = m->target_fps;
+	if (fps > 0 && now < m->next_publish) {
+		m->publish_deferred = true;
+		return;
+	}
+	m->publish_deferred = false;
+
+	QRegion damage = takeInvalidRegion(gdi);
+	std::vector<FrameExchange::Move> moves;
+	QRegion moved;
+	if (!m->moves.empty()) {
+		// 移動先のうち、移動の後に描かれていない部分は表示側で描き直さなくてよい。
+		// RDPGFXでは移動の後の描画をrecordDrawn()で数えているが、GDIの描画は今の無効領域にある
+		QRegion dirty = m->move_dirty;
+		if (!client_context()->gfx) {
+			dirty += damage;
+		}
+		moved = m->moved.subtracted(dirty);
+		moves.swap(m->moves);
+	}
+	damage += m->move_damage;
+	m->move_damage = {};
+	m->move_dirty = {};
+	m->moved = {};
+
+	// 同じ画素を描き直しただけのタイルは表示側に渡さない。移動がある時は、
+	// 移動先を含めて表示側のキャッシュと合わせる必要があるのでハッシュの更新だけにする
+	QImage source(gdi->primary_buffer, gdi->width, gdi->height, gdi->stride, m->screen_image_foramt);
+	if (moves.empty()) {
+		damage = m->damage_filter.filter(source, damage);
+	} else {
+		m->damage_filter.update(source, damage);
+	}
+	if (damage.isEmpty()) return;
+	if (!m->first_frame) {
+		m->first_frame = true;
+		setPhase(ConnectTiming::FirstFrame, {});
+	}
+	if (fps > 0) {
+		m->next_publish = now + std::chrono::microseconds(1000000 / fps);
+	}
+
+	if (m->recorder.isOpen()) {
+		m->recorder.submit(source, damage);
+	}
+	exportScreen(source.size(), damage);
+	for (int i = 0; i < (int)m->outputs.size(); i++) {
+		auto &output = *m->outputs[i];
+		if (output.rect.isEmpty()) {
+			output.frames.publish(source, damage, moves, moved);
+		} else {
+			// モニターの部分だけを切り出す（コピーせずに同じバッファを参照する）
+			QRect rect = output.rect.intersected(source.rect());
+			QRegion part = damage.intersected(rect);
+			if (part.isEmpty()) continue;
+			uchar const *bits = source.constBits() + rect.y() * source.bytesPerLine() + rect.x() * 4;
+			QImage slice(bits, rect.width(), rect.height(), source.bytesPerLine(), source.format());
+			// 移動はすべてモニターの中で閉じている場合だけ伝える
+			std::vector<FrameExchange::Move> local;
+			for (FrameExchange::Move const &move : moves) {
+				if (!rect.contains(move.rect) || !rect.contains(move.rect.translated(move.delta))) {
+					local.clear();
+					break;
+				}
+				local.push_back({ move.rect.translated(-rect.topLeft()), move.delta });
+			}
+			QRegion local_moved = local.empty() ? QRegion() : moved.intersected(rect).translated(-rect.topLeft());
+			output.frames.publish(slice, part.translated(-rect.topLeft()), local, local_moved);
+		}
+		if (!output.update_requested.exchange(true)) {
+			emit frameReady(i);
+		}
+	}
+
+	// RDPGFXの確認応答で調整できない場合は、表示が大きく遅れたら画面の送信を止める
+	if (!client_context()->frame_acks && !m->output_stats.suppressing && backlog() > MAX_BACKLOG_WITHOUT_ACKS) {
+		applyOutputState();
+	}
+}
+
+/**
+ * @brief RDPスレッド：画面を他のプロセスに公開している場合、フレームの番号と無効領域を知らせる
+ *
+ * 画素は共有メモリのGDIのバッファそのものなのでコピーしない。バッファを確保し直した時だけ、新しいfdを渡す。
+ */
+void Session::exportScreen(QSize size, const QRegion &damage)
+{
+	if (!m->frame_export.isListening() || !m->screen_pool.isShared() || m->screen_pool.fd() < 0) return;
+	if (m->exported_allocation != m->screen_pool.allocations()) {
+		m->exported_allocation = m->screen_pool.allocations();
+		m->frame_export.setBuffer(m->screen_pool.fd(), m->screen_pool.bytes(), m->screen_pool.stride(), m->screen_image_foramt);
+	}
+	m->frame_export.publishFrame(size, damage);
+}
+
+/**
+ * @brief RDPスレッド：画面のコピーを移動として記録する
+ * @param dst 移動先（RDP座標）
+ * @param delta 移動元から移動先への移動量
+ * @param written 実際に書き換えられた領域（クリップされていればdstより小さい）
+ */
+void Session::recordMove(const QRect &dst, const QPoint &delta, const QRegion &written)
+{
+	auto *gdi = rdp_gdi();
+	if (!gdi) return;
+	QRect bounds(0, 0, gdi->width, gdi->height);
+	QRect d = written.boundingRect().intersected(dst).intersected(bounds).intersected(bounds.translated(delta));
+	if (delta.isNull() || d.isEmpty() || written.subtracted(d) != QRegion() || (int)m->moves.size() >= FrameExchange::MAX_MOVES) {
+		// 矩形の移動として表せないものは、普通の描画として扱う
+		m->move_dirty += written;
+		return;
+	}
+	FrameExchange::Move move { d.translated(-delta), delta };
+	m->move_dirty = FrameExchange::moveRegion(m->move_dirty, move);
+	m->moved += d;
+	m->moves.push_back(move);
+}
+
+/**
+ * @brief RDPスレッド：移動を記録した後のRDPGFXの描画を、移動で得られない部分として数える
+ * @param rect サーフェスの座標
+ */
+void Session::recordDrawn(RdpgfxClientContext *gfx, UINT16 surface_id, const QRect &rect)
+{
+	if (m->moves.empty() || rect.isEmpty()) return;
+	auto *surface = reinterpret_cast<gdiGfxSurface *>(gfx->GetSurfaceData(gfx, surface_id));
+	if (!surface || !surface->outputMapped) return;
+	QRect r = rect;
+	if (surface->outputTargetWidth != surface->width || surface->outputTargetHeight != surface->height) {
+		// 拡大して出力しているサーフェスは、拡大後の矩形を1画素広げて数える
+		double sx = surface->width ? (double)surface->outputTargetWidth / surface->width : 1;
+		double sy = surface->height ? (double)surface->outputTargetHeight / surface->height : 1;
+		r = QRect((int)(r.x() * sx), (int)(r.y() * sy), (int)std::ceil(r.width() * sx), (int)std::ceil(r.height() * sy)).adjusted(-1, -1, 1, 1);
+	}
+	m->move_dirty += r.translated((int)surface->outputOriginX, (int)surface->outputOriginY);
+}
+
+/**
+ * @brief RDPスレッド：RDPGFXのフレーム中に描かれ、まだプライマリバッファに出していない領域（RDP座標）
+ */
+QRegion Session::gfxPendingRegion(RdpgfxClientContext *gfx)
+{
+	QRegion region;
+	UINT16 *ids = nullptr;
+	UINT16 count = 0;
+	if (gfx->GetSurfaceIds(gfx, &ids, &count) != CHANNEL_RC_OK) return region;
+	for (UINT16 i = 0; i < count; i++) {
+		auto *surface = reinterpret_cast<gdiGfxSurface *>(gfx->GetSurfaceData(gfx, ids[i]));
+		if (!surface || !surface->outputMapped) continue;
+		UINT32 n = 0;
+		RECTANGLE_16 const *rects = region16_rects(&surface->invalidRegion, &n);
+		QRect extent(0, 0, surface->outputTargetWidth, surface->outputTargetHeight);
+		for (UINT32 j = 0; j < n; j++) {
+			// 拡大して出力しているサーフェスは、出力先全体とみなす
+			QRect r = (surface->outputTargetWidth != surface->width || surface->outputTargetHeight != surface->height)
+					  ? extent : QRect(rects[j].left, rects[j].top, rects[j].right - rects[j].left, rects[j].bottom - rects[j].top);
+			region += r.translated((int)surface->outputOriginX, (int)surface->outputOriginY);
+		}
+	}
+	free(ids);
+	return region;
+}
+
+/**
+ * @brief RDPスレッド：表示の状態に合わせてSuppress Outputを送る
+ *
+ * 隠れている時、またはRDPGFXを使わずに表示が大きく遅れている時は画面の送信を止める。
+ * 再開する時はRefresh Rectで止めていた間の画面を送ってもらう。
+ */
+void Session::applyOutputState()
+{
+	QRect area;
+	{
+		std::lock_guard lock(m->request_mutex);
+		if (m->output_changed) {
+			m->hidden = !m->output_visible;
+			m->output_changed = false;
+		}
+		area = m->output_area;
+	}
+
+	auto *context = rdp_context();
+	if (!context || !context->update || !context->update->SuppressOutput) return;
+
+	bool behind = !client_context()->frame_acks && backlog() > (m->output_stats.suppressing ? 0 : MAX_BACKLOG_WITHOUT_ACKS);
+	bool suppress = m->hidden || behind;
+	if (behind) {
+		m->waiting_for_presenter = true;
+	}
+	if (suppress == m->output_stats.suppressing) return;
+
+	auto *settings = rdp_settings();
+	QRect desktop(0, 0, freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth), freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight));
+	area = area.isValid() ? area.intersected(desktop) : desktop;
+	RECTANGLE_16 rect;
+	rect.left = (UINT16)desktop.left();
+	rect.top = (UINT16)desktop.top();
+	rect.right = (UINT16)(desktop.left() + desktop.width() - 1); // TS_RECTANGLE16は右下を含む
+	rect.bottom = (UINT16)(desktop.top() + desktop.height() - 1);
+	if (suppress) {
+		context->update->SuppressOutput(context, FALSE, nullptr);
+		m->output_stats.suppressed++;
+	} else {
+		context->update->SuppressOutput(context, TRUE, &rect);
+		if (context->update->RefreshRect && !area.isEmpty()) {
+			rect.left = (UINT16)area.left();
+			rect.top = (UINT16)area.top();
+			rect.right = (UINT16)(area.left() + area.width() - 1);
+			rect.bottom = (UINT16)(area.top() + area.height() - 1);
+			context->update->RefreshRect(context, 1, &rect);
+			m->output_stats.refreshed++;
+		}
+	}
+	m->output_stats.suppressing = suppress;
+}
+
+/**
+ * @brief RDPスレッド：表示が追いついていれば、遅らせていたフレームの確認応答を送る
+ *
+ * サーバーは確認応答のないフレームが溜まると送信を控えるので、表示が遅れている間は
+ * 応答を遅らせてエンコードと帯域を節約する。キューの深さとして表示待ちのフレーム数を知らせる。
+ * 隠れている間は表示を待たずに応答する（画面の送信は止めている）。
+ * フレームレートを制限している間は、応答もその間隔より速くは送らない。公開を
+ * 間引くだけではサーバーは全速でエンコードと送信を続けるので、帯域が減らないため。
+ */
+void Session::flushFrameAcks()
+{
+	m->ack_deferred = false;
+	MyClientContext *ctx = client_context();
+	if (!ctx || !ctx->gfx || !ctx->frame_acks || !ctx->gfx->FrameAcknowledge) {
+		m->pending_acks.clear();
+		return;
+	}
+	while (!m->pending_acks.empty()) {
+		int fps = m->target_fps;
+		auto now = std::chrono::steady_clock::now();
+		if (fps > 0 && !m->hidden && now < m->next_ack) {
+			m->ack_deferred = true;
+			break;
+		}
+		quint64 depth = m->hidden ? 0 : backlog();
+		if (depth > MAX_BACKLOG) {
+			m->waiting_for_presenter = true;
+			// 待っている間に表示が追いついた場合に備えて、もう一度確かめる
+			if (backlog() > MAX_BACKLOG) break;
+			m->waiting_for_presenter = false;
+			continue;
+		}
+		RDPGFX_FRAME_ACKNOWLEDGE_PDU ack = {};
+		ack.frameId = m->pending_acks.front();
+		ack.totalFramesDecoded = (UINT32)m->gfx_stats.frames.load();
+		ack.queueDepth = depth > 0 ? (UINT32)depth : QUEUE_DEPTH_UNAVAILABLE;
+		ctx->gfx->FrameAcknowledge(ctx->gfx, &ack);
+		m->pending_acks.pop_front();
+		m->output_stats.acks++;
+		if (fps > 0) {
+			m->next_ack = now + std::chrono::microseconds(1000000 / fps);
+		}
+	}
+	if (!m->pending_acks.empty()) {
+		m->output_stats.delayed_acks++;
+	}
+}
+
+/**
+ * @brief 出力の数（複数モニターならモニターの数、それ以外は1）
+ */
+int Session::outputCount() const
+{
+	return (int)m->outputs.size();
+}
+
+/**
+ * @brief 出力のデスクトップ上の位置（RDP座標）
+ */
+QRect Session::outputRect(int output) const
+{
+	if (output < 0 || output >= (int)m->outputs.size()) return {};
+	QRect rect = m->outputs[output]->rect;
+	return rect.isEmpty() ? QRect(QPoint(0, 0), m->options.size) : rect;
+}
+
+/**
+ * @brief 最新のフレームを受け取る（frameReady()の受け取り側のスレッドから呼ぶ）
+ */
+bool Session::acquireFrame(FrameExchange::Frame *out, int output)
+{
+	if (output < 0 || output >= (int)m->outputs.size()) return false;
+	auto &o = *m->outputs[output];
+	o.update_requested = false;
+	return o.frames.acquire(out);
+}
+
+InputQueue *Session::inputQueue()
+{
+	return &m->input;
+}
+
+FrameExchange::Stats Session::frameStats() const
+{
+	FrameExchange::Stats stats;
+	for (auto const &output : m->outputs) {
+		FrameExchange::Stats s = output->frames.stats();
+		stats.published += s.published;
+		stats.acquired += s.acquired;
+		stats.dropped += s.dropped;
+	}
+	return stats;
+}
+
+InputQueue::Stats Session::inputStats() const
+{
+	return m->input.stats();
+}
+
+Session::LoopStats const &Session::loopStats() const
+{
+	return m->loop_stats;
+}
+
+Session::GfxStats const &Session::gfxStats() const
+{
+	return m->gfx_stats;
+}
+
+Session::CacheStats const &Session::cacheStats() const
+{
+	return m->cache_stats;
+}
+
+DamageFilter::Stats const &Session::damageStats() const
+{
+	return m->damage_filter.stats();
+}
+
+FramebufferExport::Stats const &Session::exportStats() const
+{
+	return m->frame_export.stats();
+}
+
+/**
+ * @brief 画面を公開しているソケットのパス（公開していなければ空）
+ */
+QString Session::exportServerName() const
+{
+	return m->frame_export.serverName();
+}
+
+Session::OutputStats const &Session::outputStats() const
+{
+	return m->output_stats;
+}
+
+Telemetry &Session::telemetry()
+{
+	return m->telemetry;
+}
+
+bool Session::isRecording() const
+{
+	return m->recorder.isOpen();
+}
+
+/**
+ * @brief 再生が記録時の間隔を待つか（FreeRDPが速く再生する設定を持たない場合）
+ */
+bool Session::isReplayPaced() const
+{
+	return m->replay_paced;
+}
+
+ScreenRecorder::Stats Session::recorderStats() const
+{
+	return m->recorder.stats();
+}
+
+/**
+ * @brief 受信したバイト数
+ */
+quint64 Session::receivedBytes()
+{
+	UINT64 received_bytes = 0;
+	if (rdp_context()) {
+		freerdp_get_stats(rdp_context()->rdp, &received_bytes, nullptr, nullptr, nullptr);
+	}
+	return received_bytes;
+}
+
+/**
+ * @brief RDPスレッド：要求された解像度をサーバーに通知し、GDIのバッファを作り直す
+ */
+void Session::applyRequestedSize()
+{
+	QSize size;
+	{
+		std::lock_guard lock(m->request_mutex);
+		std::swap(size, m->requested_size);
+	}
+	if (!size.isValid()) return;
+	if (m->outputs.size() > 1) return; // 複数モニターではモニターの配置を変えない
+
+	auto *settings = rdp_settings();
+	auto *disp = disp_client_context();
+	if (settings && disp && disp->DisplayControlCaps) {
+		DISPLAY_CONTROL_MONITOR_LAYOUT layout = { 0 };
+		layout.Flags = DISPLAY_CONTROL_MONITOR_PRIMARY;
+		layout.Left = 0;
+		layout.Top = 0;
+		layout.Width = size.width();
+		layout.Height = size.height();
+		layout.PhysicalWidth = size.width();
+		layout.PhysicalHeight = size.height();
+		layout.Orientation = freerdp_settings_get_uint16(settings, FreeRDP_DesktopOrientation);
+		layout.DesktopScaleFactor = freerdp_settings_get_uint32(settings, FreeRDP_DesktopScaleFactor);
+		layout.DeviceScaleFactor = freerdp_settings_get_uint32(settings, FreeRDP_DeviceScaleFactor);
+
+		disp->SendMonitorLayout(disp, 1, &layout);
+
+		freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, size.width());
+		freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, size.height());
+
+		auto gdi = rdp_gdi();
+		if (gdi) {
+			if (version() == V1) {
+				gdi_resize(gdi, size.width(), size.height());
+			} else if (version() == V2) {
+				// 確保済みのバッファを新しい大きさで使い直す（行の長さは変わらない）
+				m->screen_image = m->screen_pool.image(size, m->screen_image_foramt);
+				gdi_resize_ex(gdi, size.width(), size.height(), m->screen_image.bytesPerLine(), m->rdp_pixel_format, m->screen_image.bits(), nullptr);
+			}
+		}
+	}
+}
+
+// FreeRDPコールバック関数の実装
+BOOL Session::rdp_pre_connect(freerdp *rdp)
+{
+	auto ctx = rdp->context;
+	int r = 0;
+	r = PubSub_SubscribeChannelConnected(ctx->pubSub, channelConnected);
+	r = PubSub_SubscribeChannelDisconnected(ctx->pubSub, channelDisconnected);
+
+	// 受信と接続の各段階に掛かる時間を測るため、PDUの読み込みとTCP・TLSの接続を横取りする
+	auto *io = freerdp_get_io_callbacks(ctx);
+	if (io) {
+		rdpTransportIo hook = *io;
+		MyClientContext *cc = reinterpret_cast<MyClientContext *>(ctx);
+		cc->read_pdu = hook.ReadPdu;
+		cc->tcp_connect = hook.TCPConnect;
+		cc->tls_connect = hook.TLSConnect;
+		hook.ReadPdu = onReadPdu;
+		if (hook.TCPConnect) hook.TCPConnect = onTcpConnect;
+		if (hook.TLSConnect) hook.TLSConnect = onTlsConnect;
+		freerdp_set_io_callbacks(ctx, &hook);
+	}
+	return TRUE;
+}
+
+/**
+ * @brief 接続先のアドレス（数値）を解決する。名前解決に掛かった時間はDnsの段階として記録する
+ * @return 解決できなかった場合は空（FreeRDPに名前のまま渡す）
+ */
+static QStringList resolveHost(const char *hostname, int port)
+{
+	QStringList addresses;
+	if (!hostname || hostname[0] == '/') return addresses; // Unixドメインソケット
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *result = nullptr;
+	if (getaddrinfo(hostname, QByteArray::number(port).constData(), &hints, &result) != 0) return addresses;
+	for (addrinfo *ai = result; ai; ai = ai->ai_next) {
+		char host[NI_MAXHOST];
+		if (getnameinfo(ai->ai_addr, (socklen_t)ai->ai_addrlen, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0) {
+			QString address = QString::fromLatin1(host);
+			if (!addresses.contains(address)) {
+				addresses.push_back(address);
+			}
+		}
+	}
+	freeaddrinfo(result);
+	return addresses;
+}
+
+/**
+ * @brief TCP接続。名前解決を1回だけ行い、解決したアドレスを順にFreeRDPに渡す
+ *
+ * FreeRDPに名前を渡すとその中で解決されてTCPの時間に含まれてしまい、
+ * 解決中は中断もできないので、ここで解決してから数値のアドレスで接続する。
+ * サーバー証明書の確認はFreeRDP_ServerHostnameで行うので影響しない。
+ */
+int Session::onTcpConnect(rdpContext *context, rdpSettings *settings, const char *hostname, int port, DWORD timeout)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	Session *self = ctx->self;
+	QStringList addresses = resolveHost(hostname, port);
+	self->setPhase(ConnectTiming::Dns, QString("Connecting to %1").arg(QString::fromUtf8(hostname)));
+	if (self->m->interrupted) return -1;
+
+	int r = -1;
+	if (addresses.isEmpty()) {
+		r = ctx->tcp_connect(context, settings, hostname, port, timeout);
+	} else {
+		for (QString const &address : addresses) {
+			r = ctx->tcp_connect(context, settings, address.toLatin1().constData(), port, timeout);
+			if (r >= 0 || self->m->interrupted) break;
+		}
+	}
+	if (r >= 0) {
+		self->setPhase(ConnectTiming::Tcp, "TLS handshake");
+	}
+	return r;
+}
+
+BOOL Session::onTlsConnect(rdpTransport *transport)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(transport_get_context(transport));
+	BOOL r = ctx->tls_connect(transport);
+	if (r) {
+		ctx->self->setPhase(ConnectTiming::Tls, "Authenticating");
+	}
+	return r;
+}
+
+int Session::onReadPdu(rdpTransport *transport, wStream *s)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(transport_get_context(transport));
+	Session *self = ctx->self;
+	if (self->m->connecting && self->m->timing.end[ConnectTiming::Nla].time_since_epoch().count() == 0) {
+		// NLAが終わると（使わない場合はネゴシエーションの後）MCSの接続に進む
+		if (freerdp_get_state(&ctx->rdpcc.context) > CONNECTION_STATE_NLA) {
+			self->setPhase(ConnectTiming::Nla, "Negotiating capabilities");
+		}
+	}
+	auto t = std::chrono::steady_clock::now();
+	int r = ctx->read_pdu(transport, s);
+	if (r > 0) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t).count();
+		ctx->self->m->telemetry.record(Telemetry::Receive, us);
+	}
+	return r;
+}
+
+BOOL Session::onRdpPostConnect(freerdp *rdp)
+{
+	setPhase(ConnectTiming::Nla, {});
+	setPhase(ConnectTiming::Capabilities, "Waiting for the first frame");
+	if (version() == V1) {
+		if (!gdi_init(rdp, m->rdp_pixel_format)) {
+			return FALSE;
+		}
+	} else if (version() == V2) {
+		// 解像度を変えても確保し直さないように、最大の大きさで確保しておく
+		QSize capacity = m->options.size.expandedTo(m->options.max_size);
+		m->screen_pool.reserve(capacity, m->screen_image_foramt);
+		for (auto &output : m->outputs) {
+			output->frames.reserve(output->rect.isEmpty() ? capacity : output->rect.size(), m->screen_image_foramt);
+		}
+		m->screen_image = m->screen_pool.image(m->options.size, m->screen_image_foramt);
+		if (!gdi_init_ex(rdp, m->rdp_pixel_format, m->screen_image.bytesPerLine(), m->screen_image.bits(), nullptr)) {
+			return FALSE;
+		}
+	}
+
+	// 画面のコピーを移動として表示側に伝える
+	auto *primary = rdp->context->update->primary;
+	if (primary && primary->ScrBlt != onScrBlt) {
+		client_context()->gdi_scr_blt = primary->ScrBlt;
+		primary->ScrBlt = onScrBlt;
+	}
+
+	// ロックキーの状態は、入力を捨てて同期し直す時に使う
+	rdp->context->update->SetKeyboardIndicators = onKeyboardIndicators;
+
+	// マウスポインタは表示側でカーソルとして描く（移動のたびに画面を更新しない）
+	rdpPointer pointer = {};
+	pointer.size = sizeof(SessionPointer);
+	pointer.New = onPointerNew;
+	pointer.Free = onPointerFree;
+	pointer.Set = onPointerSet;
+	pointer.SetNull = onPointerSetNull;
+	pointer.SetDefault = onPointerSetDefault;
+	pointer.SetPosition = onPointerSetPosition;
+	graphics_register_pointer(rdp->context->graphics, &pointer);
+	return TRUE;
+}
+
+BOOL Session::rdp_post_connect(freerdp *instance)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(instance->context);
+	if (ctx && ctx->self) {
+		return ctx->self->onRdpPostConnect(instance);
+	}
+	return FALSE;
+}
+
+void Session::rdp_post_disconnect(freerdp *instance)
+{
+	gdi_free(instance);
+}
+
+BOOL Session::rdp_authenticate(freerdp *instance, char **username, char **password, char **domain)
+{
+	(void)instance;
+	(void)username;
+	(void)password;
+	(void)domain;
+	return TRUE;
+}
+
+/**
+ * @brief ポインタの画像をデコードする（キャッシュに入る時に1回だけ）
+ */
+BOOL Session::onPointerNew(rdpContext *context, rdpPointer *pointer)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	auto *p = reinterpret_cast<SessionPointer *>(pointer);
+	auto *gdi = context->gdi;
+	if (!gdi) return FALSE;
+
+	QImage image;
+	if (pointer->width > 0 && pointer->height > 0) {
+		image = QImage(pointer->width, pointer->height, QImage::Format_ARGB32);
+		if (image.isNull()) return FALSE;
+		if (!freerdp_image_copy_from_pointer_data(image.bits(), PIXEL_FORMAT_BGRA32, image.bytesPerLine(), 0, 0, pointer->width, pointer->height,
+												  pointer->xorMaskData, pointer->lengthXorMask, pointer->andMaskData, pointer->lengthAndMask,
+												  pointer->xorBpp, &gdi->palette)) {
+			return FALSE;
+		}
+	}
+	p->id = ++ctx->self->m->pointer_serial;
+	p->image = new QImage(image);
+	return TRUE;
+}
+
+void Session::onPointerFree(rdpContext *context, rdpPointer *pointer)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	auto *p = reinterpret_cast<SessionPointer *>(pointer);
+	if (!p->image) return;
+	delete p->image;
+	p->image = nullptr;
+	emit ctx->self->pointerFreed(p->id);
+}
+
+BOOL Session::onPointerSet(rdpContext *context, rdpPointer *pointer)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	auto *p = reinterpret_cast<SessionPointer *>(pointer);
+	if (!p->image) return FALSE;
+	emit ctx->self->pointerChanged(p->id, *p->image, QPoint(pointer->xPos, pointer->yPos));
+	return TRUE;
+}
+
+BOOL Session::onPointerSetNull(rdpContext *context)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	emit ctx->self->pointerHidden();
+	return TRUE;
+}
+
+BOOL Session::onPointerSetDefault(rdpContext *context)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	emit ctx->self->pointerDefault();
+	return TRUE;
+}
+
+BOOL Session::onPointerSetPosition(rdpContext *context, UINT32 x, UINT32 y)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	emit ctx->self->pointerMoved(QPoint((int)x, (int)y));
+	return TRUE;
+}
+
+BOOL Session::rdp_end_paint(rdpContext *context)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	Session *self = ctx->self;
+	auto *gdi = self->rdp_gdi();
+	if (!gdi || !gdi->primary) return FALSE;
+
+	// RDPGFXのフレーム中はサーフェスごとに呼ばれるので、EndFrameでまとめて公開する
+	if (gdi->inGfxFrame) return TRUE;
+
+	self->publishScreen();
+
+	return TRUE;
+}
+
+void Session::channelConnected(void *context, const ChannelConnectedEventArgs *e)
+{
+	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
+	} else if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0) {
+		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+		ctx->disp = reinterpret_cast<DispClientContext *>(e->pInterface);
+		ctx->disp->DisplayControlCaps = onDisplayControlCaps;
+		ctx->disp->custom = reinterpret_cast<void *>(ctx->self);
+	} else if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0) {
+		// サーフェスはGDIのプライマリバッファに合成され、無効領域としてEndPaintに届く
+		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+		ctx->gfx = reinterpret_cast<RdpgfxClientContext *>(e->pInterface);
+		gdi_graphics_pipeline_init(ctx->rdpcc.context.gdi, ctx->gfx);
+		ctx->gdi_start_frame = ctx->gfx->StartFrame;
+		ctx->gdi_surface_command = ctx->gfx->SurfaceCommand;
+		ctx->gdi_end_frame = ctx->gfx->EndFrame;
+		ctx->gfx->StartFrame = onGfxStartFrame;
+		ctx->gfx->SurfaceCommand = onGfxSurfaceCommand;
+		ctx->gfx->EndFrame = onGfxEndFrame;
+		ctx->gdi_surface_to_cache = ctx->gfx->SurfaceToCache;
+		ctx->gdi_cache_to_surface = ctx->gfx->CacheToSurface;
+		ctx->gdi_cache_import_reply = ctx->gfx->CacheImportReply;
+		ctx->gfx->SurfaceToCache = onGfxSurfaceToCache;
+		ctx->gfx->CacheToSurface = onGfxCacheToSurface;
+		ctx->gfx->CacheImportReply = onGfxCacheImportReply;
+		ctx->gdi_on_open = ctx->gfx->OnOpen;
+		ctx->gfx->OnOpen = onGfxOpen;
+		ctx->gdi_solid_fill = ctx->gfx->SolidFill;
+		ctx->gdi_surface_to_surface = ctx->gfx->SurfaceToSurface;
+		ctx->gdi_map_surface_to_output = ctx->gfx->MapSurfaceToOutput;
+		ctx->gfx->SolidFill = onGfxSolidFill;
+		ctx->gfx->SurfaceToSurface = onGfxSurfaceToSurface;
+		ctx->gfx->MapSurfaceToOutput = onGfxMapSurfaceToOutput;
+	} else {
+		freerdp_client_OnChannelConnectedEventHandler(context, e);
+	}
+}
+
+void Session::channelDisconnected(void *context, const ChannelDisconnectedEventArgs *e)
+{
+	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0) {
+	} else if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0) {
+		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+		ctx->disp->custom = nullptr;
+		ctx->disp = nullptr;
+	} else if (strcmp(e->name, RDPGFX_DVC_CHANNEL_NAME) == 0) {
+		MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+		gdi_graphics_pipeline_uninit(ctx->rdpcc.context.gdi, ctx->gfx);
+		ctx->gdi_start_frame = nullptr;
+		ctx->gdi_surface_command = nullptr;
+		ctx->gdi_end_frame = nullptr;
+		ctx->gdi_surface_to_cache = nullptr;
+		ctx->gdi_cache_to_surface = nullptr;
+		ctx->gdi_cache_import_reply = nullptr;
+		ctx->gdi_on_open = nullptr;
+		ctx->gdi_solid_fill = nullptr;
+		ctx->gdi_surface_to_surface = nullptr;
+		ctx->gdi_map_surface_to_output = nullptr;
+		ctx->frame_acks = false;
+		ctx->gfx = nullptr;
+	} else {
+		freerdp_client_OnChannelDisconnectedEventHandler(context, e);
+	}
+}
+
+static MyClientContext *gfxClientContext(RdpgfxClientContext *gfx)
+{
+	rdpGdi *gdi = reinterpret_cast<rdpGdi *>(gfx->custom);
+	return reinterpret_cast<MyClientContext *>(gdi->context);
+}
+
+UINT Session::onGfxStartFrame(RdpgfxClientContext *gfx, const RDPGFX_START_FRAME_PDU *startFrame)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	ctx->self->m->gfx_stats.frame_decode = {};
+	return ctx->gdi_start_frame ? ctx->gdi_start_frame(gfx, startFrame) : CHANNEL_RC_OK;
+}
+
+/**
+ * @brief サーフェスコマンド：デコードに掛かった時間をフレームごとに積算する
+ */
+UINT Session::onGfxSurfaceCommand(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_COMMAND *cmd)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	auto &stats = ctx->self->m->gfx_stats;
+	switch (cmd->codecId) {
+	case RDPGFX_CODECID_AVC420:
+	case RDPGFX_CODECID_AVC444:
+	case RDPGFX_CODECID_AVC444v2:
+		stats.avc_commands++;
+		break;
+	}
+	auto t = std::chrono::steady_clock::now();
+	UINT r = ctx->gdi_surface_command ? ctx->gdi_surface_command(gfx, cmd) : CHANNEL_RC_OK;
+	stats.frame_decode += std::chrono::steady_clock::now() - t;
+	ctx->self->recordDrawn(gfx, cmd->surfaceId, QRect(cmd->left, cmd->top, cmd->right - cmd->left, cmd->bottom - cmd->top));
+	return r;
+}
+
+/**
+ * @brief RDPGFXのフレームの終わり：GDIに合成させた後、まとめて画面を公開する
+ */
+UINT Session::onGfxEndFrame(RdpgfxClientContext *gfx, const RDPGFX_END_FRAME_PDU *endFrame)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Session *self = ctx->self;
+	auto &stats = self->m->gfx_stats;
+	auto t = std::chrono::steady_clock::now();
+	UINT r = ctx->gdi_end_frame ? ctx->gdi_end_frame(gfx, endFrame) : CHANNEL_RC_OK;
+	stats.frame_decode += std::chrono::steady_clock::now() - t;
+	self->m->telemetry.record(Telemetry::Decode, std::chrono::duration_cast<std::chrono::microseconds>(stats.frame_decode).count());
+	stats.frames++;
+	self->publishScreen();
+	if (ctx->frame_acks) {
+		self->m->pending_acks.push_back(endFrame->frameId);
+		self->flushFrameAcks();
+	}
+	return r;
+}
+
+/**
+ * @brief チャネルが開いた：フレームの確認応答はFreeRDPに任せず、表示の進み具合に合わせて自分で送る
+ */
+UINT Session::onGfxOpen(RdpgfxClientContext *gfx, BOOL *do_caps_advertise, BOOL *do_frame_acks)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	UINT r = ctx->gdi_on_open ? ctx->gdi_on_open(gfx, do_caps_advertise, do_frame_acks) : CHANNEL_RC_OK;
+	if (r == CHANNEL_RC_OK && do_frame_acks && *do_frame_acks) {
+		*do_frame_acks = FALSE;
+		ctx->frame_acks = true;
+	}
+	ctx->self->m->pending_acks.clear();
+	return r;
+}
+
+/**
+ * @brief サーバーが永続キャッシュのエントリを受け入れた：読み込んだスロットを覚えておく
+ */
+UINT Session::onGfxCacheImportReply(RdpgfxClientContext *gfx, const RDPGFX_CACHE_IMPORT_REPLY_PDU *cacheImportReply)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Private *m = ctx->self->m;
+	UINT r = ctx->gdi_cache_import_reply ? ctx->gdi_cache_import_reply(gfx, cacheImportReply) : CHANNEL_RC_OK;
+	for (UINT16 i = 0; i < cacheImportReply->importedEntriesCount; i++) {
+		UINT16 slot = cacheImportReply->cacheSlots[i];
+		if (slot >= m->imported_slots.size()) {
+			m->imported_slots.resize(slot + 1);
+		}
+		m->imported_slots[slot] = true;
+	}
+	m->cache_stats.imported += cacheImportReply->importedEntriesCount;
+	return r;
+}
+
+/**
+ * @brief サーバーから送られた画像をキャッシュに入れる（キャッシュミス）
+ */
+UINT Session::onGfxSurfaceToCache(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_TO_CACHE_PDU *surfaceToCache)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Private *m = ctx->self->m;
+	if (surfaceToCache->cacheSlot < m->imported_slots.size()) {
+		m->imported_slots[surfaceToCache->cacheSlot] = false;
+	}
+	m->cache_stats.misses++;
+	return ctx->gdi_surface_to_cache ? ctx->gdi_surface_to_cache(gfx, surfaceToCache) : CHANNEL_RC_OK;
+}
+
+/**
+ * @brief キャッシュから描画する（キャッシュヒット）
+ */
+UINT Session::onGfxCacheToSurface(RdpgfxClientContext *gfx, const RDPGFX_CACHE_TO_SURFACE_PDU *cacheToSurface)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Private *m = ctx->self->m;
+	UINT16 slot = cacheToSurface->cacheSlot;
+	m->cache_stats.hits += cacheToSurface->destPtsCount;
+	if (slot < m->imported_slots.size() && m->imported_slots[slot]) {
+		m->cache_stats.persistent_hits += cacheToSurface->destPtsCount;
+		auto *entry = reinterpret_cast<gdiGfxCacheEntry *>(gfx->GetCacheSlotData(gfx, slot));
+		if (entry) {
+			m->cache_stats.saved_bytes += (quint64)entry->width * entry->height * 4 * cacheToSurface->destPtsCount;
+		}
+	}
+	if (!m->moves.empty()) {
+		auto *entry = reinterpret_cast<gdiGfxCacheEntry *>(gfx->GetCacheSlotData(gfx, slot));
+		for (UINT16 i = 0; entry && i < cacheToSurface->destPtsCount; i++) {
+			RDPGFX_POINT16 const &pt = cacheToSurface->destPts[i];
+			ctx->self->recordDrawn(gfx, cacheToSurface->surfaceId, QRect(pt.x, pt.y, entry->width, entry->height));
+		}
+	}
+	return ctx->gdi_cache_to_surface ? ctx->gdi_cache_to_surface(gfx, cacheToSurface) : CHANNEL_RC_OK;
+}
+
+UINT Session::onGfxSolidFill(RdpgfxClientContext *gfx, const RDPGFX_SOLID_FILL_PDU *solidFill)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	for (UINT16 i = 0; i < solidFill->fillRectCount; i++) {
+		RECTANGLE_16 const &r = solidFill->fillRects[i];
+		ctx->self->recordDrawn(gfx, solidFill->surfaceId, QRect(r.left, r.top, r.right - r.left, r.bottom - r.top));
+	}
+	return ctx->gdi_solid_fill ? ctx->gdi_solid_fill(gfx, solidFill) : CHANNEL_RC_OK;
+}
+
+/**
+ * @brief サーフェス内のコピー：拡大せずに出力しているサーフェスの中の1か所へのコピーは移動として記録する
+ */
+UINT Session::onGfxSurfaceToSurface(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_TO_SURFACE_PDU *surfaceToSurface)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Session *self = ctx->self;
+	Private *m = self->m;
+	auto *surface = reinterpret_cast<gdiGfxSurface *>(gfx->GetSurfaceData(gfx, surfaceToSurface->surfaceIdDest));
+	RECTANGLE_16 const &rs = surfaceToSurface->rectSrc;
+	QRect src(rs.left, rs.top, rs.right - rs.left, rs.bottom - rs.top);
+	bool move = surface && surface->outputMapped && surfaceToSurface->surfaceIdSrc == surfaceToSurface->surfaceIdDest
+				&& surfaceToSurface->destPtsCount == 1
+				&& surface->outputTargetWidth == surface->width && surface->outputTargetHeight == surface->height;
+	if (move && m->moves.empty()) {
+		// 最初の移動より前の描画（前のフレームとこのフレームの分）は、移動と一緒に動く
+		QRegion before = takeInvalidRegion(self->rdp_gdi());
+		m->move_damage += before;
+		m->move_dirty += before + self->gfxPendingRegion(gfx);
+	}
+
+	UINT r = ctx->gdi_surface_to_surface ? ctx->gdi_surface_to_surface(gfx, surfaceToSurface) : CHANNEL_RC_OK;
+
+	QRect bounds = surface ? QRect(0, 0, surface->width, surface->height) : QRect();
+	for (UINT16 i = 0; i < surfaceToSurface->destPtsCount; i++) {
+		RDPGFX_POINT16 const &pt = surfaceToSurface->destPts[i];
+		QRect dst = QRect(QPoint(pt.x, pt.y), src.size()).intersected(bounds);
+		if (move) {
+			QPoint origin((int)surface->outputOriginX, (int)surface->outputOriginY);
+			self->recordMove(dst.translated(origin), dst.topLeft() - src.topLeft(), QRegion(dst.translated(origin)));
+		} else {
+			self->recordDrawn(gfx, surfaceToSurface->surfaceIdDest, dst);
+		}
+	}
+	return r;
+}
+
+/**
+ * @brief サーフェスの出力先が変わった：移動を記録していれば、画面全体を描き直させる
+ */
+UINT Session::onGfxMapSurfaceToOutput(RdpgfxClientContext *gfx, const RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU *surfaceToOutput)
+{
+	MyClientContext *ctx = gfxClientContext(gfx);
+	Private *m = ctx->self->m;
+	if (!m->moves.empty()) {
+		auto *gdi = ctx->self->rdp_gdi();
+		m->move_dirty += QRect(0, 0, gdi ? gdi->width : 0, gdi ? gdi->height : 0);
+	}
+	return ctx->gdi_map_surface_to_output ? ctx->gdi_map_surface_to_output(gfx, surfaceToOutput) : CHANNEL_RC_OK;
+}
+
+/**
+ * @brief 画面内のコピー（GDI）：移動として記録する
+ */
+BOOL Session::onKeyboardIndicators(rdpContext *context, UINT16 led_flags)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	ctx->self->m->input.setKeyboardIndicators(led_flags);
+	return TRUE;
+}
+
+BOOL Session::onScrBlt(rdpContext *context, const SCRBLT_ORDER *scrblt)
+{
+	MyClientContext *ctx = reinterpret_cast<MyClientContext *>(context);
+	Session *self = ctx->self;
+	Private *m = self->m;
+	if (!ctx->gdi_scr_blt) return FALSE;
+	auto *gdi = context->gdi;
+	if (!gdi || scrblt->bRop != 0xCC) { // SRCCOPY以外は普通の描画
+		return ctx->gdi_scr_blt(context, scrblt);
+	}
+
+	// これまでの描画は移動の前に起きた
+	QRegion before = takeInvalidRegion(gdi);
+	m->move_damage += before;
+	m->move_dirty += before;
+	BOOL r = ctx->gdi_scr_blt(context, scrblt);
+	QRegion written = takeInvalidRegion(gdi);
+	m->move_damage += written;
+
+	QRect dst(scrblt->nLeftRect, scrblt->nTopRect, scrblt->nWidth, scrblt->nHeight);
+	self->recordMove(dst, QPoint(dst.x() - (int)scrblt->nXSrc, dst.y() - (int)scrblt->nYSrc), written);
+	return r;
+}
+
+UINT Session::onDisplayControlCaps(DispClientContext *disp, UINT32 maxNumMonitors, UINT32 maxMonitorAreaFactorA, UINT32 maxMonitorAreaFactorB)
+{
+	return CHANNEL_RC_OK;
+}
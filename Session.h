@@ -0,0 +1,249 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "DamageFilter.h"
+#include "FrameExchange.h"
+#include "FramebufferExport.h"
+#include "FramebufferPool.h"
+#include "Histogram.h"
+#include "InputQueue.h"
+#include "ScreenRecorder.h"
+#include "Telemetry.h"
+#include <QImage>
+#include <QObject>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <freerdp/freerdp.h>
+#include <freerdp/client/disp.h>
+#include <freerdp/client/rdpgfx.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/graphics.h>
+#include <freerdp/transport_io.h>
+
+class Session;
+
+struct MyClientContext {
+	rdpClientContext rdpcc;
+	Session *self = nullptr;
+	DispClientContext *disp = nullptr;
+	RdpgfxClientContext *gfx = nullptr;
+	// GDIが設定したコールバック
+	pcRdpgfxStartFrame gdi_start_frame = nullptr;
+	pcRdpgfxSurfaceCommand gdi_surface_command = nullptr;
+	pcRdpgfxEndFrame gdi_end_frame = nullptr;
+	pcRdpgfxSurfaceToCache gdi_surface_to_cache = nullptr;
+	pcRdpgfxCacheToSurface gdi_cache_to_surface = nullptr;
+	pcRdpgfxCacheImportReply gdi_cache_import_reply = nullptr;
+	pcRdpgfxOnOpen gdi_on_open = nullptr;
+	pcRdpgfxSolidFill gdi_solid_fill = nullptr;
+	pcRdpgfxSurfaceToSurface gdi_surface_to_surface = nullptr;
+	pcRdpgfxMapSurfaceToOutput gdi_map_surface_to_output = nullptr;
+	pScrBlt gdi_scr_blt = nullptr;
+	bool frame_acks = false; // FreeRDPの代わりにフレームの確認応答を送る
+	pTransportRWFkt read_pdu = nullptr; // 元のPDU読み込み関数
+	pTCPConnect tcp_connect = nullptr; // 元のTCP接続関数
+	pTransportFkt tls_connect = nullptr; // 元のTLS接続関数
+};
+
+/**
+ * @brief 1つのRDP接続
+ *
+ * FreeRDPのコンテキスト、RDPスレッド、フレームバッファ、入力キューを持つ。
+ * ウィンドウとは独立しているので、GUIなしでも使える（再生ベンチマーク等）。
+ * 新しいフレームが公開されるとframeReady()を送出する。受け取った側が
+ * acquireFrame()を呼ぶまで、次のframeReady()は送出しない。
+ * 複数モニターで接続した場合は、モニターごとに画面を切り出して別々に公開する
+ * （出力）。変化した領域に重なる出力だけに公開する。
+ * 画面のコピー（ScrBlt、RDPGFXのSurfaceToSurface）は移動として公開する
+ * （FrameExchange::Frame::moves）。
+ * マウスポインタは画面に描かず、ポインタの更新をpointerChanged()等で通知する。
+ */
+class Session : public QObject {
+	Q_OBJECT
+public:
+	enum Version {
+		V1,
+		V2,
+	};
+	struct Options {
+		QString hostname;
+		QString username;
+		QString password;
+		QString domain;
+		QSize size { 1920, 1080 };
+		QSize max_size; // フレームバッファを確保する大きさ（これ以下の解像度の変更では確保し直さない）
+		QString record_file; // 受信したPDUを記録するファイル
+		QString replay_file; // 記録したPDUを再生するファイル（サーバーには接続しない）
+		QString video_file; // 画面を録画するファイル
+		QString bitmap_cache_file; // 永続ビットマップキャッシュのファイル（空なら使わない）
+		int quality = -1; // QualityController::Level（-1なら設定ファイルのDecoderグループに従う）
+		QImage::Format pixel_format = QImage::Format_RGBX8888; // フレームバッファの形式（表示先と同じにすると描画時に変換しない）
+		QVector<QRect> monitors; // モニターの配置（先頭がプライマリで左上が(0,0)。2つ以上なら複数モニターで接続する）
+		QString export_name; // 画面を他のプロセスに公開するローカルソケットの名前（空なら公開しない）
+	};
+	struct LoopStats {
+		std::atomic<quint64> iterations { 0 };
+		std::atomic<quint64> network { 0 }; // ソケット等のイベントで起きた回数
+		std::atomic<quint64> wakeup { 0 };  // wakeup_eventで起きた回数
+	};
+	struct GfxStats {
+		std::atomic<quint64> frames { 0 }; // デコードしたRDPGFXのフレーム数
+		std::atomic<quint64> avc_commands { 0 }; // H.264（AVC420/AVC444）のサーフェスコマンド数
+		std::chrono::steady_clock::duration frame_decode {}; // RDPスレッド専用：フレーム内の累計
+	};
+	struct OutputStats {
+		std::atomic<quint64> acks { 0 }; // 送ったフレームの確認応答
+		std::atomic<quint64> delayed_acks { 0 }; // 表示が追いつくまで遅らせた確認応答
+		std::atomic<quint64> suppressed { 0 }; // Suppress Outputで画面の送信を止めた回数
+		std::atomic<quint64> refreshed { 0 }; // 再開時にRefresh Rectを送った回数
+		std::atomic<bool> suppressing { false }; // 今止めているか
+	};
+	struct ConnectTiming {
+		enum Phase {
+			Dns,
+			Tcp,
+			Tls,
+			Nla,
+			Capabilities, // MCS、ライセンス、能力交換（PostConnectまで）
+			FirstFrame,
+			PhaseCount,
+		};
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end[PhaseCount]; // 各段階が終わった時刻（終わっていなければ0）
+		static char const *phaseName(Phase phase);
+		qint64 duration(Phase phase) const;
+		qint64 total() const;
+	};
+	static constexpr quint64 MAX_BACKLOG = 3; // 表示されていないフレームがこれを超えたら確認応答を遅らせる
+	static constexpr quint64 MAX_BACKLOG_WITHOUT_ACKS = 12; // RDPGFXを使わない場合、これを超えたら画面の送信を止める
+	struct CacheStats {
+		std::atomic<quint64> imported { 0 }; // 永続キャッシュからサーバーに受け入れられたエントリ数
+		std::atomic<quint64> hits { 0 }; // キャッシュから描画した回数（CacheToSurfaceの描画先の数）
+		std::atomic<quint64> misses { 0 }; // サーバーから送られてキャッシュに入った数（SurfaceToCache）
+		std::atomic<quint64> persistent_hits { 0 }; // hitsのうち永続キャッシュから読み込んだエントリの分
+		std::atomic<quint64> saved_bytes { 0 }; // persistent_hitsの画素のバイト数（再送されずに済んだ分）
+	};
+private:
+	struct Private;
+	struct Private *m;
+
+	// FreeRDPコールバック関数
+	static BOOL rdp_pre_connect(freerdp *instance);
+	static BOOL rdp_post_connect(freerdp *instance);
+	static void rdp_post_disconnect(freerdp *instance);
+	static BOOL rdp_authenticate(freerdp *instance, char **username, char **password, char **domain);
+	static BOOL rdp_end_paint(rdpContext *context);
+	static int onReadPdu(rdpTransport *transport, wStream *s);
+	static int onTcpConnect(rdpContext *context, rdpSettings *settings, const char *hostname, int port, DWORD timeout);
+	static BOOL onTlsConnect(rdpTransport *transport);
+	static void channelConnected(void *context, const ChannelConnectedEventArgs *e);
+	static void channelDisconnected(void *context, const ChannelDisconnectedEventArgs *e);
+	static UINT onGfxStartFrame(RdpgfxClientContext *gfx, const RDPGFX_START_FRAME_PDU *startFrame);
+	static UINT onGfxSurfaceCommand(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_COMMAND *cmd);
+	static UINT onGfxEndFrame(RdpgfxClientContext *gfx, const RDPGFX_END_FRAME_PDU *endFrame);
+	static UINT onGfxSurfaceToCache(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_TO_CACHE_PDU *surfaceToCache);
+	static UINT onGfxCacheToSurface(RdpgfxClientContext *gfx, const RDPGFX_CACHE_TO_SURFACE_PDU *cacheToSurface);
+	static UINT onGfxCacheImportReply(RdpgfxClientContext *gfx, const RDPGFX_CACHE_IMPORT_REPLY_PDU *cacheImportReply);
+	static UINT onGfxOpen(RdpgfxClientContext *gfx, BOOL *do_caps_advertise, BOOL *do_frame_acks);
+	static UINT onGfxSolidFill(RdpgfxClientContext *gfx, const RDPGFX_SOLID_FILL_PDU *solidFill);
+	static UINT onGfxSurfaceToSurface(RdpgfxClientContext *gfx, const RDPGFX_SURFACE_TO_SURFACE_PDU *surfaceToSurface);
+	static UINT onGfxMapSurfaceToOutput(RdpgfxClientContext *gfx, const RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU *surfaceToOutput);
+	static BOOL onScrBlt(rdpContext *context, const SCRBLT_ORDER *scrblt);
+	static BOOL onKeyboardIndicators(rdpContext *context, UINT16 led_flags);
+	static BOOL onPointerNew(rdpContext *context, rdpPointer *pointer);
+	static void onPointerFree(rdpContext *context, rdpPointer *pointer);
+	static BOOL onPointerSet(rdpContext *context, rdpPointer *pointer);
+	static BOOL onPointerSetNull(rdpContext *context);
+	static BOOL onPointerSetDefault(rdpContext *context);
+	static BOOL onPointerSetPosition(rdpContext *context, UINT32 x, UINT32 y);
+	static UINT onDisplayControlCaps(DispClientContext *disp, UINT32 maxNumMonitors, UINT32 maxMonitorAreaFactorA, UINT32 maxMonitorAreaFactorB);
+
+	void context_new();
+	void context_free();
+	bool prepare(Options const &options);
+	bool establish();
+	void run();
+	void teardown();
+	void setPhase(ConnectTiming::Phase phase, QString const &next);
+	BOOL onRdpPostConnect(freerdp *instance);
+	void applySettings(rdpSettings *settings);
+	void applyRequestedSize();
+	void applyOutputState();
+	void flushFrameAcks();
+	quint64 backlog() const;
+	void publishScreen();
+	void exportScreen(QSize size, const QRegion &damage);
+	void recordMove(const QRect &dst, const QPoint &delta, const QRegion &written);
+	void recordDrawn(RdpgfxClientContext *gfx, UINT16 surface_id, const QRect &rect);
+	QRegion gfxPendingRegion(RdpgfxClientContext *gfx);
+public:
+	Session(QObject *parent = nullptr);
+	~Session();
+
+	Version version() const;
+	freerdp *rdp_instance();
+	rdpContext *rdp_context();
+	MyClientContext *client_context();
+	rdpSettings *rdp_settings();
+	rdpGdi *rdp_gdi();
+	DispClientContext *disp_client_context();
+
+	bool connectToHost(Options const &options);
+	void connectAsync(Options const &options);
+	void disconnectFromHost();
+	void disconnectAsync();
+	bool isConnected() const;
+	bool isConnecting() const;
+	bool isRunning() const;
+	QString errorString() const;
+	ConnectTiming const &connectTiming() const;
+	Options const &options() const;
+
+	void start();
+	bool processEvents();
+	DWORD eventHandles(HANDLE *handles, DWORD count);
+	bool poll();
+	void wake();
+	void requestSize(const QSize &size);
+	void setTargetFrameRate(int fps);
+	int targetFrameRate() const;
+	void setOutputVisible(bool visible, const QRect &area);
+	void framePresented(quint64 sequence, int output = 0);
+
+	int outputCount() const;
+	QRect outputRect(int output) const;
+	bool acquireFrame(FrameExchange::Frame *out, int output = 0);
+	InputQueue *inputQueue();
+	FrameExchange::Stats frameStats() const;
+	InputQueue::Stats inputStats() const;
+	LoopStats const &loopStats() const;
+	GfxStats const &gfxStats() const;
+	CacheStats const &cacheStats() const;
+	DamageFilter::Stats const &damageStats() const;
+	FramebufferExport::Stats const &exportStats() const;
+	QString exportServerName() const;
+	OutputStats const &outputStats() const;
+	Telemetry &telemetry();
+	bool isRecording() const;
+	bool isReplayPaced() const;
+	ScreenRecorder::Stats recorderStats() const;
+	quint64 receivedBytes();
+signals:
+	void frameReady(int output);
+	void connectProgress(QString const &text); // 接続中の段階が変わった（RDPスレッドから送出）
+	void connectFinished(bool ok); // connectAsync()の結果（RDPスレッドから送出）
+	void disconnected(); // RDPスレッドが終わった（RDPスレッドから送出）
+	// マウスポインタ（RDPスレッドから送出）。idはポインタごとに一意で、画像はその間変わらない
+	void pointerChanged(quint64 id, QImage const &image, QPoint const &hotspot);
+	void pointerFreed(quint64 id);
+	void pointerHidden();
+	void pointerDefault();
+	void pointerMoved(QPoint const &pos); // サーバーがポインタを動かした（RDP座標）
+};
+
+#endif // SESSION_H
@@ -0,0 +1,757 @@
+#include "SessionWidget.h"
+#include "MySettings.h"
+#include "MyView.h"
+#include "PersistentCache.h"
+#include <QDateTime>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QScreen>
+#include <QUrl>
+#include <QVBoxLayout>
+#include <QWindow>
+
+SessionWidget::SessionWidget(QWidget *parent)
+	: QWidget(parent)
+{
+	view_ = new MyView(this);
+	view_->setTelemetry(&session_.telemetry());
+	auto *layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+	layout->addWidget(view_);
+	setFocusProxy(view_);
+
+	connect(&session_, &Session::frameReady, this, &SessionWidget::updateScreen);
+	connect(view_, &MyView::presented, this, [this](){
+		if (!acquired_sequences_.empty()) {
+			session_.framePresented(acquired_sequences_[0]);
+		}
+	});
+	connect(&session_, &Session::connectProgress, this, &SessionWidget::progress);
+	connect(&session_, &Session::connectFinished, this, &SessionWidget::onConnectFinished);
+	connect(&session_, &Session::disconnected, this, &SessionWidget::onDisconnected);
+
+	// マウスポインタはすべてのビューで同じものを使う
+	connect(&session_, &Session::pointerChanged, this, [this](quint64 id, const QImage &image, const QPoint &hotspot){
+		for (MyView *view : views()) {
+			view->setPointer(id, image, hotspot);
+		}
+	});
+	connect(&session_, &Session::pointerFreed, this, [this](quint64 id){
+		for (MyView *view : views()) {
+			view->freePointer(id);
+		}
+	});
+	connect(&session_, &Session::pointerHidden, this, [this](){
+		for (MyView *view : views()) {
+			view->setPointerHidden();
+		}
+	});
+	connect(&session_, &Session::pointerDefault, this, [this](){
+		for (MyView *view : views()) {
+			view->setPointerDefault();
+		}
+	});
+	connect(&session_, &Session::pointerMoved, this, [this](const QPoint &pos){
+		for (MyView *view : views()) {
+			if (view->warpPointer(pos)) break;
+		}
+	});
+}
+
+SessionWidget::~SessionWidget()
+{
+	disconnectFromHost();
+	deleteMonitorViews();
+}
+
+/**
+ * @brief 画面の物理ピクセル単位の位置と大きさ
+ */
+static QRect deviceGeometry(QScreen *screen)
+{
+	QRect g = screen->geometry();
+	qreal dpr = screen->devicePixelRatio();
+	return QRect(QPoint(qRound(g.x() * dpr), qRound(g.y() * dpr)), g.size() * dpr);
+}
+
+MyView *SessionWidget::view()
+{
+	return view_;
+}
+
+Session *SessionWidget::session()
+{
+	return &session_;
+}
+
+QString SessionWidget::hostname() const
+{
+	return session_.options().hostname;
+}
+
+bool SessionWidget::isConnected() const
+{
+	return session_.isConnected();
+}
+
+bool SessionWidget::isConnecting() const
+{
+	return session_.isConnecting();
+}
+
+QSize SessionWidget::newSize() const
+{
+	double scale = view_->scale();
+	int w = (int)(view_->width() / scale);
+	int h = (int)(view_->height() / scale);
+	w = std::clamp(w, DISPLAY_CONTROL_MIN_MONITOR_WIDTH, DISPLAY_CONTROL_MAX_MONITOR_WIDTH);
+	h = std::clamp(h, DISPLAY_CONTROL_MIN_MONITOR_HEIGHT, DISPLAY_CONTROL_MAX_MONITOR_HEIGHT);
+	return {w, h};
+}
+
+/**
+ * @brief 出力を表示するビュー（複数モニターならモニターのウィンドウ、それ以外はタブのビュー）
+ */
+MyView *SessionWidget::outputView(int output) const
+{
+	if (!monitor_views_.empty()) {
+		return output >= 0 && output < (int)monitor_views_.size() ? monitor_views_[output] : nullptr;
+	}
+	return output == 0 ? view_ : nullptr;
+}
+
+/**
+ * @brief タブのビューと、複数モニターのウィンドウのビュー
+ */
+std::vector<MyView *> SessionWidget::views() const
+{
+	std::vector<MyView *> views { view_ };
+	views.insert(views.end(), monitor_views_.begin(), monitor_views_.end());
+	return views;
+}
+
+/**
+ * @brief すべてのビューの描画の統計の合計
+ */
+MyView::PresentStats SessionWidget::presentStats() const
+{
+	MyView::PresentStats stats = view_->presentStats();
+	for (MyView *view : monitor_views_) {
+		auto const &s = view->presentStats();
+		stats.frames += s.frames;
+		stats.damaged_pixels += s.damaged_pixels;
+		stats.presented_pixels += s.presented_pixels;
+		stats.moved_pixels += s.moved_pixels;
+		stats.converted_pixels += s.converted_pixels;
+	}
+	return stats;
+}
+
+/**
+ * @brief モニターごとにフルスクリーンのウィンドウを作る（接続できたら表示する）
+ * @param screens 先頭がプライマリモニター。Session::Options::monitorsと同じ順
+ */
+void SessionWidget::createMonitorViews(QList<QScreen *> const &screens)
+{
+	deleteMonitorViews();
+	for (int i = 0; i < screens.size(); i++) {
+		auto *view = new MyView;
+		view->setWindowFlags(Qt::Window | Qt::FramelessWindowHint);
+		view->setWindowTitle(QString("%1 - Monitor %2").arg(hostname()).arg(i + 1));
+		view->setTelemetry(&session_.telemetry());
+		view->setFitToWindow(true);
+		view->setGeometry(screens[i]->geometry());
+		view->winId(); // ウィンドウを作って画面を決める
+		view->windowHandle()->setScreen(screens[i]);
+		connect(view, &MyView::presented, this, [this, i](){
+			if (i < (int)acquired_sequences_.size()) {
+				session_.framePresented(acquired_sequences_[i], i);
+			}
+		});
+		monitor_views_.push_back(view);
+	}
+}
+
+void SessionWidget::deleteMonitorViews()
+{
+	for (MyView *view : monitor_views_) {
+		delete view;
+	}
+	monitor_views_.clear();
+}
+
+bool SessionWidget::isMultiMonitor() const
+{
+	return multi_monitor_;
+}
+
+/**
+ * @brief 次の接続を複数モニターで行うかを設定する（モニターが1つなら通常の接続になる）
+ */
+void SessionWidget::setMultiMonitor(bool enabled)
+{
+	multi_monitor_ = enabled;
+}
+
+/**
+ * @brief 複数モニターで接続していて、モニターごとのウィンドウがあるか
+ */
+bool SessionWidget::hasMonitorWindows() const
+{
+	return !monitor_views_.empty();
+}
+
+bool SessionWidget::isMonitorWindowsVisible() const
+{
+	for (MyView *view : monitor_views_) {
+		if (view->isVisible()) return true;
+	}
+	return false;
+}
+
+/**
+ * @brief モニターごとのウィンドウを表示する、または隠す（隠している間は画面の送信を止める）
+ */
+void SessionWidget::setMonitorWindowsVisible(bool visible)
+{
+	for (MyView *view : monitor_views_) {
+		if (visible) {
+			view->showFullScreen();
+		} else {
+			view->hide();
+		}
+	}
+	if (visible && !monitor_views_.empty()) {
+		monitor_views_.front()->activateWindow();
+		monitor_views_.front()->setFocus();
+	}
+}
+
+/**
+ * @brief windowがモニターごとのウィンドウならそのビューを返す
+ */
+MyView *SessionWidget::monitorView(QObject *window) const
+{
+	for (MyView *view : monitor_views_) {
+		if (view->windowHandle() == window) return view;
+	}
+	return nullptr;
+}
+
+/**
+ * @brief 接続を始める（すぐに戻る）。結果はconnected()で通知する
+ *
+ * options.sizeは動的解像度が有効な場合はビューの大きさで上書きする。
+ * 複数モニターが有効でモニターが2つ以上ある場合は、options.monitorsに
+ * モニターの配置を入れ、デスクトップ全体の大きさで接続する。
+ */
+void SessionWidget::connectToHost(Session::Options options)
+{
+	// 動的解像度が有効な場合は、現在のビューサイズに合わせる
+	if (dynamic_resolution_) {
+		size_ = newSize();
+	} else {
+		size_ = options.size;
+	}
+	options.size = size_;
+
+	// フレームバッファを描画先と同じ形式にして、描画のたびに変換しないようにする
+	options.pixel_format = MyView::frameFormat(view_->nativeFormat());
+
+	// 複数モニター。プライマリを先頭にして、その左上を(0,0)とする
+	options.monitors.clear();
+	deleteMonitorViews();
+	QList<QScreen *> screens = QGuiApplication::screens();
+	if (multi_monitor_ && screens.size() > 1) {
+		QScreen *primary = QGuiApplication::primaryScreen();
+		screens.removeOne(primary);
+		screens.prepend(primary);
+		QPoint origin = deviceGeometry(primary).topLeft();
+		QRect desktop;
+		for (QScreen *screen : screens) {
+			QRect r = deviceGeometry(screen).translated(-origin);
+			options.monitors.append(r);
+			desktop |= r;
+		}
+		size_ = desktop.size();
+		createMonitorViews(screens);
+	}
+
+	// フレームバッファは最も大きいモニターの大きさで確保し、解像度の変更で確保し直さない
+	for (QScreen *screen : QGuiApplication::screens()) {
+		QSize s = screen->size() * screen->devicePixelRatio();
+		options.max_size = options.max_size.expandedTo(s);
+	}
+
+	last_iterations_ = 0;
+	last_input_stats_ = {};
+	last_presented_frames_ = presentStats().frames;
+	last_received_bytes_ = 0;
+	telemetry_counter_ = 0;
+	last_decode_us_ = 0;
+	last_dropped_frames_ = 0;
+	acquired_sequences_.assign(std::max<int>(options.monitors.size(), 1), 0);
+	timing_logged_ = false;
+
+	{
+		// 画質の自動調整。前回この接続先で決めた段階から始める
+		MySettings settings;
+		settings.beginGroup("Quality");
+		adaptive_quality_ = settings.value("Adaptive", true).toBool();
+		auto min = QualityController::Level(std::clamp(settings.value("MinLevel", QualityController::Low).toInt(), 0, 2));
+		auto max = QualityController::Level(std::clamp(settings.value("MaxLevel", QualityController::High).toInt(), 0, 2));
+		QString key = "Level_" + QString::fromLatin1(QUrl::toPercentEncoding(options.hostname));
+		auto level = QualityController::Level(std::clamp(settings.value(key, max).toInt(), 0, 2));
+		settings.endGroup();
+		if (adaptive_quality_) {
+			quality_.reset(options.hostname, level, min, max);
+			options.quality = quality_.level();
+		}
+	}
+
+	if (!options.bitmap_cache_file.isEmpty()) {
+		PersistentCache::touch(options.bitmap_cache_file);
+	}
+
+	session_.connectAsync(options);
+}
+
+void SessionWidget::onConnectFinished(bool ok)
+{
+	if (ok) {
+		view_->setInputQueue(session_.inputQueue());
+		for (int i = 0; i < (int)monitor_views_.size(); i++) {
+			monitor_views_[i]->setOrigin(session_.outputRect(i).topLeft());
+			monitor_views_[i]->setInputQueue(session_.inputQueue());
+		}
+		setMonitorWindowsVisible(true);
+		if (dynamic_resolution_ && !hasMonitorWindows()) {
+			resizeDynamicLater();
+		}
+		emit connected(true, {});
+	} else {
+		deleteMonitorViews();
+		logConnectTiming(false);
+		emit connected(false, session_.errorString());
+	}
+}
+
+/**
+ * @brief RDPスレッドが切断を終えた
+ */
+void SessionWidget::onDisconnected()
+{
+	view_->setInputQueue(nullptr);
+	view_->setStretched(false);
+	view_->clearPointers();
+	deleteMonitorViews();
+
+	// 切断時にFreeRDPがキャッシュを書き出すので、その後で上限を超えた分を消す
+	if (!session_.options().bitmap_cache_file.isEmpty()) {
+		PersistentCache::trim(session_.options().bitmap_cache_file);
+	}
+
+	QImage image(size_.width(), size_.height(), session_.options().pixel_format);
+	image.fill(Qt::black);
+	view_->setImage(image, QRegion{});
+	status_text_.clear();
+	emit disconnected();
+}
+
+/**
+ * @brief 切断する（RDPスレッドが終わるまで戻らない）
+ */
+void SessionWidget::disconnectFromHost()
+{
+	view_->setInputQueue(nullptr);
+	bool running = session_.isRunning() || session_.isConnected();
+	session_.disconnectFromHost();
+	deleteMonitorViews();
+
+	if (running && !session_.options().bitmap_cache_file.isEmpty()) {
+		PersistentCache::trim(session_.options().bitmap_cache_file);
+	}
+	status_text_.clear();
+}
+
+/**
+ * @brief 接続中なら中止し、切断を始める。RDPスレッドが終わったら自身を削除する
+ */
+void SessionWidget::closeLater()
+{
+	view_->setInputQueue(nullptr);
+	deleteMonitorViews();
+	connect(&session_, &Session::disconnected, this, &QObject::deleteLater);
+	session_.disconnectAsync();
+	if (!session_.isRunning()) {
+		deleteLater();
+	}
+}
+
+/**
+ * @brief 接続の段階ごとの時間をログと統計ファイルに書く
+ */
+void SessionWidget::logConnectTiming(bool ok)
+{
+	if (timing_logged_) return;
+	timing_logged_ = true;
+
+	auto const &timing = session_.connectTiming();
+	QStringList phases;
+	QJsonObject json;
+	json["time"] = QDateTime::currentDateTime().toString(Qt::ISODateWithMs);
+	json["host"] = hostname();
+	json["event"] = ok ? "connect" : "connect_failed";
+	for (int i = 0; i < Session::ConnectTiming::PhaseCount; i++) {
+		auto phase = Session::ConnectTiming::Phase(i);
+		qint64 ms = timing.duration(phase);
+		if (ms < 0) continue;
+		phases.append(QString("%1 %2 ms").arg(Session::ConnectTiming::phaseName(phase)).arg(ms));
+		json[QString("%1_ms").arg(Session::ConnectTiming::phaseName(phase))] = ms;
+	}
+	json["total_ms"] = timing.total();
+	if (!ok) {
+		json["error"] = session_.errorString();
+	}
+	qInfo().noquote() << QString("connect %1 %2: %3, total %4 ms")
+						 .arg(hostname()).arg(ok ? "ok" : "failed (" + session_.errorString() + ")")
+						 .arg(phases.join(", ")).arg(timing.total());
+	appendTelemetry(json);
+}
+
+void SessionWidget::appendTelemetry(const QJsonObject &json)
+{
+	if (telemetry_file_.isEmpty()) return;
+	QFile file(telemetry_file_);
+	if (file.open(QFile::WriteOnly | QFile::Append)) {
+		file.write(QJsonDocument(json).toJson(QJsonDocument::Compact) + '\n');
+	}
+}
+
+void SessionWidget::setTelemetryFile(const QString &file, int interval)
+{
+	telemetry_file_ = file;
+	telemetry_interval_ = std::max(interval, 1);
+}
+
+/**
+ * @brief 出力の新しいフレームを受け取り、その出力のビューに渡す
+ */
+void SessionWidget::updateScreen(int output)
+{
+	FrameExchange::Frame frame;
+	if (!session_.acquireFrame(&frame, output)) return;
+
+	if (!session_.isConnected()) return;
+	MyView *view = outputView(output);
+	if (!view || output >= (int)acquired_sequences_.size()) return;
+
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - frame.published).count();
+	session_.telemetry().record(Telemetry::Handoff, us);
+	acquired_sequences_[output] = frame.sequence;
+	view->setImage(frame);
+	if (view != view_ && !isMonitorViewExposed(view)) {
+		// 描画されないモニターの出力は受け取った時点で表示したことにする。
+		// そうしないとその出力の遅れが増え続け、見えているモニターも含めて確認応答が止まる
+		session_.framePresented(frame.sequence, output);
+	}
+	if (view == view_ && view_->isStretched() && frame.image.size() == size_) {
+		// 新しい解像度のフレームが届いた
+		view_->setStretched(false);
+	}
+
+	if (!timing_logged_ && session_.connectTiming().end[Session::ConnectTiming::FirstFrame].time_since_epoch().count() != 0) {
+		logConnectTiming(true);
+	}
+}
+
+bool SessionWidget::isDynamicResolution() const
+{
+	return dynamic_resolution_;
+}
+
+void SessionWidget::setDynamicResolution(bool enabled)
+{
+	dynamic_resolution_ = enabled;
+	if (enabled) {
+		resizeDynamicLater();
+	} else {
+		view_->setStretched(false);
+	}
+}
+
+/**
+ * @brief 少し待ってから解像度を変更する
+ *
+ * 待つ時間はresizeEvent()の間隔に合わせる。ウィンドウの端を速く動かしている時は
+ * 短く、ゆっくり動かしている時は長く待ち、最大化のような1回きりの変更はすぐに行う。
+ */
+void SessionWidget::resizeDynamicLater()
+{
+	if (!dynamic_resolution_) {
+		dynamic_resize_counter_ = 0;
+		return;
+	}
+	int ms = std::clamp((int)(resize_interval_ * 3), MIN_RESIZE_DELAY, MAX_RESIZE_DELAY);
+	dynamic_resize_counter_ = ms / 10;
+}
+
+void SessionWidget::resizeDynamic()
+{
+	if (!session_.isConnected()) return;
+	if (dynamic_resolution_) {
+		auto size = newSize();
+		if (size != size_) {
+			size_ = size;
+			session_.requestSize(size);
+			return; // 新しい大きさのフレームが届くまで引き伸ばして表示する
+		}
+	}
+	view_->setStretched(false);
+	view_->layoutView();
+}
+
+void SessionWidget::resizeEvent(QResizeEvent *event)
+{
+	QWidget::resizeEvent(event);
+
+	// リサイズの速さを測る。1秒以上空いたら新しいリサイズとみなす
+	qint64 dt = resize_clock_.isValid() ? resize_clock_.restart() : -1;
+	if (!resize_clock_.isValid()) {
+		resize_clock_.start();
+	}
+	if (dt < 0 || dt > 1000) {
+		resize_interval_ = 0;
+	} else {
+		resize_interval_ = resize_interval_ > 0 ? resize_interval_ * 0.7 + dt * 0.3 : dt;
+	}
+
+	if (dynamic_resolution_ && session_.isConnected() && !hasMonitorWindows()) {
+		// 解像度の変更を待つ間は、最後のフレームを引き伸ばして表示する
+		view_->setStretched(true);
+	} else {
+		view_->layoutView();
+	}
+	resizeDynamicLater();
+}
+
+/**
+ * @brief モニターのウィンドウが描画されるか（隠れている、最小化、別の仮想デスクトップならfalse）
+ */
+static bool isMonitorViewExposed(MyView *view)
+{
+	QWindow *handle = view->windowHandle();
+	return view->isVisible() && !view->isMinimized() && (!handle || handle->isExposed());
+}
+
+/**
+ * @brief 画面が見えているか（別のタブ、最小化、他のウィンドウに完全に隠れている場合はfalse）
+ *
+ * 複数モニターの場合は、モニターのウィンドウのどれかが見えていればtrue。
+ */
+bool SessionWidget::isOutputVisible() const
+{
+	if (!monitor_views_.empty()) {
+		for (MyView *view : monitor_views_) {
+			if (isMonitorViewExposed(view)) return true;
+		}
+		return false;
+	}
+	if (!isVisible()) return false;
+	QWidget *w = window();
+	if (w->isMinimized()) return false;
+	QWindow *handle = w->windowHandle();
+	return !handle || handle->isExposed();
+}
+
+/**
+ * @brief 約10ミリ秒ごとに呼ばれる
+ */
+void SessionWidget::tick()
+{
+	if (!session_.isConnected()) return;
+
+	// 表示範囲を動かせる場合は、再開時に画面全体を送り直してもらう
+	session_.setOutputVisible(isOutputVisible(), monitor_views_.empty() && !view_->isPannable() ? view_->visibleRect() : QRect());
+	// 受け取った後で隠れたモニターのフレームは描画されないので、ここで表示したことにする
+	for (int i = 0; i < (int)monitor_views_.size() && i < (int)acquired_sequences_.size(); i++) {
+		if (!isMonitorViewExposed(monitor_views_[i])) {
+			session_.framePresented(acquired_sequences_[i], i);
+		}
+	}
+
+	if (dynamic_resize_counter_ > 0) {
+		dynamic_resize_counter_--;
+		if (dynamic_resize_counter_ == 0) {
+			resizeDynamic();
+		}
+	}
+}
+
+QString SessionWidget::statusText() const
+{
+	return status_text_;
+}
+
+/**
+ * @brief 計測値を画質の制御に渡し、段階が変わったらフレームレートを変えて次の接続のために保存する
+ * @param dropped この1秒間に表示されずに捨てられたフレーム数
+ */
+void SessionWidget::updateQuality(quint64 dropped)
+{
+	if (!adaptive_quality_) return;
+
+	Telemetry &telemetry = session_.telemetry();
+	Histogram const &decode = telemetry.histogram(Telemetry::Decode);
+	double decode_us = decode.mean() * decode.count();
+
+	QualityController::Sample sample;
+	sample.rtt = telemetry.rtt();
+	sample.bandwidth = telemetry.bandwidth();
+	sample.decode_load = (decode_us - last_decode_us_) / 1000000.0;
+	sample.dropped = dropped;
+	last_decode_us_ = decode_us;
+
+	if (!quality_.update(sample)) return;
+
+	auto level = quality_.level();
+	session_.setTargetFrameRate(QualityController::profile(level).fps);
+
+	MySettings settings;
+	settings.beginGroup("Quality");
+	settings.setValue("Level_" + QString::fromLatin1(QUrl::toPercentEncoding(hostname())), (int)level);
+	settings.endGroup();
+}
+
+/**
+ * @brief 約1秒ごとに呼ばれ、ステータスバーの文字列とオーバーレイを更新し、統計ファイルに書き出す
+ */
+void SessionWidget::updateStatistics()
+{
+	if (!session_.isConnected()) return;
+
+	auto stats = presentStats();
+	auto mpx = [](quint64 pixels){
+		return QString::number(pixels / 1000000.0, 'f', 1);
+	};
+	auto ms = [](quint64 us){
+		return QString::number(us / 1000.0, 'f', 1);
+	};
+	double ratio = stats.presented_pixels ? (100.0 * stats.damaged_pixels / stats.presented_pixels) : 0.0;
+	auto frames = session_.frameStats();
+	updateQuality(frames.dropped - last_dropped_frames_);
+	last_dropped_frames_ = frames.dropped;
+	auto const &loop = session_.loopStats();
+	quint64 iterations = loop.iterations.load();
+	quint64 loops = iterations - last_iterations_;
+	last_iterations_ = iterations;
+	auto input = session_.inputStats();
+	auto const &last = last_input_stats_;
+	QString input_text = QString("Input %1/%2/%3 per sec (received/coalesced/sent)")
+						 .arg(input.received - last.received).arg(input.coalesced - last.coalesced).arg(input.sent - last.sent);
+	last_input_stats_ = input;
+	quint64 received_bytes = session_.receivedBytes();
+	auto const &gfx = session_.gfxStats();
+	Telemetry &telemetry = session_.telemetry();
+	auto const &decode = telemetry.histogram(Telemetry::Decode);
+	QString net_text = QString("Received %1 MB, GFX %2 frames (AVC %3), decode p50 %4 ms / p99 %5 ms")
+					   .arg(received_bytes / 1048576.0, 0, 'f', 1).arg(gfx.frames.load()).arg(gfx.avc_commands.load())
+					   .arg(decode.percentile(50) / 1000.0, 0, 'f', 1).arg(decode.percentile(99) / 1000.0, 0, 'f', 1);
+	QString text = QString("Damaged %1 Mpx / Presented %2 Mpx (%3%), Dropped %4/%5 frames, Loop %6/s (net %7, wake %8), %9, %10")
+				   .arg(mpx(stats.damaged_pixels)).arg(mpx(stats.presented_pixels)).arg(ratio, 0, 'f', 1)
+				   .arg(frames.dropped).arg(frames.published)
+				   .arg(loops).arg(loop.network.load()).arg(loop.wakeup.load())
+				   .arg(input_text).arg(net_text);
+	auto const &cache = session_.cacheStats();
+	quint64 cache_hits = cache.hits.load();
+	quint64 cache_lookups = cache_hits + cache.misses.load();
+	if (cache_lookups > 0) {
+		text += QString(", Cache hit %1% (persistent %2, saved %3 MB)")
+				.arg(100.0 * cache_hits / cache_lookups, 0, 'f', 1).arg(cache.persistent_hits.load())
+				.arg(cache.saved_bytes.load() / 1048576.0, 0, 'f', 1);
+	}
+	auto const &unchanged = session_.damageStats();
+	if (unchanged.skipped_pixels > 0) {
+		text += QString(", Unchanged %1 Mpx (%2 frames)").arg(mpx(unchanged.skipped_pixels.load())).arg(unchanged.skipped_frames.load());
+	}
+	if (stats.moved_pixels > 0) {
+		text += QString(", Scrolled %1 Mpx").arg(mpx(stats.moved_pixels));
+	}
+	if (stats.converted_pixels > 0) {
+		text += QString(", Converted %1 Mpx").arg(mpx(stats.converted_pixels));
+	}
+	int export_clients = session_.exportStats().clients.load();
+	if (export_clients > 0) {
+		text += QString(", Exported to %1").arg(export_clients);
+	}
+	auto const &output = session_.outputStats();
+	if (output.suppressing) {
+		text += ", Output suppressed";
+	}
+	if (output.delayed_acks || output.suppressed) {
+		text += QString(", Backpressure %1 delayed acks, %2 suppressed").arg(output.delayed_acks.load()).arg(output.suppressed.load());
+	}
+	if (adaptive_quality_) {
+		text += QString(", Quality %1 (%2 fps)").arg(QualityController::levelName(quality_.level())).arg(session_.targetFrameRate());
+	}
+	if (session_.isRecording()) {
+		auto rec = session_.recorderStats();
+		text += QString(", Rec %1 frames (%2 dropped, %3 MB)").arg(rec.frames).arg(rec.dropped).arg(rec.bytes / 1048576.0, 0, 'f', 1);
+	}
+	status_text_ = text;
+
+	// オーバーレイ
+	quint64 presented = stats.frames;
+	quint64 fps = presented - last_presented_frames_;
+	last_presented_frames_ = presented;
+	double received_mbps = (received_bytes - last_received_bytes_) * 8 / 1000000.0;
+	last_received_bytes_ = received_bytes;
+
+	Histogram const &present = telemetry.histogram(Telemetry::Present);
+	QStringList lines;
+	lines.append(QString("%1 fps").arg(fps));
+	lines.append(QString("Frame latency p50 %1 ms / p99 %2 ms").arg(ms(present.percentile(50))).arg(ms(present.percentile(99))));
+	lines.append(QString("Decode p99 %1 ms, Paint p99 %2 ms, Input p99 %3 ms")
+				 .arg(ms(telemetry.histogram(Telemetry::Decode).percentile(99)))
+				 .arg(ms(telemetry.histogram(Telemetry::Paint).percentile(99)))
+				 .arg(ms(telemetry.histogram(Telemetry::Input).percentile(99))));
+	lines.append(QString("RTT %1 ms").arg(telemetry.rtt()));
+	lines.append(QString("Bandwidth %1 Mbit/s (receiving %2 Mbit/s)").arg(telemetry.bandwidth() / 1000.0, 0, 'f', 1).arg(received_mbps, 0, 'f', 1));
+	view_->setOverlayText(lines);
+	if (!monitor_views_.empty()) {
+		// 複数モニターではプライマリモニターに表示する
+		monitor_views_.front()->setOverlayVisible(view_->isOverlayVisible());
+		monitor_views_.front()->setOverlayText(lines);
+	}
+
+	// 統計ファイル
+	if (telemetry_file_.isEmpty()) return;
+	if (++telemetry_counter_ < telemetry_interval_) return;
+	telemetry_counter_ = 0;
+
+	QJsonObject json = telemetry.toJson();
+	json["time"] = QDateTime::currentDateTime().toString(Qt::ISODateWithMs);
+	json["host"] = hostname();
+	json["fps"] = (qint64)fps;
+	json["received_bytes"] = (qint64)received_bytes;
+	json["frames_published"] = (qint64)frames.published;
+	json["frames_dropped"] = (qint64)frames.dropped;
+	json["delayed_acks"] = (qint64)output.delayed_acks.load();
+	json["output_suppressed"] = (qint64)output.suppressed.load();
+	json["unchanged_pixels"] = (qint64)session_.damageStats().skipped_pixels.load();
+	json["unchanged_frames"] = (qint64)session_.damageStats().skipped_frames.load();
+	json["moved_pixels"] = (qint64)stats.moved_pixels;
+	json["converted_pixels"] = (qint64)stats.converted_pixels;
+	if (adaptive_quality_) {
+		json["quality"] = QualityController::levelName(quality_.level());
+		json["quality_reason"] = quality_.reason();
+		json["target_fps"] = session_.targetFrameRate();
+	}
+	json["cache_imported"] = (qint64)cache.imported.load();
+	json["cache_hits"] = (qint64)cache_hits;
+	json["cache_misses"] = (qint64)cache.misses.load();
+	json["cache_persistent_hits"] = (qint64)cache.persistent_hits.load();
+	json["cache_saved_bytes"] = (qint64)cache.saved_bytes.load();
+	appendTelemetry(json);
+}
@@ -0,0 +1,105 @@
+#ifndef SESSIONWIDGET_H
+#define SESSIONWIDGET_H
+
+#include "QualityController.h"
+#include "Session.h"
+#include "MyView.h"
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QWidget>
+
+class QScreen;
+
+/**
+ * @brief 1つの接続を表示するタブ
+ *
+ * Session（FreeRDPのコンテキストとRDPスレッド）と、その画面を表示するMyViewを
+ * 持つ。動的解像度の変更と、毎秒の統計の集計もタブごとに行う。
+ * 複数モニターで接続した場合は、モニターごとにフルスクリーンのMyViewを
+ * トップレベルのウィンドウとして作り、それぞれに自分の出力を表示する。
+ */
+class SessionWidget : public QWidget {
+	Q_OBJECT
+public:
+	static constexpr int MIN_RESIZE_DELAY = 50; // ミリ秒
+	static constexpr int MAX_RESIZE_DELAY = 500;
+private:
+	Session session_;
+	MyView *view_ = nullptr;
+	bool multi_monitor_ = false; // 次の接続を複数モニターで行う
+	std::vector<MyView *> monitor_views_; // 複数モニターで接続中の、モニターごとのウィンドウ
+	QSize size_ { 1920, 1080 };
+	bool dynamic_resolution_ = false;
+	int dynamic_resize_counter_ = 0;
+	QElapsedTimer resize_clock_; // 前回のresizeEvent()からの時間
+	double resize_interval_ = 0; // resizeEvent()の間隔の移動平均（ミリ秒）。0ならリサイズ中ではない
+
+	// 毎秒の統計
+	quint64 last_iterations_ = 0;
+	InputQueue::Stats last_input_stats_;
+	quint64 last_presented_frames_ = 0;
+	quint64 last_received_bytes_ = 0;
+	QString telemetry_file_; // 統計を定期的に追記するファイル（JSON Lines）
+	int telemetry_interval_ = 10; // 秒
+	int telemetry_counter_ = 0;
+	QString status_text_;
+	bool timing_logged_ = false;
+
+	// 画質の自動調整
+	bool adaptive_quality_ = false;
+	QualityController quality_;
+	double last_decode_us_ = 0;
+	quint64 last_dropped_frames_ = 0;
+
+	std::vector<quint64> acquired_sequences_; // 出力ごとに、最後にビューに渡したフレーム
+
+	QSize newSize() const;
+	MyView *outputView(int output) const;
+	MyView::PresentStats presentStats() const;
+	void createMonitorViews(QList<QScreen *> const &screens);
+	void deleteMonitorViews();
+	std::vector<MyView *> views() const;
+	void resizeDynamic();
+	void updateQuality(quint64 dropped);
+	bool isOutputVisible() const;
+	void logConnectTiming(bool ok);
+	void appendTelemetry(const QJsonObject &json);
+private slots:
+	void updateScreen(int output);
+	void onConnectFinished(bool ok);
+	void onDisconnected();
+protected:
+	void resizeEvent(QResizeEvent *event) override;
+public:
+	explicit SessionWidget(QWidget *parent = nullptr);
+	~SessionWidget() override;
+
+	void connectToHost(Session::Options options);
+	void disconnectFromHost();
+	void closeLater();
+	bool isConnected() const;
+	bool isConnecting() const;
+	QString hostname() const;
+	MyView *view();
+	Session *session();
+
+	bool isDynamicResolution() const;
+	void setDynamicResolution(bool enabled);
+	bool isMultiMonitor() const;
+	void setMultiMonitor(bool enabled);
+	bool hasMonitorWindows() const;
+	bool isMonitorWindowsVisible() const;
+	void setMonitorWindowsVisible(bool visible);
+	MyView *monitorView(QObject *window) const;
+	void resizeDynamicLater();
+	void tick();
+	void setTelemetryFile(const QString &file, int interval);
+	void updateStatistics();
+	QString statusText() const;
+signals:
+	void connected(bool ok, const QString &error);
+	void progress(const QString &text);
+	void disconnected();
+};
+
+#endif // SESSIONWIDGET_H
@@ -0,0 +1,83 @@
+#include "Telemetry.h"
+
+char const *Telemetry::stageName(Stage stage)
+{
+	switch (stage) {
+	case Receive: return "receive";
+	case Process: return "process";
+	case Decode:  return "decode";
+	case Handoff: return "handoff";
+	case Paint:   return "paint";
+	case Present: return "present";
+	case Input:   return "input";
+	default:      return "";
+	}
+}
+
+void Telemetry::reset()
+{
+	for (Histogram &h : histograms_) {
+		h.reset();
+	}
+	rtt_ = 0;
+	bandwidth_ = 0;
+}
+
+Histogram &Telemetry::histogram(Stage stage)
+{
+	return histograms_[stage];
+}
+
+Histogram const &Telemetry::histogram(Stage stage) const
+{
+	return histograms_[stage];
+}
+
+void Telemetry::record(Stage stage, quint64 us)
+{
+	histograms_[stage].record(us);
+}
+
+/**
+ * @brief ネットワーク自動検出の結果を設定する
+ * @param rtt 平均RTT（ミリ秒）
+ * @param bandwidth 帯域（kbit/s）
+ */
+void Telemetry::setNetwork(quint32 rtt, quint32 bandwidth)
+{
+	rtt_.store(rtt, std::memory_order_relaxed);
+	bandwidth_.store(bandwidth, std::memory_order_relaxed);
+}
+
+quint32 Telemetry::rtt() const
+{
+	return rtt_.load(std::memory_order_relaxed);
+}
+
+quint32 Telemetry::bandwidth() const
+{
+	return bandwidth_.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 各段階の件数・平均・p50/p99・最大（マイクロ秒）
+ */
+QJsonObject Telemetry::toJson() const
+{
+	QJsonObject stages;
+	for (int i = 0; i < StageCount; i++) {
+		Histogram const &h = histograms_[i];
+		QJsonObject o;
+		o["count"] = (qint64)h.count();
+		o["mean"] = h.mean();
+		o["p50"] = (qint64)h.percentile(50);
+		o["p99"] = (qint64)h.percentile(99);
+		o["max"] = (qint64)h.max();
+		stages[stageName((Stage)i)] = o;
+	}
+	QJsonObject json;
+	json["stages"] = stages;
+	json["rtt_ms"] = (qint64)rtt();
+	json["bandwidth_kbps"] = (qint64)bandwidth();
+	return json;
+}
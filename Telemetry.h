@@ -0,0 +1,48 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "Histogram.h"
+#include <QJsonObject>
+#include <atomic>
+
+/**
+ * @brief 処理段階ごとの所要時間（マイクロ秒）の統計
+ *
+ * 各段階のヒストグラムはロックフリーなので、どのスレッドから記録してもよい。
+ * - Receive: 1つのPDUの受信（ソケットの読み込みとTLSの復号）
+ * - Process: freerdp_check_event_handles()の1回分
+ * - Decode: RDPGFXの1フレームのデコードと合成
+ * - Handoff: フレームを公開してからGUIスレッドが受け取るまで
+ * - Paint: MyView::paintEvent()の1回分
+ * - Present: フレームを公開してから描画し終わるまで
+ * - Input: 入力イベントを積んでから送信するまで
+ */
+class Telemetry {
+public:
+	enum Stage {
+		Receive,
+		Process,
+		Decode,
+		Handoff,
+		Paint,
+		Present,
+		Input,
+		StageCount,
+	};
+private:
+	Histogram histograms_[StageCount];
+	std::atomic<quint32> rtt_ { 0 };
+	std::atomic<quint32> bandwidth_ { 0 };
+public:
+	static char const *stageName(Stage stage);
+	void reset();
+	Histogram &histogram(Stage stage);
+	Histogram const &histogram(Stage stage) const;
+	void record(Stage stage, quint64 us);
+	void setNetwork(quint32 rtt, quint32 bandwidth);
+	quint32 rtt() const;
+	quint32 bandwidth() const;
+	QJsonObject toJson() const;
+};
+
+#endif // TELEMETRY_H
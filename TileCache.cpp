@@ -0,0 +1,256 @@
+#include "TileCache.h"
+#include "ImageScaler.h"
+#include <QPainter>
+#include <cmath>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 元画像の矩形に掛かるタイルの範囲（タイル単位）を返す
+ */
+QRect TileCache::tileRange(const QRect &rect)
+{
+	if (rect.isEmpty()) return {};
+	int x0 = rect.left() / TILE_SIZE;
+	int y0 = rect.top() / TILE_SIZE;
+	int x1 = rect.right() / TILE_SIZE;
+	int y1 = rect.bottom() / TILE_SIZE;
+	return QRect(QPoint(x0, y0), QPoint(x1, y1));
+}
+
+bool TileCache::isIntegerScale() const
+{
+	return scale_ == std::floor(scale_);
+}
+
+/**
+ * @brief 元画像の矩形を拡大縮小後の座標に変換する
+ */
+QRect TileCache::scaledRect(const QRect &rect) const
+{
+	int x0 = ImageScaler::scaledLength(rect.left(), scale_);
+	int y0 = ImageScaler::scaledLength(rect.top(), scale_);
+	int x1 = ImageScaler::scaledLength(rect.left() + rect.width(), scale_);
+	int y1 = ImageScaler::scaledLength(rect.top() + rect.height(), scale_);
+	return QRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * @brief タイルの拡大縮小後の座標
+ */
+QRect TileCache::tileRect(int tx, int ty, const Tile &tile) const
+{
+	QPoint origin(ImageScaler::scaledLength(tx * TILE_SIZE, scale_), ImageScaler::scaledLength(ty * TILE_SIZE, scale_));
+	return QRect(origin, tile.image.size());
+}
+
+void TileCache::clear()
+{
+	tiles_.clear();
+}
+
+double TileCache::scale() const
+{
+	return scale_;
+}
+
+void TileCache::setScale(double scale)
+{
+	if (scale_ != scale) {
+		scale_ = scale;
+		clear();
+	}
+}
+
+/**
+ * @brief 無効領域（元画像の座標）に触れたタイルを作り直し対象にする
+ */
+void TileCache::invalidate(const QRegion &region)
+{
+	if (tiles_.isEmpty()) return;
+	bool integer = isIntegerScale();
+	for (QRect const &r : region) {
+		// 補間する場合は隣の画素も参照するので、1画素広げる
+		QRect range = tileRange(integer ? r : r.adjusted(-1, -1, 1, 1));
+		for (int ty = range.top(); ty <= range.bottom(); ty++) {
+			for (int tx = range.left(); tx <= range.right(); tx++) {
+				auto it = tiles_.find(key(tx, ty));
+				if (it != tiles_.end()) {
+					it->dirty = true;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief 元画像の矩形rectがdeltaだけ移動した（スクロール）：拡大済みの画素を移す
+ *
+ * 移動先のタイルに、移動元のタイルの拡大済みの画素を写す。移動元が無いか
+ * 作り直し待ちのタイルは、移動先も作り直し対象にする。拡大後の移動量が
+ * 整数にならない倍率では画素の位置が合わないので、移動先を無効にする。
+ * タイルは複製せずにその場で書き換える。移動の向きと逆の端のタイルから順に
+ * 処理するので、移動元は書き換える前に読まれる（FrameExchange::moveRectと同じ）。
+ * タイル単位の移動でタイル全体が移る場合は、画像を入れ替えるだけで済ませる。
+ * @return 拡大済みの画素を移せた場合はtrue
+ */
+bool TileCache::move(const QRect &rect, const QPoint &delta)
+{
+	if (tiles_.isEmpty() || rect.isEmpty()) return true;
+	QRect dst = rect.translated(delta);
+	double sx = delta.x() * scale_;
+	double sy = delta.y() * scale_;
+	if (sx != std::floor(sx) || sy != std::floor(sy)) {
+		invalidate(dst);
+		return false;
+	}
+	QPoint sdelta((int)sx, (int)sy);
+	QRect sdst = scaledRect(dst);
+	bool whole = isIntegerScale() && delta.x() % TILE_SIZE == 0 && delta.y() % TILE_SIZE == 0;
+
+	QRect range = tileRange(dst);
+	int ty0 = delta.y() > 0 ? range.bottom() : range.top();
+	int ty1 = delta.y() > 0 ? range.top() : range.bottom();
+	int tx0 = delta.x() > 0 ? range.right() : range.left();
+	int tx1 = delta.x() > 0 ? range.left() : range.right();
+	int ystep = delta.y() > 0 ? -1 : 1;
+	int xstep = delta.x() > 0 ? -1 : 1;
+	for (int ty = ty0; ty != ty1 + ystep; ty += ystep) {
+		for (int tx = tx0; tx != tx1 + xstep; tx += xstep) {
+			auto it = tiles_.find(key(tx, ty));
+			if (it == tiles_.end() || it->dirty) continue;
+			QRect d = tileRect(tx, ty, *it);
+			QRect part = d.intersected(sdst);
+			if (part.isEmpty()) continue;
+
+			QRect tile(QPoint(tx, ty) * TILE_SIZE, QSize(TILE_SIZE, TILE_SIZE));
+			if (whole && dst.contains(tile)) {
+				// タイル全体が1つのタイルから移る：画像を入れ替える
+				QPoint u = QPoint(tx, ty) - QPoint(delta.x() / TILE_SIZE, delta.y() / TILE_SIZE);
+				auto o = tiles_.find(key(u.x(), u.y()));
+				if (o == tiles_.end() || o->dirty || o->image.size() != it->image.size() || o->image.format() != it->image.format()) {
+					it->dirty = true;
+					continue;
+				}
+				std::swap(it->image, o->image);
+				// 移動元のタイルは、この後で移動先として全体を書き換えられなければ作り直す
+				if (!dst.contains(QRect(u * TILE_SIZE, QSize(TILE_SIZE, TILE_SIZE)))) {
+					o->dirty = true;
+				}
+				continue;
+			}
+
+			QRect from = part.translated(-sdelta); // 拡大後の座標での移動元
+			QRect src = tile.intersected(dst).translated(-delta);
+			QRect srange = tileRange(src);
+			int bpp = it->image.depth() / 8;
+			uchar *bits = it->image.bits();
+			qsizetype stride = it->image.bytesPerLine();
+			// 自分自身から写す部分を先に写す（他のタイルから写す部分が上書きする画素を読むことがある）
+			std::vector<QPoint> sources;
+			if (srange.contains(tx, ty)) {
+				sources.push_back(QPoint(tx, ty));
+			}
+			for (int uy = srange.top(); uy <= srange.bottom(); uy++) {
+				for (int ux = srange.left(); ux <= srange.right(); ux++) {
+					if (ux != tx || uy != ty) {
+						sources.push_back(QPoint(ux, uy));
+					}
+				}
+			}
+			for (QPoint const &u : sources) {
+				auto o = tiles_.find(key(u.x(), u.y()));
+				if (o == tiles_.end() || o->dirty || o->image.format() != it->image.format()) {
+					it->dirty = true;
+					break;
+				}
+				QRect od = tileRect(u.x(), u.y(), *o);
+				QRect piece = od.intersected(from);
+				if (piece.isEmpty()) continue;
+				QPoint s = piece.topLeft() - od.topLeft();
+				QPoint t = piece.topLeft() + sdelta - d.topLeft();
+				qsizetype ostride = o->image.bytesPerLine();
+				uchar const *obits = o->image.constBits();
+				// 同じタイルの中で重なる場合は、移動の向きと逆の行から写す
+				bool backward = o == it && sdelta.y() > 0;
+				for (int i = 0; i < piece.height(); i++) {
+					int y = backward ? piece.height() - 1 - i : i;
+					memmove(bits + (t.y() + y) * stride + t.x() * bpp, obits + (s.y() + y) * ostride + s.x() * bpp, (size_t)piece.width() * bpp);
+				}
+			}
+		}
+	}
+
+	// 補間する場合、移動先の縁の画素は移動しなかった隣の画素も参照しているので作り直す
+	if (!isIntegerScale()) {
+		QRegion edge = QRegion(dst).subtracted(dst.adjusted(1, 1, -1, -1));
+		invalidate(edge);
+	}
+	return true;
+}
+
+/**
+ * @brief clip（ウィジェットの座標）に掛かるタイルを描画する
+ * @param origin 元画像の原点を描画する位置
+ * @return 拡大し直した元画像の画素数
+ */
+quint64 TileCache::draw(QPainter *pr, const QImage &source, const QPoint &origin, const QRect &clip)
+{
+	quint64 scaled_pixels = 0;
+	QRect bounds(QPoint(0, 0), source.size());
+	QRect area = QRect(clip.topLeft() - origin, clip.size());
+	int ax = (int)std::floor(area.x() / scale_);
+	int ay = (int)std::floor(area.y() / scale_);
+	area = QRect(ax, ay, (int)std::ceil(area.width() / scale_) + 2, (int)std::ceil(area.height() / scale_) + 2).intersected(bounds);
+
+	ImageScaler::Source src;
+	src.bits = source.constBits();
+	src.width = source.width();
+	src.height = source.height();
+	src.stride = source.bytesPerLine();
+
+	QRect range = tileRange(area);
+	for (int ty = range.top(); ty <= range.bottom(); ty++) {
+		for (int tx = range.left(); tx <= range.right(); tx++) {
+			QRect r = QRect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE).intersected(bounds);
+			QRect d = scaledRect(r);
+			if (d.isEmpty()) continue;
+			Tile &tile = tiles_[key(tx, ty)];
+			if (tile.dirty || tile.image.size() != d.size() || tile.image.format() != source.format()) {
+				if (tile.image.size() != d.size() || tile.image.format() != source.format()) {
+					tile.image = QImage(d.size(), source.format());
+				}
+				ImageScaler::Target dst;
+				dst.bits = tile.image.bits();
+				dst.stride = tile.image.bytesPerLine();
+				dst.x = d.x();
+				dst.y = d.y();
+				dst.width = d.width();
+				dst.height = d.height();
+				ImageScaler::scale(src, dst, scale_);
+				tile.dirty = false;
+				scaled_pixels += (quint64)r.width() * r.height();
+			}
+			pr->drawImage(origin + d.topLeft(), tile.image);
+		}
+	}
+	return scaled_pixels;
+}
+
+/**
+ * @brief visible（元画像の座標）から外れたタイルを破棄する
+ */
+void TileCache::evictOutside(const QRect &visible)
+{
+	QRect range = tileRange(visible);
+	for (auto it = tiles_.begin(); it != tiles_.end();) {
+		int tx = it.key() & 0xffff;
+		int ty = it.key() >> 16;
+		if (range.contains(tx, ty)) {
+			++it;
+		} else {
+			it = tiles_.erase(it);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QHash>
+#include <QImage>
+#include <QRegion>
+
+class QPainter;
+
+/**
+ * @brief 拡大縮小済み画面をタイル単位で保持するキャッシュ
+ *
+ * 元画像をTILE_SIZE四方のタイルに分割し、表示範囲にあるタイルだけを必要に
+ * なった時点で拡大縮小する。無効領域に触れたタイルだけを作り直す。
+ * 画面のスクロールは、拡大済みの画素をタイルの間で移すだけで済ませる。
+ */
+class TileCache {
+public:
+	static constexpr int TILE_SIZE = 64;
+private:
+	struct Tile {
+		QImage image;
+		bool dirty = true;
+	};
+	QHash<quint32, Tile> tiles_;
+	double scale_ = 1;
+
+	static quint32 key(int tx, int ty)
+	{
+		return ((quint32)ty << 16) | (quint32)tx;
+	}
+	static QRect tileRange(const QRect &rect);
+	bool isIntegerScale() const;
+	QRect scaledRect(const QRect &rect) const;
+	QRect tileRect(int tx, int ty, const Tile &tile) const;
+public:
+	void clear();
+	double scale() const;
+	void setScale(double scale);
+	void invalidate(const QRegion &region);
+	bool move(const QRect &rect, const QPoint &delta);
+	quint64 draw(QPainter *pr, const QImage &source, const QPoint &origin, const QRect &clip);
+	void evictOutside(const QRect &visible);
+};
+
+#endif // TILECACHE_H
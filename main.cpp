@@ -1,9 +1,18 @@
 #include "MainWindow.h"
+#include "ExportBenchmark.h"
+#include "ExportClient.h"
 #include "Global.h"
+#include "LoadGenerator.h"
+#include "RecordingPlayer.h"
+#include "ReplayBenchmark.h"
+#include "ScaleBenchmark.h"
 #include <QApplication>
 #include <QFileInfo>
 #include <QStandardPaths>
 #include "joinpath.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 ApplicationGlobal *global;
 
@@ -11,6 +20,17 @@ int main(int argc, char *argv[])
 {
 	qputenv("QT_ASSUME_STDERR_HAS_CONSOLE", "1");
 
+	if (argc > 1 && strcmp(argv[1], "--bench-scale") == 0) {
+		return runScaleBenchmark();
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-export") == 0) {
+		QCoreApplication a(argc, argv);
+		return runExportBenchmark();
+	}
+	if (argc > 2 && strcmp(argv[1], "--export-consumer") == 0) {
+		return runExportConsumer(QString::fromLocal8Bit(argv[2]));
+	}
+
 	ApplicationGlobal g;
 	global = &g;
 
@@ -21,8 +41,48 @@ int main(int argc, char *argv[])
 	global->app_config_dir = global->generic_config_dir / global->organization_name / global->application_name;
 	global->config_file_path = joinpath(global->app_config_dir, global->application_name + ".ini");
 
+	if (argc > 1 && strcmp(argv[1], "--load") == 0) {
+		QCoreApplication a(argc, argv);
+		return runLoadGenerator(argc, argv);
+	}
+
+	QString replay_file;
+	QString play_file;
+	double replay_scale = 1;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0) {
+			global->record_file = QString::fromLocal8Bit(argv[++i]);
+		} else if (strcmp(argv[i], "--replay") == 0) {
+			replay_file = QString::fromLocal8Bit(argv[++i]);
+		} else if (strcmp(argv[i], "--play") == 0) {
+			play_file = QString::fromLocal8Bit(argv[++i]);
+		} else if (strcmp(argv[i], "--export") == 0) {
+			global->export_name = QString::fromLocal8Bit(argv[++i]);
+		} else if (strcmp(argv[i], "--scale") == 0) {
+			replay_scale = atof(argv[++i]);
+		}
+	}
+	if (!replay_file.isEmpty()) {
+		if (replay_scale <= 0) {
+			replay_scale = 1;
+		}
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+		QGuiApplication a(argc, argv);
+		return runReplayBenchmark(replay_file, replay_scale);
+	}
+
 	QApplication a(argc, argv);
 
+	if (!play_file.isEmpty()) {
+		RecordingPlayer player;
+		if (!player.open(play_file)) {
+			fprintf(stderr, "failed to open %s\n", play_file.toUtf8().constData());
+			return 1;
+		}
+		player.show();
+		return a.exec();
+	}
+
 	MainWindow w;
 	global->mainwindow = &w;
 